@@ -0,0 +1,24 @@
+#pragma once
+#include <glad/glad.h>
+
+#include "BRDFLUTData.h"
+
+// The split-sum BRDF LUT only depends on NdotV and roughness, so instead of integrating it at every startup the
+// renderer uploads the precomputed table from BRDFLUTData.h (regenerate it with EVCBake --brdf-lut).
+namespace BRDFLUT
+{
+    inline unsigned int createTexture()
+    {
+        unsigned int brdfLUTTexture;
+        glGenTextures(1, &brdfLUTTexture);
+        glBindTexture(GL_TEXTURE_2D, brdfLUTTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, BRDF_LUT_SIZE, BRDF_LUT_SIZE, 0, GL_RG, GL_HALF_FLOAT, BRDF_LUT_DATA);
+        // be sure to set wrapping mode to GL_CLAMP_TO_EDGE
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        return brdfLUTTexture;
+    }
+}
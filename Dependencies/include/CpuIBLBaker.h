@@ -0,0 +1,581 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include "ThreadPool.h"
+#include "IBLConfig.h"
+#include "IBLCacheFile.h"
+#include "IBLSampling.h"
+#include "SphericalHarmonics.h"
+#include "OctahedralMap.h"
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define EVC_CPU_BAKER_SSE2 1
+#endif
+
+// RGB float image, rows stored bottom-up like a GL texture
+struct CpuImage
+{
+    int width = 0;
+    int height = 0;
+    std::vector<float> pixels;
+};
+
+// RGB float cubemap with a chain of mip levels. Faces follow GL_TEXTURE_CUBE_MAP_POSITIVE_X + i and every face is
+// stored in GL texel order, so the images can be uploaded (or written to an IBL cache file) unchanged.
+struct CpuCubemap
+{
+    int size = 0;
+    int levels = 0;
+    std::vector<std::vector<float>> images; // [level * 6 + face]
+
+    void allocate(int faceSize, int levelCount)
+    {
+        size = faceSize;
+        levels = levelCount;
+        images.assign(levels * 6, std::vector<float>());
+        for (int level = 0; level < levels; ++level)
+            for (int face = 0; face < 6; ++face)
+                images[level * 6 + face].assign(static_cast<size_t>(levelSize(level)) * levelSize(level) * 3, 0.0f);
+    }
+
+    int levelSize(int level) const { return std::max(1, size >> level); }
+    float* face(int level, int face) { return images[level * 6 + face].data(); }
+    const float* face(int level, int face) const { return images[level * 6 + face].data(); }
+};
+
+// CPU port of the IBL bake shaders (equirectangular_to_cubemap, irradiance_convolution, prefilter and brdf).
+// Every stage is split over the faces/rows of its output on a thread pool, and the inner sample loops run
+// four samples at a time with SSE2 where available. The results are written as IBL cache records, so a
+// batch bake on a machine without a GPU produces exactly the files the renderer looks for at startup.
+class CpuIBLBaker
+{
+public:
+    CpuIBLBaker(ThreadPool& pool, const IBLConfig& config) : pool(pool), config(config)
+    {
+    }
+
+    // equirectangular projection -> cubemap faces, then a full mip chain (like glGenerateMipmap)
+    void equirectangularToCubemap(const CpuImage& equirect, CpuCubemap& env)
+    {
+        const int size = config.environmentSize;
+        int levels = 1;
+        while ((size >> levels) > 0)
+            ++levels;
+        env.allocate(size, levels);
+
+        pool.parallelFor(6 * size, [&](size_t job)
+        {
+            const int face = static_cast<int>(job / size);
+            const int y = static_cast<int>(job % size);
+            float* row = env.face(0, face) + static_cast<size_t>(y) * size * 3;
+            for (int x = 0; x < size; ++x)
+            {
+                glm::vec3 v = glm::normalize(texelDirection(face, (x + 0.5f) / size, (y + 0.5f) / size));
+                // same constants as SampleSphericalMap() in the shader
+                float u = std::atan2(v.z, v.x) * 0.1591f + 0.5f;
+                float w = std::asin(v.y) * 0.3183f + 0.5f;
+                sampleImage(equirect.pixels.data(), equirect.width, equirect.height, u, w, row + x * 3);
+            }
+        });
+        generateMipmaps(env);
+    }
+
+    // 2x2 box filter down the mip chain
+    void generateMipmaps(CpuCubemap& cube)
+    {
+        for (int level = 1; level < cube.levels; ++level)
+        {
+            const int size = cube.levelSize(level);
+            const int parentSize = cube.levelSize(level - 1);
+            pool.parallelFor(6 * size, [&](size_t job)
+            {
+                const int face = static_cast<int>(job / size);
+                const int y = static_cast<int>(job % size);
+                const float* parent = cube.face(level - 1, face);
+                float* row = cube.face(level, face) + static_cast<size_t>(y) * size * 3;
+                const int y0 = std::min(2 * y, parentSize - 1), y1 = std::min(2 * y + 1, parentSize - 1);
+                for (int x = 0; x < size; ++x)
+                {
+                    const int x0 = std::min(2 * x, parentSize - 1), x1 = std::min(2 * x + 1, parentSize - 1);
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        row[x * 3 + c] = 0.25f * (parent[(y0 * parentSize + x0) * 3 + c] + parent[(y0 * parentSize + x1) * 3 + c] +
+                                                  parent[(y1 * parentSize + x0) * 3 + c] + parent[(y1 * parentSize + x1) * 3 + c]);
+                    }
+                }
+            });
+        }
+    }
+
+    // Riemann sum over the hemisphere, see 2.2.2.irradiance_convolution.fs
+    void convolveIrradiance(const CpuCubemap& env, CpuCubemap& irradiance)
+    {
+        const int size = config.irradianceSize;
+        irradiance.allocate(size, 1);
+
+        // the hemisphere samples are the same for every texel; only the tangent frame changes
+        SampleSet samples;
+        const float sampleDelta = 0.025f;
+        int nrSamples = 0;
+        for (float phi = 0.0f; phi < 2.0f * IBLSampling::PI; phi += sampleDelta)
+        {
+            for (float theta = 0.0f; theta < 0.5f * IBLSampling::PI; theta += sampleDelta)
+            {
+                samples.add(glm::vec3(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta)),
+                            std::cos(theta) * std::sin(theta), 0.0f);
+                ++nrSamples;
+            }
+        }
+        samples.pad();
+        const float scale = IBLSampling::PI / float(nrSamples);
+
+        pool.parallelFor(6 * size, [&](size_t job)
+        {
+            const int face = static_cast<int>(job / size);
+            const int y = static_cast<int>(job % size);
+            float* row = irradiance.face(0, face) + static_cast<size_t>(y) * size * 3;
+            for (int x = 0; x < size; ++x)
+            {
+                glm::vec3 N = glm::normalize(texelDirection(face, (x + 0.5f) / size, (y + 0.5f) / size));
+                glm::vec3 up(0.0f, 1.0f, 0.0f);
+                glm::vec3 right = glm::normalize(glm::cross(up, N));
+                up = glm::normalize(glm::cross(N, right));
+
+                glm::vec3 sum = integrate(env, samples, right, up, N, false);
+                row[x * 3 + 0] = sum.r * scale;
+                row[x * 3 + 1] = sum.g * scale;
+                row[x * 3 + 2] = sum.b * scale;
+            }
+        });
+    }
+
+    // split-sum pre-filtered radiance, one roughness per mip level, see prefilter.fs
+    void prefilter(const CpuCubemap& env, CpuCubemap& prefiltered)
+    {
+        const int levels = config.prefilterMipLevels;
+        prefiltered.allocate(config.prefilterSize, levels);
+
+        for (int mip = 0; mip < levels; ++mip)
+        {
+            const float roughness = levels > 1 ? float(mip) / float(levels - 1) : 0.0f;
+            SampleSet samples;
+            for (const glm::vec4& sample : IBLSampling::prefilterSamples(roughness, IBLSampling::prefilterSampleCount(mip, config.sampleCount), config.environmentSize))
+                samples.add(glm::vec3(sample), sample.z, sample.w);
+            samples.pad();
+            const float totalWeight = samples.totalWeight;
+
+            const int size = prefiltered.levelSize(mip);
+            pool.parallelFor(6 * size, [&](size_t job)
+            {
+                const int face = static_cast<int>(job / size);
+                const int y = static_cast<int>(job % size);
+                float* row = prefiltered.face(mip, face) + static_cast<size_t>(y) * size * 3;
+                for (int x = 0; x < size; ++x)
+                {
+                    glm::vec3 N = glm::normalize(texelDirection(face, (x + 0.5f) / size, (y + 0.5f) / size));
+                    glm::vec3 tangent, bitangent;
+                    IBLSampling::tangentBasis(N, tangent, bitangent);
+
+                    glm::vec3 sum = integrate(env, samples, tangent, bitangent, N, true);
+                    row[x * 3 + 0] = sum.r / totalWeight;
+                    row[x * 3 + 1] = sum.g / totalWeight;
+                    row[x * 3 + 2] = sum.b / totalWeight;
+                }
+            });
+        }
+    }
+
+    // split-sum BRDF integration LUT (scale, bias) with NdotV along x and roughness along y, see 2.2.2.brdf.fs.
+    // It doesn't depend on the environment; EVCBake --brdf-lut turns it into the LUT embedded in the renderer.
+    void integrateBRDF(int size, std::vector<float>& lut)
+    {
+        const uint32_t sampleCount = config.sampleCount;
+        lut.assign(static_cast<size_t>(size) * size * 2, 0.0f);
+
+        pool.parallelFor(size, [&](size_t job)
+        {
+            const int y = static_cast<int>(job);
+            const float roughness = (y + 0.5f) / size;
+            const float k = (roughness * roughness) / 2.0f; // IBL remapping of k
+
+            // halfway vectors for this roughness. The shader's tangent frame around N = +Z maps (x, y, z) to (y, -x, z).
+            const uint32_t padded = (sampleCount + 3) & ~3u;
+            std::vector<float> hx(padded, 0.0f), hz(padded, 1.0f), valid(padded, 0.0f);
+            for (uint32_t i = 0; i < sampleCount; ++i)
+            {
+                glm::vec3 H = IBLSampling::importanceSampleGGX(IBLSampling::hammersley(i, sampleCount), roughness);
+                hx[i] = H.y;
+                hz[i] = H.z;
+                valid[i] = 1.0f;
+            }
+
+            float* row = lut.data() + static_cast<size_t>(y) * size * 2;
+            for (int x = 0; x < size; ++x)
+            {
+                const float NdotV = (x + 0.5f) / size;
+                const float Vx = std::sqrt(1.0f - NdotV * NdotV);
+                const float gV = NdotV / (NdotV * (1.0f - k) + k);
+                float A = 0.0f, B = 0.0f;
+                integrateBRDFRow(hx.data(), hz.data(), valid.data(), padded, Vx, NdotV, k, gV, A, B);
+                row[x * 2 + 0] = A / float(sampleCount);
+                row[x * 2 + 1] = B / float(sampleCount);
+            }
+        });
+    }
+
+    // irradiance SH of the environment. Projecting a small mip is plenty for a band-limited signal.
+    void projectIrradianceSH(const CpuCubemap& env, glm::vec3* coefficients)
+    {
+        int level = 0;
+        while (level + 1 < env.levels && env.levelSize(level) > SphericalHarmonics::SOURCE_SIZE)
+            ++level;
+        const float* faces[6];
+        for (int face = 0; face < 6; ++face)
+            faces[face] = env.face(level, face);
+        SphericalHarmonics::project(pool, faces, env.levelSize(level), coefficients);
+        SphericalHarmonics::irradiance(coefficients);
+    }
+
+    // bakes every product and returns them as IBL cache contents
+    IBLCacheContents bake(const CpuImage& equirect)
+    {
+        CpuCubemap env, prefiltered;
+        IBLCacheContents contents;
+        equirectangularToCubemap(equirect, env);
+        contents.textures.push_back(record(IBLCacheFile::SLOT_ENVIRONMENT, env, GL_LINEAR_MIPMAP_LINEAR));
+        if (config.irradianceSH)
+        {
+            projectIrradianceSH(env, contents.irradianceSH);
+            contents.hasIrradianceSH = true;
+        }
+        else
+        {
+            CpuCubemap irradiance;
+            convolveIrradiance(env, irradiance);
+            contents.textures.push_back(record(IBLCacheFile::SLOT_IRRADIANCE, irradiance, GL_LINEAR));
+        }
+        prefilter(env, prefiltered);
+        contents.textures.push_back(record(IBLCacheFile::SLOT_PREFILTER, prefiltered, GL_LINEAR_MIPMAP_LINEAR));
+        return contents;
+    }
+
+    // direction through texel (s, t) of a cubemap face, following the GL cubemap face conventions
+    static glm::vec3 texelDirection(int face, float s, float t)
+    {
+        float sc = 2.0f * s - 1.0f;
+        float tc = 2.0f * t - 1.0f;
+        switch (face)
+        {
+        case 0: return glm::vec3(1.0f, -tc, -sc);
+        case 1: return glm::vec3(-1.0f, -tc, sc);
+        case 2: return glm::vec3(sc, 1.0f, tc);
+        case 3: return glm::vec3(sc, -1.0f, -tc);
+        case 4: return glm::vec3(sc, -tc, 1.0f);
+        default: return glm::vec3(-sc, -tc, -1.0f);
+        }
+    }
+
+    // face index and face coordinates of a direction, the inverse of texelDirection()
+    static void faceCoordinates(float x, float y, float z, int& face, float& s, float& t)
+    {
+        float ax = std::abs(x), ay = std::abs(y), az = std::abs(z);
+        float ma, sc, tc;
+        if (ax >= ay && ax >= az)
+        {
+            face = x >= 0.0f ? 0 : 1;
+            ma = ax;
+            sc = x >= 0.0f ? -z : z;
+            tc = -y;
+        }
+        else if (ay >= az)
+        {
+            face = y >= 0.0f ? 2 : 3;
+            ma = ay;
+            sc = x;
+            tc = y >= 0.0f ? z : -z;
+        }
+        else
+        {
+            face = z >= 0.0f ? 4 : 5;
+            ma = az;
+            sc = z >= 0.0f ? x : -x;
+            tc = -y;
+        }
+        s = 0.5f * sc / ma + 0.5f;
+        t = 0.5f * tc / ma + 0.5f;
+    }
+
+    // bilinear lookup with clamp-to-edge addressing
+    static void sampleImage(const float* image, int width, int height, float u, float v, float* rgb)
+    {
+        float fx = u * width - 0.5f, fy = v * height - 0.5f;
+        int x0 = static_cast<int>(std::floor(fx)), y0 = static_cast<int>(std::floor(fy));
+        float tx = fx - x0, ty = fy - y0;
+        int x1 = std::min(std::max(x0 + 1, 0), width - 1), y1 = std::min(std::max(y0 + 1, 0), height - 1);
+        x0 = std::min(std::max(x0, 0), width - 1);
+        y0 = std::min(std::max(y0, 0), height - 1);
+
+        const float* p00 = image + (static_cast<size_t>(y0) * width + x0) * 3;
+        const float* p10 = image + (static_cast<size_t>(y0) * width + x1) * 3;
+        const float* p01 = image + (static_cast<size_t>(y1) * width + x0) * 3;
+        const float* p11 = image + (static_cast<size_t>(y1) * width + x1) * 3;
+        for (int c = 0; c < 3; ++c)
+        {
+            float top = p00[c] + (p10[c] - p00[c]) * tx;
+            float bottom = p01[c] + (p11[c] - p01[c]) * tx;
+            rgb[c] = top + (bottom - top) * ty;
+        }
+    }
+
+    // trilinear lookup of a cubemap face
+    static void sampleCubeFace(const CpuCubemap& cube, int face, float s, float t, float lod, float* rgb)
+    {
+        lod = std::min(std::max(lod, 0.0f), float(cube.levels - 1));
+        int level0 = static_cast<int>(lod);
+        int level1 = std::min(level0 + 1, cube.levels - 1);
+        float blend = lod - level0;
+
+        sampleImage(cube.face(level0, face), cube.levelSize(level0), cube.levelSize(level0), s, t, rgb);
+        if (blend > 0.0f && level1 != level0)
+        {
+            float upper[3];
+            sampleImage(cube.face(level1, face), cube.levelSize(level1), cube.levelSize(level1), s, t, upper);
+            for (int c = 0; c < 3; ++c)
+                rgb[c] += (upper[c] - rgb[c]) * blend;
+        }
+    }
+
+private:
+    ThreadPool& pool;
+    IBLConfig config;
+
+    // tangent-space sample directions with a weight and a source mip level each, stored as structure of arrays
+    // and padded to a multiple of four (padding samples point along N with zero weight)
+    struct SampleSet
+    {
+        std::vector<float> x, y, z, weight, lod;
+        float totalWeight = 0.0f;
+
+        void add(const glm::vec3& direction, float w, float level)
+        {
+            x.push_back(direction.x);
+            y.push_back(direction.y);
+            z.push_back(direction.z);
+            weight.push_back(w);
+            lod.push_back(level);
+            totalWeight += w;
+        }
+
+        void pad()
+        {
+            while (x.size() % 4 != 0)
+                add(glm::vec3(0.0f, 0.0f, 1.0f), 0.0f, 0.0f);
+        }
+
+        size_t size() const { return x.size(); }
+    };
+
+    // sum of weight * env(T * s.x + B * s.y + N * s.z) over a sample set. Directions and cube face coordinates are
+    // computed for four samples at once; the texel fetches themselves stay scalar.
+    static glm::vec3 integrate(const CpuCubemap& env, const SampleSet& samples, const glm::vec3& T, const glm::vec3& B, const glm::vec3& N, bool useLod)
+    {
+        float sum[3] = { 0.0f, 0.0f, 0.0f };
+        int face[4];
+        float s[4], t[4];
+        for (size_t i = 0; i < samples.size(); i += 4)
+        {
+            faceCoordinates4(&samples.x[i], &samples.y[i], &samples.z[i], T, B, N, face, s, t);
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                const float weight = samples.weight[i + lane];
+                if (weight == 0.0f)
+                    continue;
+                float rgb[3];
+                if (useLod)
+                    sampleCubeFace(env, face[lane], s[lane], t[lane], samples.lod[i + lane], rgb);
+                else
+                    sampleImage(env.face(0, face[lane]), env.size, env.size, s[lane], t[lane], rgb);
+                sum[0] += rgb[0] * weight;
+                sum[1] += rgb[1] * weight;
+                sum[2] += rgb[2] * weight;
+            }
+        }
+        return glm::vec3(sum[0], sum[1], sum[2]);
+    }
+
+#ifdef EVC_CPU_BAKER_SSE2
+    static __m128 select(__m128 mask, __m128 a, __m128 b)
+    {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+
+    // rotates four tangent-space directions into the frame (T, B, N) and finds their cube faces and face coordinates
+    static void faceCoordinates4(const float* sx, const float* sy, const float* sz, const glm::vec3& T, const glm::vec3& B, const glm::vec3& N,
+                                 int* face, float* s, float* t)
+    {
+        const __m128 lx = _mm_loadu_ps(sx), ly = _mm_loadu_ps(sy), lz = _mm_loadu_ps(sz);
+        const __m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, _mm_set1_ps(T.x)), _mm_mul_ps(ly, _mm_set1_ps(B.x))), _mm_mul_ps(lz, _mm_set1_ps(N.x)));
+        const __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, _mm_set1_ps(T.y)), _mm_mul_ps(ly, _mm_set1_ps(B.y))), _mm_mul_ps(lz, _mm_set1_ps(N.y)));
+        const __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, _mm_set1_ps(T.z)), _mm_mul_ps(ly, _mm_set1_ps(B.z))), _mm_mul_ps(lz, _mm_set1_ps(N.z)));
+
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        const __m128 ax = _mm_andnot_ps(signMask, x), ay = _mm_andnot_ps(signMask, y), az = _mm_andnot_ps(signMask, z);
+        const __m128 xMajor = _mm_and_ps(_mm_cmpge_ps(ax, ay), _mm_cmpge_ps(ax, az));
+        const __m128 yMajor = _mm_andnot_ps(xMajor, _mm_cmpge_ps(ay, az));
+
+        // sc/tc per major axis; multiplying by the sign of the major component is a sign-bit xor
+        const __m128 xSign = _mm_and_ps(x, signMask), ySign = _mm_and_ps(y, signMask), zSign = _mm_and_ps(z, signMask);
+        const __m128 negZ = _mm_xor_ps(z, signMask), negY = _mm_xor_ps(y, signMask);
+        const __m128 sc = select(xMajor, _mm_xor_ps(negZ, xSign), select(yMajor, x, _mm_xor_ps(x, zSign)));
+        const __m128 tc = select(yMajor, _mm_xor_ps(z, ySign), negY);
+        const __m128 ma = select(xMajor, ax, select(yMajor, ay, az));
+
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 scale = _mm_div_ps(half, ma);
+        _mm_storeu_ps(s, _mm_add_ps(_mm_mul_ps(sc, scale), half));
+        _mm_storeu_ps(t, _mm_add_ps(_mm_mul_ps(tc, scale), half));
+
+        // face = base (0, 2 or 4) + 1 for the negative direction
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 negative = _mm_and_ps(_mm_cmplt_ps(select(xMajor, x, select(yMajor, y, z)), _mm_setzero_ps()), one);
+        const __m128 base = select(xMajor, _mm_setzero_ps(), select(yMajor, _mm_set1_ps(2.0f), _mm_set1_ps(4.0f)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(face), _mm_cvttps_epi32(_mm_add_ps(base, negative)));
+    }
+
+    // accumulates the scale (A) and bias (B) terms of the BRDF integral for one NdotV, four samples at a time
+    static void integrateBRDFRow(const float* hx, const float* hz, const float* valid, uint32_t count, float Vx, float NdotV, float k, float gV,
+                                 float& A, float& B)
+    {
+        const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f);
+        const __m128 vx = _mm_set1_ps(Vx), nv = _mm_set1_ps(NdotV), kk = _mm_set1_ps(k), oneMinusK = _mm_set1_ps(1.0f - k);
+        const __m128 gv = _mm_set1_ps(gV);
+        __m128 sumA = zero, sumB = zero;
+        for (uint32_t i = 0; i < count; i += 4)
+        {
+            const __m128 Hx = _mm_loadu_ps(hx + i), Hz = _mm_loadu_ps(hz + i);
+            const __m128 VdotH = _mm_max_ps(_mm_add_ps(_mm_mul_ps(vx, Hx), _mm_mul_ps(nv, Hz)), zero);
+            const __m128 NdotL = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(two, VdotH), Hz), nv);
+            const __m128 mask = _mm_and_ps(_mm_cmpgt_ps(NdotL, zero), _mm_cmpgt_ps(_mm_loadu_ps(valid + i), zero));
+
+            const __m128 gL = _mm_div_ps(NdotL, _mm_add_ps(_mm_mul_ps(NdotL, oneMinusK), kk));
+            const __m128 G_Vis = _mm_div_ps(_mm_mul_ps(_mm_mul_ps(gL, gv), VdotH), _mm_mul_ps(Hz, nv));
+            const __m128 f = _mm_sub_ps(one, VdotH);
+            const __m128 f2 = _mm_mul_ps(f, f);
+            const __m128 Fc = _mm_mul_ps(_mm_mul_ps(f2, f2), f);
+
+            sumA = _mm_add_ps(sumA, _mm_and_ps(mask, _mm_mul_ps(_mm_sub_ps(one, Fc), G_Vis)));
+            sumB = _mm_add_ps(sumB, _mm_and_ps(mask, _mm_mul_ps(Fc, G_Vis)));
+        }
+        float a[4], b[4];
+        _mm_storeu_ps(a, sumA);
+        _mm_storeu_ps(b, sumB);
+        A += a[0] + a[1] + a[2] + a[3];
+        B += b[0] + b[1] + b[2] + b[3];
+    }
+#else
+    static void faceCoordinates4(const float* sx, const float* sy, const float* sz, const glm::vec3& T, const glm::vec3& B, const glm::vec3& N,
+                                 int* face, float* s, float* t)
+    {
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            glm::vec3 d = T * sx[lane] + B * sy[lane] + N * sz[lane];
+            faceCoordinates(d.x, d.y, d.z, face[lane], s[lane], t[lane]);
+        }
+    }
+
+    static void integrateBRDFRow(const float* hx, const float* hz, const float* valid, uint32_t count, float Vx, float NdotV, float k, float gV,
+                                 float& A, float& B)
+    {
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            float VdotH = std::max(Vx * hx[i] + NdotV * hz[i], 0.0f);
+            float NdotL = 2.0f * VdotH * hz[i] - NdotV;
+            if (NdotL <= 0.0f || valid[i] == 0.0f)
+                continue;
+            float gL = NdotL / (NdotL * (1.0f - k) + k);
+            float G_Vis = (gL * gV * VdotH) / (hz[i] * NdotV);
+            float Fc = std::pow(1.0f - VdotH, 5.0f);
+            A += (1.0f - Fc) * G_Vis;
+            B += Fc * G_Vis;
+        }
+    }
+#endif
+
+    static std::vector<char> toHalf(const float* data, size_t count)
+    {
+        std::vector<char> bytes(count * 2);
+        uint16_t* halves = reinterpret_cast<uint16_t*>(bytes.data());
+        for (size_t i = 0; i < count; ++i)
+            halves[i] = glm::packHalf1x16(data[i]);
+        return bytes;
+    }
+
+    // the cache record of a baked cubemap, as a cubemap or as an octahedral map depending on the configuration
+    IBLCacheTexture record(uint32_t slot, const CpuCubemap& cube, uint32_t minFilter)
+    {
+        return config.octahedral ? octahedralRecord(slot, cube, minFilter) : cubemapRecord(slot, cube, minFilter);
+    }
+
+    // resamples every level of the cubemap into the matching level of an octahedral map, like OctahedralEncoder
+    IBLCacheTexture octahedralRecord(uint32_t slot, const CpuCubemap& cube, uint32_t minFilter)
+    {
+        const int size = OctahedralMap::sizeForFace(cube.size);
+        IBLCacheTexture texture;
+        texture.slot = slot;
+        texture.target = GL_TEXTURE_2D;
+        texture.internalFormat = GL_RGB16F;
+        texture.format = GL_RGB;
+        texture.type = GL_HALF_FLOAT;
+        texture.minFilter = minFilter;
+        texture.magFilter = GL_LINEAR;
+        texture.width = texture.height = size;
+        texture.levels = OctahedralMap::levelCount(size, cube.levels);
+        texture.faces = 1;
+        for (uint32_t level = 0; level < texture.levels; ++level)
+        {
+            const int levelSize = size >> level;
+            const int faceSize = cube.levelSize(level);
+            std::vector<float> image(static_cast<size_t>(levelSize) * levelSize * 3);
+            pool.parallelFor(levelSize, [&](size_t job)
+            {
+                const int y = static_cast<int>(job);
+                float* row = image.data() + static_cast<size_t>(y) * levelSize * 3;
+                for (int x = 0; x < levelSize; ++x)
+                {
+                    glm::vec3 direction = OctahedralMap::texelDirection(x, y, levelSize);
+                    int face;
+                    float s, t;
+                    faceCoordinates(direction.x, direction.y, direction.z, face, s, t);
+                    sampleImage(cube.face(level, face), faceSize, faceSize, s, t, row + x * 3);
+                }
+            });
+            texture.images.push_back(toHalf(image.data(), image.size()));
+        }
+        return texture;
+    }
+
+    static IBLCacheTexture cubemapRecord(uint32_t slot, const CpuCubemap& cube, uint32_t minFilter)
+    {
+        IBLCacheTexture texture;
+        texture.slot = slot;
+        texture.target = GL_TEXTURE_CUBE_MAP;
+        texture.internalFormat = GL_RGB16F;
+        texture.format = GL_RGB;
+        texture.type = GL_HALF_FLOAT;
+        texture.minFilter = minFilter;
+        texture.magFilter = GL_LINEAR;
+        texture.width = texture.height = cube.size;
+        texture.levels = cube.levels;
+        texture.faces = 6;
+        for (int level = 0; level < cube.levels; ++level)
+            for (int face = 0; face < 6; ++face)
+                texture.images.push_back(toHalf(cube.face(level, face), cube.images[level * 6 + face].size()));
+        return texture;
+    }
+};
@@ -0,0 +1,93 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Shader.h"
+
+#include <string>
+#include <iostream>
+
+// Single-pass rendering into all six faces of a cubemap level.
+// The whole level is attached as a layered color attachment and Shaders/cubemap_layered.gs routes each triangle
+// to every face with gl_Layer, so a capture is one draw instead of six draws with six re-attachments.
+// Capture shaders are built with that geometry shader and prepared once with prepare(); layered framebuffers
+// can't mix in a non-layered renderbuffer, which is fine because none of the captures needs depth.
+class CubemapCapture
+{
+public:
+    static constexpr const char* GEOMETRY_SHADER = "Shaders/cubemap_layered.gs";
+
+    CubemapCapture()
+    {
+        glGenFramebuffers(1, &fbo);
+    }
+    ~CubemapCapture()
+    {
+        glDeleteFramebuffers(1, &fbo);
+    }
+    CubemapCapture(const CubemapCapture&) = delete;
+    CubemapCapture& operator=(const CubemapCapture&) = delete;
+
+    // view matrix of one face, looking out from position, in GL cubemap face order
+    static glm::mat4 faceView(const glm::vec3& position, int face)
+    {
+        const glm::vec3 directions[6] = { glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+                                          glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f) };
+        const glm::vec3 ups[6] = { glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+                                   glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) };
+        return glm::lookAt(position, position + directions[face], ups[face]);
+    }
+
+    // the 90 degree projection shared by all faces
+    static glm::mat4 faceProjection(float nearPlane, float farPlane)
+    {
+        return glm::perspective(glm::radians(90.0f), 1.0f, nearPlane, farPlane);
+    }
+
+    // projection * view for each face, looking out from position, in GL cubemap face order
+    static void faceViewProjections(const glm::vec3& position, float nearPlane, float farPlane, glm::mat4* matrices)
+    {
+        glm::mat4 projection = faceProjection(nearPlane, farPlane);
+        for (int face = 0; face < 6; ++face)
+            matrices[face] = projection * faceView(position, face);
+    }
+
+    // sets the per-face matrices of a capture shader and neutralizes its own projection/view
+    static void prepare(Shader& shader, const glm::vec3& position = glm::vec3(0.0f), float nearPlane = 0.1f, float farPlane = 10.0f)
+    {
+        glm::mat4 matrices[6];
+        faceViewProjections(position, nearPlane, farPlane, matrices);
+        shader.use();
+        shader.setMat4("projection", glm::mat4(1.0f));
+        shader.setMat4("view", glm::mat4(1.0f));
+        for (int face = 0; face < 6; ++face)
+            shader.setMat4("faceViewProjections[" + std::to_string(face) + "]", matrices[face]);
+    }
+
+    // binds the capture framebuffer with all faces of the given cubemap level attached and sets the viewport.
+    // A clear always hits every face, so single-face captures (captureFace) that build a level up over several
+    // calls pass clear = false.
+    bool begin(unsigned int cubemap, int level, int levelSize, bool clear = true)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, cubemap, level);
+        glViewport(0, 0, levelSize, levelSize);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "ERROR::FRAMEBUFFER:: Layered cubemap capture framebuffer is not complete!" << std::endl;
+            return false;
+        }
+        if (clear)
+            glClear(GL_COLOR_BUFFER_BIT);
+        return true;
+    }
+
+    void end()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+private:
+    unsigned int fbo = 0;
+};
@@ -0,0 +1,107 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <cstring>
+
+// Entry points and enums beyond the GL 3.3 core profile our glad loader was generated for.
+// They are loaded at runtime through the same proc address function glad uses; every feature has a flag that
+// tells whether the context actually provides it, so callers can fall back to the 3.3 path.
+// ------------------------------------------------------------------------------------------------------------
+
+// GL 4.2 / 4.3: compute shaders, image load/store, immutable texture storage
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_SHADER_IMAGE_ACCESS_BARRIER_BIT
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#endif
+#ifndef GL_TEXTURE_FETCH_BARRIER_BIT
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#endif
+#ifndef GL_TEXTURE_UPDATE_BARRIER_BIT
+#define GL_TEXTURE_UPDATE_BARRIER_BIT 0x00000100
+#endif
+
+// GL 4.0: cube map arrays (no new entry points, glTexImage3D and layered attachments cover them)
+#ifndef GL_TEXTURE_CUBE_MAP_ARRAY
+#define GL_TEXTURE_CUBE_MAP_ARRAY 0x9009
+#endif
+
+// block-compressed texture formats beyond 3.3's RGTC (BC4/BC5): BPTC (BC7, GL 4.2 or ARB_texture_compression_bptc)
+// and S3TC (BC1-BC3, EXT_texture_compression_s3tc). Only glCompressedTexImage2D is needed, which 3.3 has.
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+typedef void (APIENTRYP PFNEVCGLDISPATCHCOMPUTEPROC)(GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z);
+typedef void (APIENTRYP PFNEVCGLBINDIMAGETEXTUREPROC)(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format);
+typedef void (APIENTRYP PFNEVCGLMEMORYBARRIERPROC)(GLbitfield barriers);
+typedef void (APIENTRYP PFNEVCGLTEXSTORAGE2DPROC)(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+
+inline PFNEVCGLDISPATCHCOMPUTEPROC evc_glDispatchCompute = nullptr;
+inline PFNEVCGLBINDIMAGETEXTUREPROC evc_glBindImageTexture = nullptr;
+inline PFNEVCGLMEMORYBARRIERPROC evc_glMemoryBarrier = nullptr;
+inline PFNEVCGLTEXSTORAGE2DPROC evc_glTexStorage2D = nullptr;
+#define glDispatchCompute evc_glDispatchCompute
+#define glBindImageTexture evc_glBindImageTexture
+#define glMemoryBarrier evc_glMemoryBarrier
+#define glTexStorage2D evc_glTexStorage2D
+
+class GLExtensions
+{
+public:
+    // compute shaders + image load/store + texture storage. GL 4.3 only: the ibl_*.comp shaders are #version 430
+    // with binding layouts, so the ARB extensions on an older context aren't enough to build them.
+    inline static bool computeShaders = false;
+    // samplerCubeArray through GL_ARB_texture_cube_map_array. The shaders stay at #version 330 and enable the
+    // extension, so it has to be advertised even on a 4.0+ context.
+    inline static bool cubeMapArrays = false;
+    // BC7 and BC1/BC3 textures; BC4 and BC5 are core
+    inline static bool textureCompressionBPTC = false;
+    inline static bool textureCompressionS3TC = false;
+
+    // call once after gladLoadGLLoader, with the same loader
+    static void load(GLADloadproc loader)
+    {
+        evc_glDispatchCompute = (PFNEVCGLDISPATCHCOMPUTEPROC)loader("glDispatchCompute");
+        evc_glBindImageTexture = (PFNEVCGLBINDIMAGETEXTUREPROC)loader("glBindImageTexture");
+        evc_glMemoryBarrier = (PFNEVCGLMEMORYBARRIERPROC)loader("glMemoryBarrier");
+        evc_glTexStorage2D = (PFNEVCGLTEXSTORAGE2DPROC)loader("glTexStorage2D");
+
+        // a non-null pointer alone doesn't mean much, some drivers hand out every entry point they know about
+        computeShaders = hasVersion(4, 3) && evc_glDispatchCompute && evc_glBindImageTexture && evc_glMemoryBarrier && evc_glTexStorage2D;
+        cubeMapArrays = hasExtension("GL_ARB_texture_cube_map_array");
+        textureCompressionBPTC = hasVersion(4, 2) || hasExtension("GL_ARB_texture_compression_bptc");
+        textureCompressionS3TC = hasExtension("GL_EXT_texture_compression_s3tc");
+    }
+
+    static bool hasVersion(int major, int minor)
+    {
+        GLint contextMajor = 0, contextMinor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &contextMajor);
+        glGetIntegerv(GL_MINOR_VERSION, &contextMinor);
+        return contextMajor > major || (contextMajor == major && contextMinor >= minor);
+    }
+
+    static bool hasExtension(const char* name)
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; ++i)
+        {
+            const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            if (extension && std::strcmp(extension, name) == 0)
+                return true;
+        }
+        return false;
+    }
+};
@@ -0,0 +1,225 @@
+#pragma once
+#include <glad/glad.h>
+
+#include "VertexLayout.h"
+#include "UploadContext.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Vertices and indices of every Mesh, sub-allocated from a few large buffers: one vertex buffer and one vertex
+// array per VertexFormat, and one index buffer all of them share. A mesh is just a range in them (a base vertex and
+// an index offset) drawn with glDrawElementsBaseVertex, so a model's meshes are drawn with a single VAO bind
+// instead of one per mesh.
+//
+// Allocations are never freed one by one: meshes live as long as their models, which are loaded once for the
+// application's lifetime. The buffers start at INITIAL_*_BYTES and double when full (a GPU-side copy into the
+// bigger buffer; base vertices and offsets stay valid, and so do the VAO names).
+//
+// With an UploadContext (setUploadContext) the data is written by the upload thread: allocate() only reserves the
+// range and the mesh may be drawn once Range::uploaded is set, on the frame the upload is published.
+class GeometryArena
+{
+public:
+    static constexpr size_t INITIAL_VERTEX_BYTES = 8 << 20;
+    static constexpr size_t INITIAL_INDEX_BYTES = 4 << 20;
+
+    // where an allocation landed
+    struct Range
+    {
+        GLint baseVertex;
+        size_t indexOffset; // in bytes
+        // set on the render thread when the data written by the upload thread may be drawn; null if allocate()
+        // wrote it right away
+        std::shared_ptr<bool> uploaded;
+    };
+
+    // the arena meshes are allocated from. Its GL objects are created with the first allocation, so it has to be
+    // released (release()) while the context still exists.
+    static GeometryArena& shared()
+    {
+        static GeometryArena arena;
+        return arena;
+    }
+
+    GeometryArena() = default;
+    GeometryArena(const GeometryArena&) = delete;
+    GeometryArena& operator=(const GeometryArena&) = delete;
+
+    // uploads go through uploads from now on (nullptr: written on the calling thread again)
+    void setUploadContext(UploadContext* context)
+    {
+        uploads = context;
+    }
+
+    // copies vertexCount vertices in format and indexCount indices of indexType into the arena. Index offsets are
+    // aligned to 4 bytes so that 16 and 32-bit indices can share the buffer.
+    Range allocate(VertexFormat format, const void* vertexData, size_t vertexCount, const void* indexData, size_t indexCount, GLenum indexType)
+    {
+        Pool& pool = pools[poolIndex(format)];
+        const size_t stride = VertexLayout::stride(format);
+        const size_t vertexBytes = vertexCount * stride;
+        const size_t indexBytes = indexCount * VertexLayout::indexSize(indexType);
+        indexUsed = (indexUsed + 3) / 4 * 4;
+        // growing copies the buffers here, so the uploads still writing into them have to land first
+        if (uploads && (indexUsed + indexBytes > indexCapacity || pool.used * stride + vertexBytes > pool.capacity))
+            uploads->finish();
+        reserveIndices(indexUsed + indexBytes);
+        reserveVertices(pool, format, pool.used * stride + vertexBytes);
+
+        Range range;
+        range.baseVertex = static_cast<GLint>(pool.used);
+        range.indexOffset = indexUsed;
+        const unsigned int vbo = pool.vbo, indexBuffer = ebo;
+        const size_t vertexOffset = pool.used * stride, indexOffset = indexUsed;
+        if (uploads)
+        {
+            // the caller's data may be gone before the upload thread gets to it
+            const unsigned char* vertexSource = static_cast<const unsigned char*>(vertexData);
+            const unsigned char* indexSource = static_cast<const unsigned char*>(indexData);
+            auto vertices = std::make_shared<std::vector<unsigned char>>(vertexSource, vertexSource + vertexBytes);
+            auto indices = std::make_shared<std::vector<unsigned char>>(indexSource, indexSource + indexBytes);
+            std::shared_ptr<bool> uploaded = std::make_shared<bool>(false);
+            range.uploaded = uploaded;
+            uploads->submit([=]()
+            {
+                write(vbo, vertexOffset, vertices->size(), vertices->data());
+                write(indexBuffer, indexOffset, indices->size(), indices->data());
+            },
+            [uploaded]() { *uploaded = true; });
+        }
+        else
+        {
+            write(vbo, vertexOffset, vertexBytes, vertexData);
+            write(indexBuffer, indexOffset, indexBytes, indexData);
+        }
+        pool.used += vertexCount;
+        indexUsed += indexBytes;
+        return range;
+    }
+
+    // the vertex array of a format's pool; valid after the first allocation in that format
+    unsigned int vertexArray(VertexFormat format) const
+    {
+        return pools[poolIndex(format)].vao;
+    }
+
+    void bind(VertexFormat format) const
+    {
+        glBindVertexArray(vertexArray(format));
+    }
+
+    // bytes in use, for statistics
+    size_t vertexBytes() const
+    {
+        return pools[0].used * VertexLayout::stride(VertexFormat::Float) + pools[1].used * VertexLayout::stride(VertexFormat::Quantized);
+    }
+
+    size_t indexBytes() const { return indexUsed; }
+
+    // deletes the GL objects; every mesh allocated from the arena is gone with them
+    void release()
+    {
+        if (uploads)
+            uploads->finish();
+        for (Pool& pool : pools)
+        {
+            if (pool.vao)
+                glDeleteVertexArrays(1, &pool.vao);
+            if (pool.vbo)
+                glDeleteBuffers(1, &pool.vbo);
+            pool = Pool();
+        }
+        if (ebo)
+            glDeleteBuffers(1, &ebo);
+        ebo = 0;
+        indexCapacity = indexUsed = 0;
+    }
+
+private:
+    struct Pool
+    {
+        unsigned int vao = 0;
+        unsigned int vbo = 0;
+        size_t capacity = 0; // bytes
+        size_t used = 0;     // vertices
+    };
+
+    Pool pools[2];
+    unsigned int ebo = 0;
+    UploadContext* uploads = nullptr;
+    size_t indexCapacity = 0;
+    size_t indexUsed = 0;
+
+    static size_t poolIndex(VertexFormat format)
+    {
+        return format == VertexFormat::Quantized ? 1 : 0;
+    }
+
+    static void write(unsigned int buffer, size_t offset, size_t size, const void* data)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    // a buffer of at least required bytes, keeping the first used bytes of buffer (which is replaced)
+    static void grow(unsigned int& buffer, size_t& capacity, size_t used, size_t required, size_t initial)
+    {
+        size_t newCapacity = std::max(capacity, initial);
+        while (newCapacity < required)
+            newCapacity *= 2;
+        if (buffer && newCapacity == capacity)
+            return;
+        unsigned int grown;
+        glGenBuffers(1, &grown);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+        glBufferData(GL_COPY_WRITE_BUFFER, newCapacity, nullptr, GL_STATIC_DRAW);
+        if (buffer)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glDeleteBuffers(1, &buffer);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        buffer = grown;
+        capacity = newCapacity;
+    }
+
+    void reserveIndices(size_t required)
+    {
+        const unsigned int previous = ebo;
+        grow(ebo, indexCapacity, indexUsed, required, INITIAL_INDEX_BYTES);
+        if (ebo == previous)
+            return;
+        // the element buffer binding is part of each vertex array
+        for (Pool& pool : pools)
+        {
+            if (!pool.vao)
+                continue;
+            glBindVertexArray(pool.vao);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        }
+        glBindVertexArray(0);
+    }
+
+    void reserveVertices(Pool& pool, VertexFormat format, size_t required)
+    {
+        const unsigned int previous = pool.vbo;
+        grow(pool.vbo, pool.capacity, pool.used * VertexLayout::stride(format), required, INITIAL_VERTEX_BYTES);
+        if (pool.vbo == previous)
+            return;
+        // the attribute pointers captured the old buffer
+        if (!pool.vao)
+            glGenVertexArrays(1, &pool.vao);
+        glBindVertexArray(pool.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, pool.vbo);
+        VertexLayout::setupAttributes(format);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+};
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+// IEEE 754 binary16 conversion for data headed to GL_HALF_FLOAT textures and vertex attributes
+namespace HalfFloat
+{
+    // round-to-nearest-even float -> half, the scalar counterpart of _mm_cvtps_ph
+    inline uint16_t fromFloat(float value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        const uint32_t sign = bits & 0x80000000u;
+        bits ^= sign;
+        uint32_t half;
+        if (bits >= (127u + 16u) << 23) // too large for a half, or inf/nan
+        {
+            half = bits > (255u << 23) ? 0x7E00u : 0x7C00u;
+        }
+        else if (bits < (113u << 23)) // a half denormal: let the float adder do the rounding
+        {
+            const uint32_t magicBits = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+            float magic, shifted;
+            std::memcpy(&magic, &magicBits, sizeof(magic));
+            std::memcpy(&shifted, &bits, sizeof(shifted));
+            shifted += magic;
+            std::memcpy(&half, &shifted, sizeof(half));
+            half -= magicBits;
+        }
+        else
+        {
+            const uint32_t mantissaOdd = (bits >> 13) & 1u;
+            bits += (static_cast<uint32_t>(15 - 127) << 23) + 0xFFFu;
+            bits += mantissaOdd;
+            half = bits >> 13;
+        }
+        return static_cast<uint16_t>(half | (sign >> 16));
+    }
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <vector>
+
+// 64-bit FNV-1a style hasher used to key on-disk caches (baked IBL data, compiled meshes).
+// It is not cryptographic; it only has to notice when a source file or a bake parameter changes.
+class Hasher
+{
+public:
+    Hasher() : state(14695981039346656037ull) {}
+
+    // feed raw bytes. Whole 8-byte words are mixed at once so hashing large source files stays cheap.
+    Hasher& update(const void* data, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        while (size >= 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes, 8);
+            state = (state ^ word) * 1099511628211ull;
+            bytes += 8;
+            size -= 8;
+        }
+        while (size > 0)
+        {
+            state = (state ^ *bytes) * 1099511628211ull;
+            ++bytes;
+            --size;
+        }
+        return *this;
+    }
+
+    Hasher& update(const std::string& text)
+    {
+        update(text.data(), text.size());
+        // include the length so that ("ab", "c") and ("a", "bc") don't collide
+        return update(static_cast<uint64_t>(text.size()));
+    }
+
+    Hasher& update(uint64_t value)
+    {
+        return update(&value, sizeof(value));
+    }
+
+    // feed the whole content of a file. Returns false (and hashes a marker instead) if the file can't be read,
+    // so a missing source still produces a stable but different key.
+    bool updateFile(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            update(std::string("<missing>") + path);
+            return false;
+        }
+        std::vector<char> buffer(1 << 20);
+        uint64_t total = 0;
+        while (file)
+        {
+            file.read(buffer.data(), buffer.size());
+            std::streamsize count = file.gcount();
+            if (count <= 0)
+                break;
+            update(buffer.data(), static_cast<size_t>(count));
+            total += static_cast<uint64_t>(count);
+        }
+        update(total);
+        return true;
+    }
+
+    uint64_t digest() const
+    {
+        // final avalanche so that keys differing in the last few bytes still spread over all bits
+        uint64_t h = state;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    // hexadecimal representation of the digest, used for cache file names
+    std::string hex() const
+    {
+        return toHex(digest());
+    }
+
+    static std::string toHex(uint64_t h)
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string result(16, '0');
+        for (int i = 15; i >= 0; --i)
+        {
+            result[i] = digits[h & 0xF];
+            h >>= 4;
+        }
+        return result;
+    }
+
+private:
+    uint64_t state;
+};
@@ -0,0 +1,284 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "IBLCacheFile.h"
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+
+// the textures produced by the IBL bake (or restored from the cache). The BRDF LUT is environment independent
+// and comes from BRDFLUT.h instead.
+struct IBLMaps
+{
+    unsigned int envCubemap = 0;
+    unsigned int irradianceMap = 0;
+    unsigned int prefilterMap = 0;
+    // the three maps are octahedral 2D textures (OctahedralMap.h) rather than cubemaps
+    bool octahedral = false;
+    // diffuse irradiance as SH coefficients, used instead of irradianceMap when present
+    bool hasIrradianceSH = false;
+    glm::vec3 irradianceSH[9];
+};
+
+// Persistent on-disk cache for the baked IBL products. See IBLCacheFile.h for the key and the file layout;
+// this class moves the maps between those files and GL textures.
+class IBLCache
+{
+public:
+    IBLCache(const std::string& directory) : directory(directory)
+    {
+    }
+
+    static uint64_t computeKey(const std::string& hdrPath, const IBLConfig& config)
+    {
+        return IBLCacheFile::computeKey(hdrPath, config);
+    }
+
+    std::string pathFor(uint64_t key) const
+    {
+        return directory + "/" + IBLCacheFile::fileName(key);
+    }
+
+    // restores all maps for the given key. Returns false on a miss or on a damaged/outdated file,
+    // in which case nothing is created and the caller has to bake.
+    bool load(uint64_t key, IBLMaps& maps) const
+    {
+        IBLCacheContents contents;
+        if (!IBLCacheFile::read(pathFor(key), key, contents))
+            return false;
+        if (!create(contents, maps))
+        {
+            std::cout << "IBL cache: incomplete file " << pathFor(key) << ", re-baking" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // creates the GL textures for contents read from a cache file. Fails (creating nothing) unless the contents
+    // hold a complete set of maps.
+    static bool create(const IBLCacheContents& contents, IBLMaps& maps)
+    {
+        IBLMaps loaded;
+        std::vector<const IBLCacheTexture*> records;
+        if (!allocate(contents, loaded, records))
+            return false;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (const IBLCacheTexture* texture : records)
+        {
+            glBindTexture(texture->target, textureOf(loaded, texture->slot));
+            for (uint32_t level = 0; level < texture->levels; ++level)
+                for (uint32_t face = 0; face < texture->faces; ++face)
+                    uploadImage(*texture, level, face);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        maps = loaded;
+        return true;
+    }
+
+    // the first half of create(): the textures with their storage but no contents yet, and in records the cache
+    // records to fill them from with uploadImage (IBLRebaker spreads that over frames). Fails like create().
+    static bool allocate(const IBLCacheContents& contents, IBLMaps& maps, std::vector<const IBLCacheTexture*>& records)
+    {
+        IBLMaps loaded;
+        records.clear();
+        for (const IBLCacheTexture& texture : contents.textures)
+        {
+            unsigned int* slot = slotTexture(loaded, texture.slot);
+            if (slot && *slot == 0)
+            {
+                *slot = allocateTexture(texture);
+                records.push_back(&texture);
+            }
+            if (texture.slot == IBLCacheFile::SLOT_ENVIRONMENT)
+                loaded.octahedral = texture.target == GL_TEXTURE_2D;
+        }
+        loaded.hasIrradianceSH = contents.hasIrradianceSH;
+        std::copy(contents.irradianceSH, contents.irradianceSH + 9, loaded.irradianceSH);
+
+        if (!loaded.envCubemap || (!loaded.irradianceMap && !loaded.hasIrradianceSH) || !loaded.prefilterMap)
+        {
+            release(loaded);
+            records.clear();
+            return false;
+        }
+        maps = loaded;
+        return true;
+    }
+
+    // reads all maps back from the GPU and writes them to disk, stalling until the GPU is done with them (see
+    // IBLRebaker for a read back spread over frames)
+    bool save(uint64_t key, const IBLMaps& maps) const
+    {
+        IBLCacheContents contents;
+        if (!describe(maps, contents))
+            return false;
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        for (IBLCacheTexture& texture : contents.textures)
+        {
+            glBindTexture(texture.target, textureOf(maps, texture.slot));
+            for (uint32_t level = 0; level < texture.levels; ++level)
+                readbackLevel(texture, level, [&texture, level](uint32_t face) { return texture.images[level * texture.faces + face].data(); });
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        return IBLCacheFile::write(pathFor(key), key, contents);
+    }
+
+    // what save() writes for maps, with the images allocated but not read back yet
+    static bool describe(const IBLMaps& maps, IBLCacheContents& contents)
+    {
+        contents.textures.resize(maps.irradianceMap ? 3 : 2);
+        std::vector<IBLCacheTexture>& textures = contents.textures;
+        const GLenum target = maps.octahedral ? GL_TEXTURE_2D : GL_TEXTURE_CUBE_MAP;
+        bool ok = describeTexture(IBLCacheFile::SLOT_ENVIRONMENT, target, maps.envCubemap, textures[0]) &&
+                  describeTexture(IBLCacheFile::SLOT_PREFILTER, target, maps.prefilterMap, textures[1]) &&
+                  (!maps.irradianceMap || describeTexture(IBLCacheFile::SLOT_IRRADIANCE, target, maps.irradianceMap, textures[2]));
+        contents.hasIrradianceSH = maps.hasIrradianceSH;
+        std::copy(maps.irradianceSH, maps.irradianceSH + 9, contents.irradianceSH);
+        return ok;
+    }
+
+    // the texture of maps a described record comes from
+    static unsigned int textureOf(const IBLMaps& maps, uint32_t slot)
+    {
+        IBLMaps copy = maps;
+        unsigned int* texture = slotTexture(copy, slot);
+        return texture ? *texture : 0;
+    }
+
+    // reads every face of one level of the bound texture, face f into destination(f): client memory, or an offset
+    // into the bound GL_PIXEL_PACK_BUFFER. Expects GL_PACK_ALIGNMENT 1.
+    template <typename Destination>
+    static void readbackLevel(const IBLCacheTexture& texture, uint32_t level, Destination destination)
+    {
+        const GLenum faceTarget = texture.target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : texture.target;
+        for (uint32_t face = 0; face < texture.faces; ++face)
+            glGetTexImage(faceTarget + face, level, texture.format, texture.type, destination(face));
+    }
+
+    static void release(IBLMaps& maps)
+    {
+        unsigned int textures[] = { maps.envCubemap, maps.irradianceMap, maps.prefilterMap };
+        for (unsigned int texture : textures)
+            if (texture)
+                glDeleteTextures(1, &texture);
+        maps = IBLMaps();
+    }
+
+    // creates a GL texture with storage for every level of a cache record, without contents
+    static unsigned int allocateTexture(const IBLCacheTexture& texture)
+    {
+        const GLenum faceTarget = texture.target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : texture.target;
+        unsigned int id;
+        glGenTextures(1, &id);
+        glBindTexture(texture.target, id);
+        for (uint32_t level = 0; level < texture.levels; ++level)
+        {
+            for (uint32_t face = 0; face < texture.faces; ++face)
+            {
+                glTexImage2D(faceTarget + face, level, texture.internalFormat, texture.levelWidth(level), texture.levelHeight(level), 0,
+                    texture.format, texture.type, nullptr);
+            }
+        }
+        glTexParameteri(texture.target, GL_TEXTURE_MAX_LEVEL, texture.levels - 1);
+        glTexParameteri(texture.target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(texture.target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        if (texture.target == GL_TEXTURE_CUBE_MAP)
+            glTexParameteri(texture.target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(texture.target, GL_TEXTURE_MIN_FILTER, texture.minFilter);
+        glTexParameteri(texture.target, GL_TEXTURE_MAG_FILTER, texture.magFilter);
+        return id;
+    }
+
+    // uploads one face of one level of a cache record into the bound texture. Expects GL_UNPACK_ALIGNMENT 1.
+    static void uploadImage(const IBLCacheTexture& texture, uint32_t level, uint32_t face)
+    {
+        const GLenum faceTarget = texture.target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : texture.target;
+        glTexSubImage2D(faceTarget + face, level, 0, 0, texture.levelWidth(level), texture.levelHeight(level), texture.format, texture.type,
+            texture.images[level * texture.faces + face].data());
+    }
+
+private:
+    std::string directory;
+
+    static unsigned int* slotTexture(IBLMaps& maps, uint32_t slot)
+    {
+        switch (slot)
+        {
+        case IBLCacheFile::SLOT_ENVIRONMENT: return &maps.envCubemap;
+        case IBLCacheFile::SLOT_IRRADIANCE: return &maps.irradianceMap;
+        case IBLCacheFile::SLOT_PREFILTER: return &maps.prefilterMap;
+        default: return nullptr;
+        }
+    }
+
+    // the client format we transfer in; all IBL products are half-float textures
+    static bool transferFormat(GLint internalFormat, GLenum& format)
+    {
+        switch (internalFormat)
+        {
+        case GL_RGB16F: format = GL_RGB; return true;
+        case GL_RGBA16F: format = GL_RGBA; return true;
+        case GL_RG16F: format = GL_RG; return true;
+        case GL_R16F: format = GL_RED; return true;
+        default: return false;
+        }
+    }
+
+    // fills in a texture's record from GL: format, size, levels and the image buffers, sized but not read
+    static bool describeTexture(uint32_t slot, GLenum target, unsigned int id, IBLCacheTexture& texture)
+    {
+        glBindTexture(target, id);
+        const GLenum faceTarget = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+
+        GLint internalFormat = 0, width = 0, height = 0, minFilter = 0, magFilter = 0;
+        glGetTexLevelParameteriv(faceTarget, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+        glGetTexLevelParameteriv(faceTarget, 0, GL_TEXTURE_WIDTH, &width);
+        glGetTexLevelParameteriv(faceTarget, 0, GL_TEXTURE_HEIGHT, &height);
+        glGetTexParameteriv(target, GL_TEXTURE_MIN_FILTER, &minFilter);
+        glGetTexParameteriv(target, GL_TEXTURE_MAG_FILTER, &magFilter);
+
+        GLenum format;
+        if (!transferFormat(internalFormat, format) || width == 0 || height == 0)
+        {
+            std::cout << "IBL cache: unsupported texture format " << internalFormat << std::endl;
+            return false;
+        }
+
+        // count the allocated mip levels the texture samples from: levels past GL_TEXTURE_MAX_LEVEL may exist
+        // (glGenerateMipmap allocates the full chain) without holding anything meaningful
+        GLint maxLevel = 0;
+        glGetTexParameteriv(target, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+        const uint32_t levelLimit = static_cast<uint32_t>(std::min(std::max(maxLevel, 0), 15)) + 1;
+        uint32_t levels = 0;
+        for (GLint levelWidth = width; levels < levelLimit; ++levels)
+        {
+            glGetTexLevelParameteriv(faceTarget, levels, GL_TEXTURE_WIDTH, &levelWidth);
+            if (levelWidth == 0)
+                break;
+        }
+
+        texture.slot = slot;
+        texture.target = target;
+        texture.internalFormat = internalFormat;
+        texture.format = format;
+        texture.type = GL_HALF_FLOAT;
+        texture.minFilter = minFilter;
+        texture.magFilter = magFilter;
+        texture.width = width;
+        texture.height = height;
+        texture.levels = levels;
+        texture.faces = target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+        texture.images.resize(texture.levels * texture.faces);
+
+        const unsigned int texelSize = IBLCacheFile::texelSize(format, GL_HALF_FLOAT);
+        for (uint32_t level = 0; level < texture.levels; ++level)
+            for (uint32_t face = 0; face < texture.faces; ++face)
+                texture.images[level * texture.faces + face].resize(static_cast<size_t>(texture.levelWidth(level)) * texture.levelHeight(level) *
+                                                                    texelSize);
+        return true;
+    }
+};
@@ -0,0 +1,292 @@
+#pragma once
+#include <glad/glad.h> // GL enum values only, nothing in here calls into GL
+
+#include <glm/glm.hpp>
+
+#include "Hash.h"
+#include "IBLConfig.h"
+#include "IBLSampling.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <cstdint>
+
+// one texture as stored in an IBL cache file: its GL description plus the pixels of every face of every level
+struct IBLCacheTexture
+{
+    uint32_t slot = 0;
+    uint32_t target = GL_TEXTURE_2D;
+    uint32_t internalFormat = GL_RGB16F;
+    uint32_t format = GL_RGB;
+    uint32_t type = GL_HALF_FLOAT;
+    uint32_t minFilter = GL_LINEAR;
+    uint32_t magFilter = GL_LINEAR;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t levels = 1;
+    uint32_t faces = 1;
+    std::vector<std::vector<char>> images; // [level * faces + face], tightly packed rows
+
+    uint32_t levelWidth(uint32_t level) const { return std::max(1u, width >> level); }
+    uint32_t levelHeight(uint32_t level) const { return std::max(1u, height >> level); }
+};
+
+// everything an IBL cache file holds
+struct IBLCacheContents
+{
+    std::vector<IBLCacheTexture> textures;
+    bool hasIrradianceSH = false;
+    glm::vec3 irradianceSH[9]; // irradiance SH coefficients (see SphericalHarmonics.h), replaces the irradiance cubemap
+
+    const IBLCacheTexture* find(uint32_t slot) const
+    {
+        for (const IBLCacheTexture& texture : textures)
+            if (texture.slot == slot)
+                return &texture;
+        return nullptr;
+    }
+};
+
+// On-disk format of the baked IBL products, shared by the renderer (IBLCache.h) and the headless baker.
+// The file is named after a key that hashes the source HDR, the bake shaders and the bake parameters, so any
+// change to one of them simply results in a miss and a fresh bake.
+//
+// file layout (native endianness):
+//   header : magic 'EVCI', version, key
+//   chunks : tag, slot, payload... terminated by CHUNK_END
+// a texture chunk stores its GL description followed by every face of every mip level,
+// an SH chunk stores the nine RGB irradiance coefficients.
+class IBLCacheFile
+{
+public:
+    static constexpr uint32_t MAGIC = 0x49435645; // "EVCI"
+    static constexpr uint32_t VERSION = 3;
+
+    enum Chunk : uint32_t
+    {
+        CHUNK_TEXTURE = 1,
+        CHUNK_SH = 2,
+        CHUNK_END = 0xFFFFFFFF
+    };
+
+    enum Slot : uint32_t
+    {
+        SLOT_ENVIRONMENT = 0,
+        SLOT_IRRADIANCE = 1,
+        SLOT_PREFILTER = 2,
+        SLOT_BRDF_LUT = 3 // no longer stored, the LUT is embedded in the renderer (BRDFLUT.h)
+    };
+
+    // the shaders whose source takes part in the cache key
+    static std::vector<std::string> bakeShaderPaths()
+    {
+        return { "Shaders/2.2.2.cubemap.vs", "Shaders/2.2.2.equirectangular_to_cubemap.fs", "Shaders/2.2.2.irradiance_convolution.fs",
+                 "Shaders/prefilter.fs", "Shaders/ibl_equirectangular_to_cubemap.comp",
+                 "Shaders/ibl_downsample.comp", "Shaders/ibl_irradiance.comp", "Shaders/ibl_prefilter.comp",
+                 "Shaders/cubemap_layered.gs", "Shaders/octahedral_encode.vs", "Shaders/octahedral_encode.fs" };
+    }
+
+    // builds the cache key from everything the bake result depends on
+    static uint64_t computeKey(const std::string& hdrPath, const IBLConfig& config)
+    {
+        Hasher hasher;
+        hasher.update(static_cast<uint64_t>(VERSION));
+        hasher.updateFile(hdrPath);
+        for (const std::string& shaderPath : bakeShaderPaths())
+            hasher.updateFile(shaderPath);
+        for (unsigned int parameter : config.cacheKeyParameters())
+            hasher.update(static_cast<uint64_t>(parameter));
+        for (unsigned int mip = 0; mip < config.prefilterMipLevels; ++mip)
+            hasher.update(static_cast<uint64_t>(IBLSampling::prefilterSampleCount(mip, config.sampleCount)));
+        return hasher.digest();
+    }
+
+    static std::string fileName(uint64_t key)
+    {
+        return Hasher::toHex(key) + ".iblcache";
+    }
+
+    // bytes per texel of the half-float formats the IBL products use
+    static unsigned int texelSize(uint32_t format, uint32_t type)
+    {
+        unsigned int componentSize = type == GL_FLOAT ? 4 : 2;
+        switch (format)
+        {
+        case GL_RED: return componentSize;
+        case GL_RG: return 2 * componentSize;
+        case GL_RGB: return 3 * componentSize;
+        case GL_RGBA: return 4 * componentSize;
+        default: return 0;
+        }
+    }
+
+    // reads a whole cache file. Pass expectedKey = 0 to accept any key (used when comparing files).
+    static bool read(const std::string& path, uint64_t expectedKey, IBLCacheContents& contents, uint64_t* storedKeyOut = nullptr)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+
+        uint32_t magic = 0, version = 0;
+        uint64_t storedKey = 0;
+        readValue(file, magic);
+        readValue(file, version);
+        readValue(file, storedKey);
+        if (!file || magic != MAGIC || version != VERSION || (expectedKey != 0 && storedKey != expectedKey))
+        {
+            std::cout << "IBL cache: ignoring outdated file " << path << std::endl;
+            return false;
+        }
+        if (storedKeyOut)
+            *storedKeyOut = storedKey;
+
+        contents = IBLCacheContents();
+        for (;;)
+        {
+            uint32_t tag = 0;
+            readValue(file, tag);
+            if (!file)
+                break;
+            if (tag == CHUNK_END)
+                return true;
+
+            if (tag == CHUNK_TEXTURE)
+            {
+                IBLCacheTexture texture;
+                if (!readTexture(file, texture))
+                    break;
+                contents.textures.push_back(std::move(texture));
+            }
+            else if (tag == CHUNK_SH)
+            {
+                uint32_t slot = 0;
+                readValue(file, slot);
+                file.read(reinterpret_cast<char*>(contents.irradianceSH), sizeof(contents.irradianceSH));
+                if (!file)
+                    break;
+                contents.hasIrradianceSH = true;
+            }
+            else
+            {
+                break;
+            }
+        }
+        std::cout << "IBL cache: damaged file " << path << std::endl;
+        contents = IBLCacheContents();
+        return false;
+    }
+
+    // writes a cache file under a temporary name first and then renames it, so an interrupted write never leaves
+    // a truncated entry behind
+    static bool write(const std::string& path, uint64_t key, const IBLCacheContents& contents)
+    {
+        std::error_code error;
+        std::filesystem::path directory = std::filesystem::path(path).parent_path();
+        if (!directory.empty())
+            std::filesystem::create_directories(directory, error);
+
+        const std::string tempPath = path + ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            if (!file)
+            {
+                std::cout << "IBL cache: can't write " << tempPath << std::endl;
+                return false;
+            }
+            writeValue(file, MAGIC);
+            writeValue(file, VERSION);
+            writeValue(file, key);
+            for (const IBLCacheTexture& texture : contents.textures)
+                writeTexture(file, texture);
+            if (contents.hasIrradianceSH)
+            {
+                writeValue(file, static_cast<uint32_t>(CHUNK_SH));
+                writeValue(file, static_cast<uint32_t>(SLOT_IRRADIANCE));
+                file.write(reinterpret_cast<const char*>(contents.irradianceSH), sizeof(contents.irradianceSH));
+            }
+            writeValue(file, static_cast<uint32_t>(CHUNK_END));
+            if (!file)
+            {
+                std::cout << "IBL cache: failed writing " << tempPath << std::endl;
+                file.close();
+                std::filesystem::remove(tempPath, error);
+                return false;
+            }
+        }
+        std::filesystem::rename(tempPath, path, error);
+        if (error)
+        {
+            std::filesystem::remove(tempPath, error);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    template <typename T>
+    static void readValue(std::ifstream& file, T& value)
+    {
+        file.read(reinterpret_cast<char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static void writeValue(std::ofstream& file, const T& value)
+    {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    static bool readTexture(std::ifstream& file, IBLCacheTexture& texture)
+    {
+        readValue(file, texture.slot);
+        readValue(file, texture.target);
+        readValue(file, texture.internalFormat);
+        readValue(file, texture.format);
+        readValue(file, texture.type);
+        readValue(file, texture.minFilter);
+        readValue(file, texture.magFilter);
+        readValue(file, texture.width);
+        readValue(file, texture.height);
+        readValue(file, texture.levels);
+        readValue(file, texture.faces);
+
+        unsigned int size = texelSize(texture.format, texture.type);
+        if (!file || size == 0 || texture.levels == 0 || texture.levels > 16 ||
+            (texture.faces != 1 && texture.faces != 6) || texture.width == 0 || texture.height == 0)
+            return false;
+
+        texture.images.resize(texture.levels * texture.faces);
+        for (uint32_t level = 0; level < texture.levels; ++level)
+        {
+            size_t bytes = static_cast<size_t>(texture.levelWidth(level)) * texture.levelHeight(level) * size;
+            for (uint32_t face = 0; face < texture.faces; ++face)
+            {
+                std::vector<char>& image = texture.images[level * texture.faces + face];
+                image.resize(bytes);
+                file.read(image.data(), bytes);
+            }
+        }
+        return static_cast<bool>(file);
+    }
+
+    static void writeTexture(std::ofstream& file, const IBLCacheTexture& texture)
+    {
+        writeValue(file, static_cast<uint32_t>(CHUNK_TEXTURE));
+        writeValue(file, texture.slot);
+        writeValue(file, texture.target);
+        writeValue(file, texture.internalFormat);
+        writeValue(file, texture.format);
+        writeValue(file, texture.type);
+        writeValue(file, texture.minFilter);
+        writeValue(file, texture.magFilter);
+        writeValue(file, texture.width);
+        writeValue(file, texture.height);
+        writeValue(file, texture.levels);
+        writeValue(file, texture.faces);
+        for (const std::vector<char>& image : texture.images)
+            file.write(image.data(), image.size());
+    }
+};
@@ -0,0 +1,117 @@
+#pragma once
+#include "IBLSampling.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+// named presets for IBLConfig, from cheap to bake and small in VRAM to the opposite
+enum class IBLQuality
+{
+    Low,
+    Medium,
+    High,
+    Ultra
+};
+
+// Resolutions and sample counts of the IBL bake. The GPU bake and the CPU baker both read them, and they are part
+// of the IBL cache key so that a change here never picks up maps baked with other settings.
+// Shaders get the values they depend on through shaderDefines() instead of repeating them as literals.
+struct IBLConfig
+{
+    unsigned int environmentSize = 512;     // face size of the environment cubemap
+    unsigned int irradianceSize = 32;       // face size of the irradiance cubemap
+    unsigned int prefilterSize = 128;       // face size of the pre-filter cubemap's first mip
+    unsigned int prefilterMipLevels = 5;    // roughness levels stored in the pre-filter mip chain
+    unsigned int sampleCount = 1024;        // importance samples for the pre-filter (capped at IBLSampling::MAX_PREFILTER_SAMPLES)
+    bool irradianceSH = true;               // diffuse irradiance as 9 SH coefficients instead of the irradiance cubemap
+    bool octahedral = false;                // store the maps as octahedral 2D textures instead of cubemaps (OctahedralMap.h)
+
+    // the default member values above are the High tier
+    static IBLConfig forQuality(IBLQuality quality)
+    {
+        IBLConfig config;
+        switch (quality)
+        {
+        case IBLQuality::Low:
+            config.environmentSize = 256;
+            config.irradianceSize = 16;
+            config.prefilterSize = 64;
+            config.sampleCount = 256;
+            break;
+        case IBLQuality::Medium:
+            // halfway between Low and High; the face sizes don't need to be powers of two
+            config.environmentSize = 384;
+            config.irradianceSize = 24;
+            config.prefilterSize = 96;
+            config.sampleCount = 512;
+            break;
+        case IBLQuality::High:
+            break;
+        case IBLQuality::Ultra:
+            config.environmentSize = 1024;
+            config.irradianceSize = 64;
+            config.prefilterSize = 256;
+            config.prefilterMipLevels = 6;
+            break;
+        }
+        return config;
+    }
+
+    static const char* qualityName(IBLQuality quality)
+    {
+        switch (quality)
+        {
+        case IBLQuality::Low: return "low";
+        case IBLQuality::Medium: return "medium";
+        case IBLQuality::High: return "high";
+        case IBLQuality::Ultra: return "ultra";
+        }
+        return "";
+    }
+
+    static bool parseQuality(const std::string& name, IBLQuality& quality)
+    {
+        for (IBLQuality candidate : { IBLQuality::Low, IBLQuality::Medium, IBLQuality::High, IBLQuality::Ultra })
+        {
+            if (name == qualityName(candidate))
+            {
+                quality = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // #defines for the shaders that depend on the configuration (the pre-filter bake, the PBR and background shaders)
+    std::string shaderDefines() const
+    {
+        return "#define IBL_PREFILTER_MIP_LEVELS " + std::to_string(prefilterMipLevels) + "\n" +
+               "#define IBL_PREFILTER_SAMPLES " + std::to_string(std::min<unsigned int>(sampleCount, IBLSampling::MAX_PREFILTER_SAMPLES)) + "\n" +
+               (octahedral ? "#define IBL_OCTAHEDRAL\n" : "");
+    }
+
+    // VRAM taken by the baked maps, counting RGB16F texels as the 8 bytes drivers actually allocate for them.
+    // An octahedral map has 2/3 of the texels of the cubemap it replaces (plus a border, ignored here).
+    size_t gpuMemoryBytes() const
+    {
+        const size_t texelBytes = 8;
+        size_t bytes = 0;
+        for (unsigned int size = environmentSize; size > 0; size >>= 1) // full mip chain
+            bytes += 6 * texelBytes * size * size;
+        if (!irradianceSH)
+            bytes += 6 * texelBytes * irradianceSize * irradianceSize;
+        for (unsigned int mip = 0; mip < prefilterMipLevels; ++mip)
+        {
+            size_t size = std::max(1u, prefilterSize >> mip);
+            bytes += 6 * texelBytes * size * size;
+        }
+        return octahedral ? bytes * 2 / 3 : bytes;
+    }
+
+    std::vector<unsigned int> cacheKeyParameters() const
+    {
+        return { environmentSize, irradianceSize, prefilterSize, prefilterMipLevels, sampleCount, irradianceSH ? 1u : 0u, octahedral ? 1u : 0u };
+    }
+};
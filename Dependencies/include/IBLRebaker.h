@@ -0,0 +1,775 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "CubemapCapture.h"
+#include "OctahedralEncoder.h"
+#include "IBLCache.h"
+#include "IBLConfig.h"
+#include "IBLSampling.h"
+#include "RadianceHDR.h"
+#include "SphericalHarmonics.h"
+#include "ThreadPool.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <algorithm>
+
+// Environment hot-swap. queue() starts baking a new environment while the current maps keep rendering; update()
+// is called once per frame and advances the bake by as many small GPU steps (one cubemap face of one stage or
+// prefilter mip each) as fit into the frame's millisecond budget. When the last step has run, the new maps
+// replace the old ones all at once between two frames. The uploads are steps too: the decoded image a band of rows
+// at a time through a pixel buffer, a cache hit a face of a level at a time.
+//
+// Everything that would stall the frame happens on the thread pool: hashing the file for the cache key, reading a
+// cache hit, decoding the .hdr (RadianceHDR) and the SH projection. The SH source is read back through a pixel buffer and a
+// fence. So are the finished maps for the cache file: a level per step in the frames after the swap, within the same
+// budget, then written by the thread pool. GPU step costs are estimated in texel-samples and calibrated with
+// GL_TIME_ELAPSED queries.
+class IBLRebaker
+{
+public:
+    IBLRebaker(ThreadPool& pool, const IBLConfig& config, const IBLCache& cache, std::function<void()> drawCube)
+        : pool(pool), config(config), cache(cache), drawCube(drawCube),
+          toCubemapShader("Shaders/2.2.2.cubemap.vs", "Shaders/2.2.2.equirectangular_to_cubemap.fs", CubemapCapture::GEOMETRY_SHADER),
+          irradianceShader("Shaders/2.2.2.cubemap.vs", "Shaders/2.2.2.irradiance_convolution.fs", CubemapCapture::GEOMETRY_SHADER),
+          prefilterShader("Shaders/2.2.2.cubemap.vs", "Shaders/prefilter.fs", CubemapCapture::GEOMETRY_SHADER, config.shaderDefines())
+    {
+        CubemapCapture::prepare(toCubemapShader);
+        CubemapCapture::prepare(irradianceShader);
+        CubemapCapture::prepare(prefilterShader);
+        toCubemapShader.use();
+        toCubemapShader.setInt("equirectangularMap", 0);
+        irradianceShader.use();
+        irradianceShader.setInt("environmentMap", 0);
+        prefilterShader.use();
+        prefilterShader.setInt("environmentMap", 0);
+        glUniformBlockBinding(prefilterShader.ID, glGetUniformBlockIndex(prefilterShader.ID, "PrefilterSamples"), SAMPLES_BINDING);
+
+        glGenBuffers(1, &samplesUbo);
+        glBindBuffer(GL_UNIFORM_BUFFER, samplesUbo);
+        glBufferData(GL_UNIFORM_BUFFER, IBLSampling::MAX_PREFILTER_SAMPLES * sizeof(glm::vec4), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glGenQueries(QUERY_COUNT, queries);
+    }
+    ~IBLRebaker()
+    {
+        release();
+    }
+    IBLRebaker(const IBLRebaker&) = delete;
+    IBLRebaker& operator=(const IBLRebaker&) = delete;
+
+    // the maps to render with
+    const IBLMaps& current() const { return maps; }
+    // hands over maps baked elsewhere (the startup bake); they are released when a queued bake replaces them
+    void setCurrent(const IBLMaps& initial) { maps = initial; }
+    bool busy() const { return job != nullptr; }
+
+    // frees the re-baker's own GL objects and any bake in progress (not the current maps). Call it before the
+    // context goes away; the destructor only does it if it hasn't happened yet.
+    void release()
+    {
+        cancel();
+        cancelSave();
+        if (!samplesUbo)
+            return;
+        glDeleteBuffers(1, &samplesUbo);
+        glDeleteQueries(QUERY_COUNT, queries);
+        samplesUbo = 0;
+    }
+
+    // starts switching to another environment, replacing a bake that is still in progress
+    void queue(const std::string& hdrPath)
+    {
+        cancel();
+        job = std::make_shared<Job>();
+        job->hdrPath = hdrPath;
+        IBLConfig jobConfig = config;
+        IBLCache jobCache = cache;
+        ThreadPool* decodePool = &pool;
+        job->source = pool.submit([hdrPath, jobConfig, jobCache, decodePool]()
+        {
+            Source source;
+            source.key = IBLCache::computeKey(hdrPath, jobConfig);
+            if (IBLCacheFile::read(jobCache.pathFor(source.key), source.key, source.contents))
+            {
+                source.cached = true;
+                return source;
+            }
+            decodeImage(*decodePool, hdrPath, source);
+            return source;
+        });
+        std::cout << "IBL: switching to " << hdrPath << std::endl;
+    }
+
+    // advances a queued bake within budgetMs of estimated GPU time. Returns true on the frame the new maps were
+    // swapped in (the caller then refreshes whatever it derived from the old maps, like the SH uniform block).
+    bool update(double budgetMs)
+    {
+        collectTimings();
+        // the last bake's read back comes first: the next bake would release the maps it reads
+        if (saving)
+        {
+            if (saving->nextStep < saving->steps.size())
+            {
+                runSteps(saving->steps, saving->nextStep, budgetMs);
+                return false;
+            }
+            finishSave();
+        }
+        if (!job)
+            return false;
+
+        if (!job->sourceReady)
+        {
+            if (job->source.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                return false;
+            job->sourceReady = true;
+            Source source = job->source.get();
+            job->key = source.key;
+            if (source.cached)
+            {
+                if (!beginUpload(source))
+                {
+                    // an incomplete cache file: decode the image after all
+                    queueDecode();
+                    return false;
+                }
+            }
+            else
+            {
+                if (source.pixels.empty())
+                {
+                    std::cout << "Failed to load HDR image " << job->hdrPath << std::endl;
+                    job.reset();
+                    return false;
+                }
+                begin(source);
+            }
+        }
+
+        runSteps(job->steps, job->nextStep, budgetMs);
+        if (job->nextStep < job->steps.size())
+            return false;
+
+        if (job->cached)
+        {
+            std::cout << "IBL: loaded baked maps for " << job->hdrPath << " from the cache" << std::endl;
+            IBLMaps loaded = job->maps;
+            swapIn(loaded);
+            return true;
+        }
+
+        std::cout << "IBL: finished baking " << job->hdrPath << std::endl;
+        IBLMaps baked = job->maps;
+        uint64_t key = job->key;
+        swapIn(baked);
+        // the next switch to this environment loads the cache file instead
+        startSave(key);
+        return true;
+    }
+
+private:
+    static const int QUERY_COUNT = 4;
+    static const unsigned int SAMPLES_BINDING = 1;
+    // texels of the decoded image copied and uploaded per step
+    static const int UPLOAD_BAND_TEXELS = 1 << 18;
+
+    // what the worker thread produces for a queued environment: a cache hit or the decoded image
+    struct Source
+    {
+        uint64_t key = 0;
+        bool cached = false;
+        IBLCacheContents contents;
+        int width = 0, height = 0;
+        std::vector<uint16_t> pixels; // RGB half floats
+    };
+
+    // one unit of GPU work. run() returns false if it has to wait and should be retried next frame.
+    struct Step
+    {
+        double cost;
+        std::function<bool()> run;
+    };
+
+    // a finished bake's maps on their way into the cache file: read back a level per step into one pixel buffer,
+    // fenced, then copied out of the mapped buffer and written on the thread pool
+    struct Save
+    {
+        uint64_t key = 0;
+        std::shared_ptr<IBLCacheContents> contents;
+        unsigned int buffer = 0;
+        // offset in buffer of every image of contents->textures
+        std::vector<std::vector<size_t>> offsets;
+        GLsync fence = 0;
+        std::future<bool> write; // valid while the pool works from the mapped buffer
+        std::vector<Step> steps;
+        size_t nextStep = 0;
+    };
+
+    struct Job
+    {
+        std::string hdrPath;
+        std::future<Source> source;
+        bool sourceReady = false;
+        uint64_t key = 0;
+
+        IBLMaps maps;
+        // a cache hit: maps are filled from contents instead of baked
+        bool cached = false;
+        IBLCacheContents contents;
+        // the decoded image on its way into hdrTexture through uploadBuffer
+        int hdrWidth = 0, hdrHeight = 0;
+        std::vector<uint16_t> hdrPixels;
+        unsigned int uploadBuffer = 0;
+        unsigned int hdrTexture = 0;
+        unsigned int shBuffer = 0;
+        GLsync shFence = 0;
+        std::future<void> shProjection;
+        glm::vec3 projectedSH[9]; // written by the worker, only read once shProjection is ready
+
+        std::vector<Step> steps;
+        size_t nextStep = 0;
+    };
+
+    ThreadPool& pool;
+    IBLConfig config;
+    IBLCache cache;
+    std::function<void()> drawCube;
+    Shader toCubemapShader;
+    Shader irradianceShader;
+    Shader prefilterShader;
+    CubemapCapture capture;
+    std::unique_ptr<OctahedralEncoder> octahedralEncoder; // only with IBLConfig::octahedral
+    unsigned int samplesUbo = 0;
+
+    IBLMaps maps;
+    std::shared_ptr<Job> job;
+    std::unique_ptr<Save> saving;
+
+    // GPU cost calibration: milliseconds per texel-sample, starting from a deliberately pessimistic guess
+    double msPerUnit = 1e-6;
+    unsigned int queries[QUERY_COUNT];
+    double queryUnits[QUERY_COUNT] = {};
+    bool queryPending[QUERY_COUNT] = {};
+    int queryIndex = 0;
+
+    // runs steps from next on until the estimated cost of the one after would exceed the budget, but always at least
+    // one, and times them
+    void runSteps(std::vector<Step>& steps, size_t& next, double budgetMs)
+    {
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glBeginQuery(GL_TIME_ELAPSED, queries[queryIndex]);
+        double spentMs = 0.0, units = 0.0;
+        bool first = true;
+        while (next < steps.size())
+        {
+            Step& step = steps[next];
+            double estimateMs = step.cost * msPerUnit;
+            if (!first && spentMs + estimateMs > budgetMs)
+                break;
+            if (!step.run())
+                break; // waiting for the worker threads or the GPU, try again next frame
+            spentMs += estimateMs;
+            units += step.cost;
+            first = false;
+            ++next;
+        }
+        glEndQuery(GL_TIME_ELAPSED);
+        queryUnits[queryIndex] = units;
+        queryPending[queryIndex] = true;
+        queryIndex = (queryIndex + 1) % QUERY_COUNT;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    }
+
+    // lays out the read back of the current maps for the cache file under key
+    void startSave(uint64_t key)
+    {
+        std::unique_ptr<Save> save(new Save());
+        save->key = key;
+        save->contents = std::make_shared<IBLCacheContents>();
+        if (!IBLCache::describe(maps, *save->contents))
+            return;
+
+        size_t size = 0;
+        for (const IBLCacheTexture& texture : save->contents->textures)
+        {
+            save->offsets.emplace_back();
+            for (const std::vector<char>& image : texture.images)
+            {
+                save->offsets.back().push_back(size);
+                size += image.size();
+            }
+        }
+        glGenBuffers(1, &save->buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, save->buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        // a level of a texture (all its faces) per step, costed at a unit per texel copied
+        for (size_t t = 0; t < save->contents->textures.size(); ++t)
+        {
+            const IBLCacheTexture& texture = save->contents->textures[t];
+            for (uint32_t level = 0; level < texture.levels; ++level)
+            {
+                const double texels = double(texture.levelWidth(level)) * texture.levelHeight(level) * texture.faces;
+                save->steps.push_back({ texels, [this, t, level]()
+                {
+                    const IBLCacheTexture& texture = saving->contents->textures[t];
+                    const std::vector<size_t>& offsets = saving->offsets[t];
+                    glBindBuffer(GL_PIXEL_PACK_BUFFER, saving->buffer);
+                    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+                    glBindTexture(texture.target, IBLCache::textureOf(maps, texture.slot));
+                    IBLCache::readbackLevel(texture, level, [&](uint32_t face)
+                    {
+                        return reinterpret_cast<void*>(offsets[level * texture.faces + face]);
+                    });
+                    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+                    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+                    return true;
+                } });
+            }
+        }
+        save->steps.push_back({ 0.0, [this]()
+        {
+            saving->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            return true;
+        } });
+        saving = std::move(save);
+    }
+
+    // once every read back is issued: maps the buffer when the fence has signaled and has the pool copy the
+    // images out and write the file, then unmaps it when the pool is done
+    void finishSave()
+    {
+        Save& save = *saving;
+        if (!save.write.valid())
+        {
+            if (glClientWaitSync(save.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+                return;
+            glDeleteSync(save.fence);
+            save.fence = 0;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, save.buffer);
+            GLint64 size = 0;
+            glGetBufferParameteri64v(GL_PIXEL_PACK_BUFFER, GL_BUFFER_SIZE, &size);
+            const char* mapped = static_cast<const char*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT));
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            if (!mapped)
+            {
+                std::cout << "IBL cache: failed to map the read back of the baked maps" << std::endl;
+                cancelSave();
+                return;
+            }
+            std::shared_ptr<IBLCacheContents> contents = save.contents;
+            std::vector<std::vector<size_t>> offsets = save.offsets;
+            const std::string path = cache.pathFor(save.key);
+            const uint64_t key = save.key;
+            save.write = pool.submit([contents, offsets, mapped, path, key]()
+            {
+                for (size_t t = 0; t < contents->textures.size(); ++t)
+                {
+                    std::vector<std::vector<char>>& images = contents->textures[t].images;
+                    for (size_t i = 0; i < images.size(); ++i)
+                        std::copy_n(mapped + offsets[t][i], images[i].size(), images[i].data());
+                }
+                return IBLCacheFile::write(path, key, *contents);
+            });
+            return;
+        }
+        if (save.write.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return;
+        cancelSave();
+    }
+
+    // drops a cache write in progress, waiting for the pool if it's reading the mapped buffer
+    void cancelSave()
+    {
+        if (!saving)
+            return;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, saving->buffer);
+        if (saving->write.valid())
+        {
+            saving->write.wait();
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glDeleteBuffers(1, &saving->buffer);
+        if (saving->fence)
+            glDeleteSync(saving->fence);
+        saving.reset();
+    }
+
+    void queueDecode()
+    {
+        std::string hdrPath = job->hdrPath;
+        uint64_t key = job->key;
+        job->sourceReady = false;
+        ThreadPool* decodePool = &pool;
+        job->source = pool.submit([hdrPath, key, decodePool]()
+        {
+            Source source;
+            source.key = key;
+            decodeImage(*decodePool, hdrPath, source);
+            return source;
+        });
+    }
+
+    // decodes the .hdr into half floats, flipped like the startup bake's upload; leaves pixels empty on failure
+    static void decodeImage(ThreadPool& pool, const std::string& hdrPath, Source& source)
+    {
+        RadianceHDR hdr;
+        if (!hdr.open(hdrPath))
+            return;
+        source.width = hdr.width();
+        source.height = hdr.height();
+        source.pixels.resize(hdr.valueCount());
+        if (!hdr.decode(pool, source.pixels.data(), true))
+            source.pixels.clear();
+    }
+
+    void collectTimings()
+    {
+        for (int i = 0; i < QUERY_COUNT; ++i)
+        {
+            if (!queryPending[i])
+                continue;
+            GLint available = 0;
+            glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                continue;
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &nanoseconds);
+            queryPending[i] = false;
+            // only frames with a meaningful amount of work say anything about the cost per unit
+            if (queryUnits[i] >= 1e5)
+                msPerUnit = 0.5 * msPerUnit + 0.5 * (nanoseconds * 1e-6 / queryUnits[i]);
+        }
+    }
+
+    void swapIn(const IBLMaps& baked)
+    {
+        // read backs not issued yet would read the released maps; issued ones have copied what they need
+        if (saving && saving->nextStep < saving->steps.size())
+            cancelSave();
+        IBLCache::release(maps);
+        maps = baked;
+        if (job)
+        {
+            job->maps = IBLMaps(); // owned by maps now
+            job->steps.clear();
+            cancel();
+        }
+    }
+
+    // drops a bake in progress together with everything it created
+    void cancel()
+    {
+        if (!job)
+            return;
+        IBLCache::release(job->maps);
+        if (job->hdrTexture)
+            glDeleteTextures(1, &job->hdrTexture);
+        if (job->uploadBuffer)
+            glDeleteBuffers(1, &job->uploadBuffer);
+        if (job->shBuffer)
+            glDeleteBuffers(1, &job->shBuffer);
+        if (job->shFence)
+            glDeleteSync(job->shFence);
+        // a running decode or projection keeps the job alive through its own reference
+        job.reset();
+    }
+
+    static unsigned int createCubemap(int size, bool mipmapped)
+    {
+        unsigned int cubemap;
+        glGenTextures(1, &cubemap);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+        for (unsigned int i = 0; i < 6; ++i)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, size, size, 0, GL_RGB, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        if (mipmapped)
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP); // allocates the chain
+        return cubemap;
+    }
+
+    // creates the textures of a cache hit and lays out their upload, a face of a level per step. Returns false
+    // (creating nothing) for an incomplete cache file.
+    bool beginUpload(Source& source)
+    {
+        Job& upload = *job;
+        upload.contents = std::move(source.contents);
+        std::vector<const IBLCacheTexture*> records;
+        if (!IBLCache::allocate(upload.contents, upload.maps, records))
+        {
+            upload.contents = IBLCacheContents();
+            return false;
+        }
+        upload.cached = true;
+        // records point into job->contents, which lives as long as the steps
+        for (const IBLCacheTexture* texture : records)
+        {
+            for (uint32_t level = 0; level < texture->levels; ++level)
+            {
+                const double texels = double(texture->levelWidth(level)) * texture->levelHeight(level);
+                for (uint32_t face = 0; face < texture->faces; ++face)
+                {
+                    upload.steps.push_back({ texels, [this, texture, level, face]()
+                    {
+                        glBindTexture(texture->target, IBLCache::textureOf(job->maps, texture->slot));
+                        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+                        IBLCache::uploadImage(*texture, level, face);
+                        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+                        return true;
+                    } });
+                }
+            }
+        }
+        return true;
+    }
+
+    // creates the source and target textures and lays out the steps of the bake, starting with the upload of
+    // the decoded image
+    void begin(Source& source)
+    {
+        Job& bake = *job;
+        bake.hdrWidth = source.width;
+        bake.hdrHeight = source.height;
+        bake.hdrPixels = std::move(source.pixels);
+        glGenTextures(1, &bake.hdrTexture);
+        glBindTexture(GL_TEXTURE_2D, bake.hdrTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, bake.hdrWidth, bake.hdrHeight, 0, GL_RGB, GL_HALF_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glGenBuffers(1, &bake.uploadBuffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, bake.uploadBuffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bake.hdrPixels.size() * sizeof(uint16_t), nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        const int envSize = config.environmentSize;
+        bake.maps.envCubemap = createCubemap(envSize, true);
+        bake.maps.prefilterMap = createCubemap(config.prefilterSize, true);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, bake.maps.prefilterMap);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, config.prefilterMipLevels - 1);
+        if (!config.irradianceSH)
+            bake.maps.irradianceMap = createCubemap(config.irradianceSize, false);
+
+        std::vector<Step>& steps = bake.steps;
+        const double envFaceTexels = double(envSize) * envSize;
+
+        addHDRUploadSteps(steps);
+
+        // equirectangular -> cubemap, a face per step
+        for (int face = 0; face < 6; ++face)
+        {
+            steps.push_back({ envFaceTexels, [this, face]()
+            {
+                toCubemapShader.use();
+                toCubemapShader.setInt("captureFace", face);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, job->hdrTexture);
+                if (capture.begin(job->maps.envCubemap, 0, config.environmentSize, false))
+                    drawCube();
+                return true;
+            } });
+        }
+        steps.push_back({ envFaceTexels * 8.0, [this]()
+        {
+            glBindTexture(GL_TEXTURE_CUBE_MAP, job->maps.envCubemap);
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+            glDeleteTextures(1, &job->hdrTexture);
+            job->hdrTexture = 0;
+            return true;
+        } });
+
+        if (config.irradianceSH)
+            addSHSteps(steps);
+        else
+            addIrradianceSteps(steps);
+
+        // pre-filter, a face of a mip per step
+        for (unsigned int mip = 0; mip < config.prefilterMipLevels; ++mip)
+        {
+            const float roughness = config.prefilterMipLevels > 1 ? float(mip) / float(config.prefilterMipLevels - 1) : 0.0f;
+            const unsigned int sampleCount = IBLSampling::prefilterSampleCount(mip, config.sampleCount);
+            const int mipSize = std::max(1, int(config.prefilterSize) >> mip);
+            for (int face = 0; face < 6; ++face)
+            {
+                steps.push_back({ double(mipSize) * mipSize * sampleCount, [this, mip, face, roughness, sampleCount, mipSize]()
+                {
+                    prefilterShader.use();
+                    if (face == 0)
+                    {
+                        std::vector<glm::vec4> samples = IBLSampling::prefilterSamples(roughness, sampleCount, config.environmentSize);
+                        glBindBuffer(GL_UNIFORM_BUFFER, samplesUbo);
+                        glBufferSubData(GL_UNIFORM_BUFFER, 0, samples.size() * sizeof(glm::vec4), samples.data());
+                        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+                        prefilterShader.setInt("sampleCount", static_cast<int>(samples.size()));
+                    }
+                    glBindBufferBase(GL_UNIFORM_BUFFER, SAMPLES_BINDING, samplesUbo);
+                    prefilterShader.setInt("captureFace", face);
+                    glActiveTexture(GL_TEXTURE0);
+                    glBindTexture(GL_TEXTURE_CUBE_MAP, job->maps.envCubemap);
+                    if (capture.begin(job->maps.prefilterMap, mip, mipSize, false))
+                        drawCube();
+                    return true;
+                } });
+            }
+        }
+        if (config.irradianceSH)
+            addSHWaitStep(steps);
+
+        // the octahedral layout is a conversion of the finished cubemaps, in one go
+        if (config.octahedral)
+        {
+            if (!octahedralEncoder)
+                octahedralEncoder.reset(new OctahedralEncoder());
+            const double octahedralSize = OctahedralMap::sizeForFace(envSize);
+            steps.push_back({ octahedralSize * octahedralSize * 2.0, [this]()
+            {
+                octahedralEncoder->convert(job->maps, config);
+                return true;
+            } });
+        }
+    }
+
+    // a band of rows per step: copied into its own range of the pixel buffer, which needs no synchronization as the
+    // ranges don't overlap, and sourced from there by glTexSubImage2D
+    void addHDRUploadSteps(std::vector<Step>& steps)
+    {
+        const int width = job->hdrWidth, height = job->hdrHeight;
+        const int bandRows = std::max(1, UPLOAD_BAND_TEXELS / width);
+        for (int firstRow = 0; firstRow < height; firstRow += bandRows)
+        {
+            const int rows = std::min(bandRows, height - firstRow);
+            steps.push_back({ double(width) * rows, [this, firstRow, rows]()
+            {
+                const size_t rowValues = static_cast<size_t>(job->hdrWidth) * 3;
+                const size_t offset = firstRow * rowValues * sizeof(uint16_t);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job->uploadBuffer);
+                void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, rows * rowValues * sizeof(uint16_t),
+                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+                if (mapped)
+                    std::copy_n(job->hdrPixels.data() + firstRow * rowValues, rows * rowValues, static_cast<uint16_t*>(mapped));
+                // the range is undefined if the buffer got corrupted while mapped (e.g. a mode switch), copy it again next frame
+                const bool copied = mapped && glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                if (copied)
+                {
+                    glBindTexture(GL_TEXTURE_2D, job->hdrTexture);
+                    glPixelStorei(GL_UNPACK_ALIGNMENT, 2); // rows of 6-byte texels
+                    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, firstRow, job->hdrWidth, rows, GL_RGB, GL_HALF_FLOAT, reinterpret_cast<void*>(offset));
+                    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+                }
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                return copied;
+            } });
+        }
+        // every copy out of the buffer has been issued, GL keeps it alive until they're done
+        steps.push_back({ 0.0, [this]()
+        {
+            glDeleteBuffers(1, &job->uploadBuffer);
+            job->uploadBuffer = 0;
+            std::vector<uint16_t>().swap(job->hdrPixels);
+            return true;
+        } });
+    }
+
+    void addIrradianceSteps(std::vector<Step>& steps)
+    {
+        // the Riemann sum in 2.2.2.irradiance_convolution.fs takes roughly 251 x 63 samples per texel
+        const double faceCost = double(config.irradianceSize) * config.irradianceSize * 251.0 * 63.0;
+        for (int face = 0; face < 6; ++face)
+        {
+            steps.push_back({ faceCost, [this, face]()
+            {
+                irradianceShader.use();
+                irradianceShader.setInt("captureFace", face);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_CUBE_MAP, job->maps.envCubemap);
+                if (capture.begin(job->maps.irradianceMap, 0, config.irradianceSize, false))
+                    drawCube();
+                return true;
+            } });
+        }
+    }
+
+    void addSHSteps(std::vector<Step>& steps)
+    {
+        int level = 0;
+        while ((int(config.environmentSize) >> level) > SphericalHarmonics::SOURCE_SIZE)
+            ++level;
+        const int size = std::max(1, int(config.environmentSize) >> level);
+        const size_t faceFloats = static_cast<size_t>(size) * size * 3;
+
+        // asynchronous read back of a small mip into a pixel buffer
+        steps.push_back({ 0.0, [this, level, faceFloats]()
+        {
+            glGenBuffers(1, &job->shBuffer);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, job->shBuffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, 6 * faceFloats * sizeof(float), nullptr, GL_STREAM_READ);
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, job->maps.envCubemap);
+            for (unsigned int face = 0; face < 6; ++face)
+                glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGB, GL_FLOAT, (void*)(face * faceFloats * sizeof(float)));
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            job->shFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            return true;
+        } });
+        // once the copy has landed, project it on the thread pool
+        steps.push_back({ 0.0, [this, size, faceFloats]()
+        {
+            if (glClientWaitSync(job->shFence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+                return false;
+            glDeleteSync(job->shFence);
+            job->shFence = 0;
+
+            std::shared_ptr<std::vector<float>> faces = std::make_shared<std::vector<float>>(6 * faceFloats);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, job->shBuffer);
+            const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, faces->size() * sizeof(float), GL_MAP_READ_BIT);
+            if (mapped)
+                std::copy_n(static_cast<const float*>(mapped), faces->size(), faces->data());
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            glDeleteBuffers(1, &job->shBuffer);
+            job->shBuffer = 0;
+
+            std::shared_ptr<Job> owner = job;
+            ThreadPool* projectionPool = &pool;
+            job->shProjection = pool.submit([owner, faces, size, faceFloats, projectionPool]()
+            {
+                const float* facePointers[6];
+                for (int face = 0; face < 6; ++face)
+                    facePointers[face] = faces->data() + face * faceFloats;
+                SphericalHarmonics::project(*projectionPool, facePointers, size, owner->projectedSH);
+                SphericalHarmonics::irradiance(owner->projectedSH);
+            });
+            return true;
+        } });
+    }
+
+    // the coefficients have to be there before the maps can be swapped in, so this is the last step
+    void addSHWaitStep(std::vector<Step>& steps)
+    {
+        steps.push_back({ 0.0, [this]()
+        {
+            if (job->shProjection.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                return false;
+            std::copy(job->projectedSH, job->projectedSH + 9, job->maps.irradianceSH);
+            job->maps.hasIrradianceSH = true;
+            return true;
+        } });
+    }
+};
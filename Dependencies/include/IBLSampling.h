@@ -0,0 +1,100 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+
+// CPU versions of the sampling helpers used by the IBL bake shaders (prefilter.fs, 2.2.2.brdf.fs).
+// They have to stay bit-for-bit close to the GLSL so the CPU baker can serve as a reference for the GPU bake.
+namespace IBLSampling
+{
+    const float PI = 3.14159265359f;
+
+    // http://holger.dammertz.org/stuff/notes_HammersleyOnHemisphere.html
+    // efficient VanDerCorpus calculation.
+    inline float radicalInverseVdC(uint32_t bits)
+    {
+        bits = (bits << 16u) | (bits >> 16u);
+        bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+        bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+        bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+        bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+        return float(bits) * 2.3283064365386963e-10f; // / 0x100000000
+    }
+
+    inline glm::vec2 hammersley(uint32_t i, uint32_t N)
+    {
+        return glm::vec2(float(i) / float(N), radicalInverseVdC(i));
+    }
+
+    // GGX importance sample of the halfway vector, in tangent space (N = +Z)
+    inline glm::vec3 importanceSampleGGX(glm::vec2 Xi, float roughness)
+    {
+        float a = roughness * roughness;
+
+        float phi = 2.0f * PI * Xi.x;
+        float cosTheta = std::sqrt((1.0f - Xi.y) / (1.0f + (a * a - 1.0f) * Xi.y));
+        float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+
+        return glm::vec3(std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta);
+    }
+
+    inline float distributionGGX(float NdotH, float roughness)
+    {
+        float a = roughness * roughness;
+        float a2 = a * a;
+        float NdotH2 = NdotH * NdotH;
+
+        float denom = (NdotH2 * (a2 - 1.0f) + 1.0f);
+        return a2 / (PI * denom * denom);
+    }
+
+    // the tangent basis prefilter.fs builds around N
+    inline void tangentBasis(const glm::vec3& N, glm::vec3& tangent, glm::vec3& bitangent)
+    {
+        glm::vec3 up = std::abs(N.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        tangent = glm::normalize(glm::cross(up, N));
+        bitangent = glm::cross(N, tangent);
+    }
+
+    // the prefilter shader's sample table is a std140 vec4 array; 1024 of them fill the 16KB every GL 3.3
+    // implementation guarantees for a uniform block
+    const uint32_t MAX_PREFILTER_SAMPLES = 1024;
+
+    // Sample count for one pre-filter mip. Roughness 0 is a mirror and needs a single sample. The rougher mips read
+    // the environment at the mip level matching each sample's solid angle (filtered importance sampling), so the
+    // source is already pre-blurred and the count can halve with every mip down to a floor of 128.
+    inline uint32_t prefilterSampleCount(uint32_t mip, uint32_t sampleCount)
+    {
+        if (mip == 0)
+            return 1;
+        uint32_t count = std::min(sampleCount, MAX_PREFILTER_SAMPLES) >> mip;
+        return std::max(count, std::min(128u, sampleCount));
+    }
+
+    // Samples of the split-sum pre-filter for one roughness. With the N = V = R assumption the reflected light
+    // direction of each sample only depends on the sample index, so it can be computed once in tangent space:
+    // xyz is L in tangent space (its z is the NdotL weight), w is the source mip level picked from the sample's pdf.
+    // Samples below the horizon contribute nothing and are dropped.
+    inline std::vector<glm::vec4> prefilterSamples(float roughness, uint32_t sampleCount, uint32_t sourceResolution)
+    {
+        std::vector<glm::vec4> samples;
+        samples.reserve(sampleCount);
+        const float saTexel = 4.0f * PI / (6.0f * float(sourceResolution) * float(sourceResolution));
+        for (uint32_t i = 0; i < sampleCount; ++i)
+        {
+            glm::vec3 H = importanceSampleGGX(hammersley(i, sampleCount), roughness);
+            glm::vec3 L = 2.0f * H.z * H - glm::vec3(0.0f, 0.0f, 1.0f);
+            if (L.z <= 0.0f)
+                continue;
+
+            float pdf = distributionGGX(H.z, roughness) * H.z / (4.0f * H.z) + 0.0001f;
+            float saSample = 1.0f / (float(sampleCount) * pdf + 0.0001f);
+            float mipLevel = roughness == 0.0f ? 0.0f : 0.5f * std::log2(saSample / saTexel);
+            samples.push_back(glm::vec4(glm::normalize(L), std::max(mipLevel, 0.0f)));
+        }
+        return samples;
+    }
+}
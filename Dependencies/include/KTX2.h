@@ -0,0 +1,262 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+
+// a 2D block-compressed texture with its mip chain, as stored in a KTX2 file
+struct KTX2Texture
+{
+    uint32_t vkFormat = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // level 0 (full size) first
+    std::vector<std::vector<uint8_t>> levels;
+};
+
+// Reading and writing the subset of KTX2 (Khronos texture container, version 2) the texture compiler produces:
+// one face, one layer, no supercompression, 4x4 block-compressed formats. The data format descriptor is the basic
+// one for the block format, so other KTX2 tools can read the files too.
+//
+// file layout (little endian):
+//   identifier, header (vkFormat, size, layer/face/level counts), index (DFD, key/value and supercompression data
+//   ranges), one (offset, length, uncompressed length) entry per level, DFD, then the levels, smallest first
+namespace KTX2
+{
+    // the VkFormat values of the supported block formats
+    const uint32_t FORMAT_BC1_RGB_UNORM = 131;
+    const uint32_t FORMAT_BC1_RGBA_UNORM = 133;
+    const uint32_t FORMAT_BC3_UNORM = 137;
+    const uint32_t FORMAT_BC4_UNORM = 139;
+    const uint32_t FORMAT_BC5_UNORM = 141;
+    const uint32_t FORMAT_BC7_UNORM = 145;
+
+    const uint8_t IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+    // bytes per 4x4 block, 0 for formats this reader doesn't handle
+    inline uint32_t blockBytes(uint32_t vkFormat)
+    {
+        switch (vkFormat)
+        {
+        case FORMAT_BC1_RGB_UNORM:
+        case FORMAT_BC1_RGBA_UNORM:
+        case FORMAT_BC4_UNORM:
+            return 8;
+        case FORMAT_BC3_UNORM:
+        case FORMAT_BC5_UNORM:
+        case FORMAT_BC7_UNORM:
+            return 16;
+        default:
+            return 0;
+        }
+    }
+
+    inline const char* formatName(uint32_t vkFormat)
+    {
+        switch (vkFormat)
+        {
+        case FORMAT_BC1_RGB_UNORM:
+        case FORMAT_BC1_RGBA_UNORM:
+            return "BC1";
+        case FORMAT_BC3_UNORM:
+            return "BC3";
+        case FORMAT_BC4_UNORM:
+            return "BC4";
+        case FORMAT_BC5_UNORM:
+            return "BC5";
+        case FORMAT_BC7_UNORM:
+            return "BC7";
+        default:
+            return "unknown";
+        }
+    }
+
+    inline uint32_t levelSize(uint32_t vkFormat, uint32_t width, uint32_t height)
+    {
+        return ((width + 3) / 4) * ((height + 3) / 4) * blockBytes(vkFormat);
+    }
+
+    namespace detail
+    {
+        struct Header
+        {
+            uint32_t vkFormat;
+            uint32_t typeSize;
+            uint32_t pixelWidth;
+            uint32_t pixelHeight;
+            uint32_t pixelDepth;
+            uint32_t layerCount;
+            uint32_t faceCount;
+            uint32_t levelCount;
+            uint32_t supercompressionScheme;
+            uint32_t dfdByteOffset;
+            uint32_t dfdByteLength;
+            uint32_t kvdByteOffset;
+            uint32_t kvdByteLength;
+            uint64_t sgdByteOffset;
+            uint64_t sgdByteLength;
+        };
+
+        struct LevelIndex
+        {
+            uint64_t byteOffset;
+            uint64_t byteLength;
+            uint64_t uncompressedByteLength;
+        };
+
+        inline void put32(std::vector<uint8_t>& out, uint32_t value)
+        {
+            for (int i = 0; i < 4; ++i)
+                out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+
+        // one sample of a basic data format descriptor: bits [offset, offset + length) hold channel
+        inline void putSample(std::vector<uint8_t>& out, uint32_t offset, uint32_t length, uint32_t channel)
+        {
+            put32(out, offset | ((length - 1) << 16) | (channel << 24));
+            put32(out, 0);          // sample position
+            put32(out, 0);          // lower
+            put32(out, 0xFFFFFFFF); // upper
+        }
+
+        // the basic data format descriptor of a block format (KDFS: colour model, 4x4 texel blocks, one plane)
+        inline std::vector<uint8_t> descriptor(uint32_t vkFormat)
+        {
+            // colour models and channel ids of the BC formats
+            uint32_t model = 0;
+            std::vector<uint8_t> samples;
+            switch (vkFormat)
+            {
+            case FORMAT_BC1_RGB_UNORM:
+                model = 128;
+                putSample(samples, 0, 64, 0);
+                break;
+            case FORMAT_BC1_RGBA_UNORM:
+                model = 128;
+                putSample(samples, 0, 64, 1);
+                break;
+            case FORMAT_BC3_UNORM:
+                model = 130;
+                putSample(samples, 0, 64, 15);
+                putSample(samples, 64, 64, 0);
+                break;
+            case FORMAT_BC4_UNORM:
+                model = 131;
+                putSample(samples, 0, 64, 0);
+                break;
+            case FORMAT_BC5_UNORM:
+                model = 132;
+                putSample(samples, 0, 64, 0);
+                putSample(samples, 64, 64, 1);
+                break;
+            default:
+                model = 134;
+                putSample(samples, 0, 128, 0);
+                break;
+            }
+            std::vector<uint8_t> block;
+            const uint32_t blockSize = 24 + static_cast<uint32_t>(samples.size());
+            put32(block, 4 + blockSize); // total size
+            put32(block, 0);             // vendor id, descriptor type
+            put32(block, 2 | (blockSize << 16));
+            put32(block, model | (1u << 8) | (1u << 16)); // BT.709 primaries, linear transfer, straight alpha
+            put32(block, 3 | (3u << 8));                  // 4x4x1x1 texels per block
+            put32(block, blockBytes(vkFormat));           // bytes in plane 0
+            put32(block, 0);
+            block.insert(block.end(), samples.begin(), samples.end());
+            return block;
+        }
+    }
+
+    // writes texture to path; the levels have to be complete (levelSize bytes each)
+    inline bool write(const std::string& path, const KTX2Texture& texture)
+    {
+        using namespace detail;
+        const uint32_t levelCount = static_cast<uint32_t>(texture.levels.size());
+        const std::vector<uint8_t> dfd = descriptor(texture.vkFormat);
+
+        Header header = {};
+        header.vkFormat = texture.vkFormat;
+        header.typeSize = 1;
+        header.pixelWidth = texture.width;
+        header.pixelHeight = texture.height;
+        header.faceCount = 1;
+        header.levelCount = levelCount;
+        header.dfdByteOffset = static_cast<uint32_t>(sizeof(IDENTIFIER) + sizeof(Header) + levelCount * sizeof(LevelIndex));
+        header.dfdByteLength = static_cast<uint32_t>(dfd.size());
+
+        // levels go smallest first, each aligned to the block size (which also keeps them 4 byte aligned)
+        const uint64_t alignment = blockBytes(texture.vkFormat);
+        std::vector<LevelIndex> index(levelCount);
+        uint64_t offset = header.dfdByteOffset + header.dfdByteLength;
+        for (uint32_t level = levelCount; level-- > 0;)
+        {
+            offset = (offset + alignment - 1) / alignment * alignment;
+            index[level].byteOffset = offset;
+            index[level].byteLength = texture.levels[level].size();
+            index[level].uncompressedByteLength = texture.levels[level].size();
+            offset += texture.levels[level].size();
+        }
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return false;
+        file.write(reinterpret_cast<const char*>(IDENTIFIER), sizeof(IDENTIFIER));
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(LevelIndex));
+        file.write(reinterpret_cast<const char*>(dfd.data()), dfd.size());
+        for (uint32_t level = levelCount; level-- > 0;)
+        {
+            static const char zeros[16] = {};
+            const uint64_t position = static_cast<uint64_t>(file.tellp());
+            file.write(zeros, static_cast<std::streamsize>(index[level].byteOffset - position));
+            file.write(reinterpret_cast<const char*>(texture.levels[level].data()), texture.levels[level].size());
+        }
+        return static_cast<bool>(file);
+    }
+
+    // reads a KTX2 file of a supported block format from memory. Returns false for anything else (other formats,
+    // supercompression, arrays, cube maps, 3D textures or a damaged file).
+    inline bool read(const uint8_t* data, size_t size, KTX2Texture& texture)
+    {
+        using namespace detail;
+        Header header;
+        if (size < sizeof(IDENTIFIER) + sizeof(Header) || std::memcmp(data, IDENTIFIER, sizeof(IDENTIFIER)) != 0)
+            return false;
+        std::memcpy(&header, data + sizeof(IDENTIFIER), sizeof(Header));
+        if (blockBytes(header.vkFormat) == 0 || header.supercompressionScheme != 0 || header.pixelDepth != 0 || header.layerCount > 1 ||
+            header.faceCount != 1 || header.levelCount == 0 || header.levelCount > 32 || header.pixelWidth == 0 || header.pixelHeight == 0)
+            return false;
+        const size_t indexOffset = sizeof(IDENTIFIER) + sizeof(Header);
+        if (indexOffset + header.levelCount * sizeof(LevelIndex) > size)
+            return false;
+
+        texture.vkFormat = header.vkFormat;
+        texture.width = header.pixelWidth;
+        texture.height = header.pixelHeight;
+        texture.levels.assign(header.levelCount, std::vector<uint8_t>());
+        for (uint32_t level = 0; level < header.levelCount; ++level)
+        {
+            LevelIndex entry;
+            std::memcpy(&entry, data + indexOffset + level * sizeof(LevelIndex), sizeof(LevelIndex));
+            const uint32_t expected = levelSize(header.vkFormat, std::max(1u, header.pixelWidth >> level), std::max(1u, header.pixelHeight >> level));
+            if (entry.byteLength != expected || entry.byteOffset > size || entry.byteLength > size - entry.byteOffset)
+                return false;
+            texture.levels[level].assign(data + entry.byteOffset, data + entry.byteOffset + entry.byteLength);
+        }
+        return true;
+    }
+
+    inline bool read(const std::string& path, KTX2Texture& texture)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file)
+            return false;
+        std::vector<uint8_t> data(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        return file && read(data.data(), data.size(), texture);
+    }
+}
@@ -0,0 +1,140 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+
+#include <string>
+
+// the texture slots of a material, in the order of their texture units (from Material::FIRST_UNIT)
+enum MaterialTexture
+{
+    MATERIAL_ALBEDO,
+    MATERIAL_METALLIC,
+    MATERIAL_ROUGHNESS,
+    MATERIAL_NORMAL,
+    MATERIAL_OCCLUSION,
+    MATERIAL_TEXTURE_COUNT
+};
+
+// how a material's textures reach the shader. Separate binds every slot to its own unit. PackedORM binds three
+// textures: albedo, one the TextureCache packs at import from the occlusion (R), roughness (G) and metallic (B)
+// slots, and the normal map. That is two sampler bindings per draw and two texture fetches per fragment fewer.
+// 2.2.2.pbr.fs is compiled for one of them (shaderDefines).
+enum class MaterialLayout
+{
+    Separate,
+    PackedORM
+};
+
+// A metallic-roughness material as imported from a model file (Model::processMaterial): the image of each slot
+// and the factors 2.2.2.pbr.fs multiplies them with. Slots without an image sample the TextureCache's 1x1
+// stand-ins, so a material without a metallic map is just its metallic factor.
+//
+// glTF packs metallic (B) and roughness (G) into one image; both slots then name that image, which the cache
+// loads once, and the channels tell the shader where to read.
+struct Material
+{
+    // texture units of the slots; 0-2 hold the IBL maps. PackedORM uses the first three: albedo, ORM, normal.
+    static constexpr unsigned int FIRST_UNIT = 3;
+
+    glm::vec4 baseColorFactor = glm::vec4(1.0f);
+    float metallicFactor = 1.0f;
+    float roughnessFactor = 1.0f;
+    // channel of the metallic and roughness images holding the value
+    int metallicChannel = 0;
+    int roughnessChannel = 0;
+    // image file of each slot, empty for none
+    std::string texturePaths[MATERIAL_TEXTURE_COUNT];
+    // the TextureCache handles of the slots' textures, set by loadTextures; they name a placeholder while the
+    // image is still loading
+    const unsigned int* textures[MATERIAL_TEXTURE_COUNT] = {};
+    // the packed occlusion-roughness-metallic texture with MaterialLayout::PackedORM (the metallic, roughness and
+    // occlusion handles are null then)
+    const unsigned int* orm = nullptr;
+
+    // the defines 2.2.2.pbr.fs needs for layout
+    static std::string shaderDefines(MaterialLayout layout)
+    {
+        return layout == MaterialLayout::PackedORM ? "#define MATERIAL_ORM\n" : "";
+    }
+
+    // points the shader's material samplers at the material texture units
+    static void setSamplers(Shader& shader, MaterialLayout layout = MaterialLayout::Separate)
+    {
+        if (layout == MaterialLayout::PackedORM)
+        {
+            shader.setInt("albedoMap", FIRST_UNIT);
+            shader.setInt("ormMap", FIRST_UNIT + 1);
+            shader.setInt("normalMap", FIRST_UNIT + 2);
+            return;
+        }
+        static const char* const names[MATERIAL_TEXTURE_COUNT] = { "albedoMap", "metallicMap", "roughnessMap", "normalMap", "aoMap" };
+        for (int slot = 0; slot < MATERIAL_TEXTURE_COUNT; slot++)
+            shader.setInt(names[slot], FIRST_UNIT + slot);
+    }
+
+    // fetches the slots' textures from the cache, decoding new ones on pool; has to run on the GL thread. Until
+    // their images arrive the slots sample a neutral texel: mid grey albedo, a rough dielectric (in either the
+    // separate or glTF's packed channels), a flat normal and no occlusion.
+    void loadTextures(TextureCache& cache, ThreadPool& pool, MaterialLayout layout = MaterialLayout::Separate)
+    {
+        static const unsigned char placeholders[MATERIAL_TEXTURE_COUNT][4] = {
+            { 128, 128, 128, 255 }, { 0, 255, 0, 255 }, { 255, 255, 0, 255 }, { 128, 128, 255, 255 }, { 255, 255, 255, 255 }
+        };
+        for (int slot = 0; slot < MATERIAL_TEXTURE_COUNT; slot++)
+        {
+            const bool packed = slot == MATERIAL_OCCLUSION || slot == MATERIAL_ROUGHNESS || slot == MATERIAL_METALLIC;
+            if (layout == MaterialLayout::PackedORM && packed)
+            {
+                textures[slot] = nullptr;
+                continue;
+            }
+            textures[slot] = texturePaths[slot].empty() ? nullptr : cache.get(texturePaths[slot], pool, placeholders[slot]);
+            if (!textures[slot])
+                textures[slot] = slot == MATERIAL_NORMAL ? cache.flatNormal() : cache.white();
+        }
+        orm = nullptr;
+        if (layout == MaterialLayout::PackedORM)
+        {
+            // no occlusion, rough, dielectric
+            static const unsigned char placeholder[4] = { 255, 255, 0, 255 };
+            const std::string paths[3] = { texturePaths[MATERIAL_OCCLUSION], texturePaths[MATERIAL_ROUGHNESS], texturePaths[MATERIAL_METALLIC] };
+            const int channels[3] = { 0, roughnessChannel, metallicChannel };
+            orm = cache.getPacked(paths, channels, pool, placeholder);
+            if (!orm)
+                orm = cache.white();
+        }
+    }
+
+    // binds the textures to their units and sets the factors, in the layout loadTextures loaded them for
+    void bind(Shader& shader) const
+    {
+        if (orm)
+        {
+            const unsigned int* const bound[3] = { textures[MATERIAL_ALBEDO], orm, textures[MATERIAL_NORMAL] };
+            for (int i = 0; i < 3; i++)
+            {
+                glActiveTexture(GL_TEXTURE0 + FIRST_UNIT + i);
+                glBindTexture(GL_TEXTURE_2D, bound[i] ? *bound[i] : 0);
+            }
+        }
+        else
+        {
+            for (int slot = 0; slot < MATERIAL_TEXTURE_COUNT; slot++)
+            {
+                glActiveTexture(GL_TEXTURE0 + FIRST_UNIT + slot);
+                glBindTexture(GL_TEXTURE_2D, textures[slot] ? *textures[slot] : 0);
+            }
+            shader.setInt("metallicChannel", metallicChannel);
+            shader.setInt("roughnessChannel", roughnessChannel);
+        }
+        glActiveTexture(GL_TEXTURE0);
+        shader.setVec4("baseColorFactor", baseColorFactor);
+        shader.setFloat("metallicFactor", metallicFactor);
+        shader.setFloat("roughnessFactor", roughnessFactor);
+    }
+};
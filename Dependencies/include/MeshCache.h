@@ -0,0 +1,356 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+#include "Material.h"
+#include "Hash.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "Meshlets.h"
+#include "MappedFile.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+// Compiled meshes of a model file, written after the first assimp import and memory-mapped on later runs: the
+// vertex and index blobs are stored in the exact layout the GL buffers use (the model's VertexFormat, 16 or 32-bit
+// indices per mesh), so loading is a table walk and one glBufferData per buffer straight from the mapping, with no
+// importer, no optimization pass and no per-vertex loop. Meshlets are stored as they are, too.
+//
+// Like the IBL cache (IBLCacheFile.h) the file is named after a key that hashes the source model, the import
+// flags, the vertex format, whether meshlets are built and the versions of the passes that process the import, so
+// a changed source simply misses. The materials are stored with the meshes, so a hit needs no importer for them
+// either; their textures are referenced by path and loaded (and checked for changes) by the TextureCache as usual.
+//
+// file layout (native endianness):
+//   header : magic 'EVCM', version, key, vertex format, mesh count, vertex blob offset and size, index blob offset
+//            and size, meshlet blob offset and count, material table offset and count, string blob offset and size
+//   table  : per mesh, its first vertex, vertex count, byte offset of its indices in the index blob, index count,
+//            index size, material, bounds, levels of detail, first meshlet and meshlet count
+//   blobs  : all vertices, then all indices, then all meshlets, then the material table (factors, channels and the
+//            offset and length of each slot's texture path) and the texture paths, each starting on a BLOB_ALIGNMENT
+//            boundary
+class MeshCache
+{
+public:
+    static constexpr uint32_t MAGIC = 0x4D435645; // "EVCM"
+    static constexpr uint32_t VERSION = 6;
+    static constexpr const char* DIRECTORY = "Cache/Meshes";
+
+    explicit MeshCache(const std::string& directory = DIRECTORY) : directory(directory) {}
+
+    // builds the cache key from everything the imported meshes depend on
+    static uint64_t computeKey(const std::string& modelPath, unsigned int importFlags, VertexFormat format, bool meshlets)
+    {
+        Hasher hasher;
+        hasher.update(static_cast<uint64_t>(VERSION));
+        hasher.update(static_cast<uint64_t>(importFlags));
+        hasher.update(static_cast<uint64_t>(format));
+        hasher.update(static_cast<uint64_t>(VertexLayout::stride(format)));
+        hasher.update(static_cast<uint64_t>(MeshOptimizer::VERSION));
+        hasher.update(static_cast<uint64_t>(MeshSimplifier::VERSION));
+        hasher.update(static_cast<uint64_t>(meshlets ? Meshlets::VERSION : 0));
+        hasher.updateFile(modelPath);
+        // glTF keeps its geometry in external buffers next to the .gltf; hashing every .bin beside the model
+        // covers them without parsing the JSON
+        std::error_code error;
+        std::filesystem::path modelDirectory = std::filesystem::path(modelPath).parent_path();
+        std::vector<std::string> buffers;
+        for (const auto& entry : std::filesystem::directory_iterator(modelDirectory.empty() ? "." : modelDirectory, error))
+            if (entry.path().extension() == ".bin")
+                buffers.push_back(entry.path().generic_string());
+        std::sort(buffers.begin(), buffers.end());
+        for (const std::string& buffer : buffers)
+            hasher.updateFile(buffer);
+        return hasher.digest();
+    }
+
+    std::string pathFor(uint64_t key) const
+    {
+        return (std::filesystem::path(directory) / (Hasher::toHex(key) + ".meshcache")).generic_string();
+    }
+
+    // maps the cache file for key and creates its meshes and materials (without their textures). Returns false
+    // (and leaves meshes and materials alone) on a miss or a damaged file.
+    bool load(uint64_t key, std::vector<Mesh>& meshes, std::vector<Material>& materials) const
+    {
+        const std::string path = pathFor(key);
+        MappedFile file;
+        if (!file.open(path))
+            return false;
+
+        Header header;
+        if (file.size() < sizeof(Header))
+            return false;
+        std::memcpy(&header, file.data(), sizeof(Header));
+        const VertexFormat format = static_cast<VertexFormat>(header.vertexFormat);
+        if (header.magic != MAGIC || header.version != VERSION || header.key != key ||
+            (format != VertexFormat::Float && format != VertexFormat::Quantized))
+        {
+            std::cout << "Mesh cache: ignoring outdated file " << path << std::endl;
+            return false;
+        }
+        const uint64_t tableEnd = sizeof(Header) + header.meshCount * sizeof(Entry);
+        if (header.meshCount > (1u << 20) || tableEnd > file.size() || header.vertexOffset + header.vertexBytes > file.size() ||
+            header.indexOffset + header.indexBytes > file.size() || header.meshletOffset + header.meshletCount * sizeof(Meshlet) > file.size() ||
+            header.materialCount > (1u << 20) || header.materialOffset + header.materialCount * sizeof(MaterialEntry) > file.size() ||
+            header.stringOffset + header.stringBytes > file.size())
+        {
+            std::cout << "Mesh cache: damaged file " << path << std::endl;
+            return false;
+        }
+
+        const uint8_t* vertices = file.data() + header.vertexOffset;
+        const uint8_t* indices = file.data() + header.indexOffset;
+        const uint8_t* meshlets = file.data() + header.meshletOffset;
+        const char* strings = reinterpret_cast<const char*>(file.data() + header.stringOffset);
+        std::vector<MaterialEntry> materialTable(header.materialCount);
+        std::memcpy(materialTable.data(), file.data() + header.materialOffset, materialTable.size() * sizeof(MaterialEntry));
+        for (const MaterialEntry& entry : materialTable)
+        {
+            bool valid = true;
+            for (int slot = 0; slot < MATERIAL_TEXTURE_COUNT; ++slot)
+                valid = valid && uint64_t(entry.pathOffset[slot]) + entry.pathLength[slot] <= header.stringBytes;
+            if (!valid || entry.metallicChannel > 3 || entry.roughnessChannel > 3)
+            {
+                std::cout << "Mesh cache: damaged file " << path << std::endl;
+                return false;
+            }
+        }
+        std::vector<Entry> table(header.meshCount);
+        std::memcpy(table.data(), file.data() + sizeof(Header), table.size() * sizeof(Entry));
+        const size_t stride = VertexLayout::stride(format);
+        for (const Entry& entry : table)
+        {
+            bool valid = entry.lodCount > 0 && entry.lodCount <= MeshSimplifier::MAX_LEVELS &&
+                         entry.firstMeshlet + entry.meshletCount <= header.meshletCount && entry.materialIndex < header.materialCount;
+            for (uint32_t lod = 0; valid && lod < entry.lodCount; ++lod)
+                valid = uint64_t(entry.lods[lod].firstIndex) + entry.lods[lod].indexCount <= entry.indexCount &&
+                        uint64_t(entry.lods[lod].firstMeshlet) + entry.lods[lod].meshletCount <= entry.meshletCount;
+            if (!valid || (entry.firstVertex + entry.vertexCount) * stride > header.vertexBytes ||
+                (entry.indexSize != sizeof(uint16_t) && entry.indexSize != sizeof(uint32_t)) ||
+                entry.indexOffset + entry.indexCount * entry.indexSize > header.indexBytes)
+            {
+                std::cout << "Mesh cache: damaged file " << path << std::endl;
+                return false;
+            }
+        }
+        for (const MaterialEntry& entry : materialTable)
+        {
+            Material material;
+            material.baseColorFactor = glm::vec4(entry.baseColorFactor[0], entry.baseColorFactor[1], entry.baseColorFactor[2], entry.baseColorFactor[3]);
+            material.metallicFactor = entry.metallicFactor;
+            material.roughnessFactor = entry.roughnessFactor;
+            material.metallicChannel = static_cast<int>(entry.metallicChannel);
+            material.roughnessChannel = static_cast<int>(entry.roughnessChannel);
+            for (int slot = 0; slot < MATERIAL_TEXTURE_COUNT; ++slot)
+                material.texturePaths[slot].assign(strings + entry.pathOffset[slot], entry.pathLength[slot]);
+            materials.push_back(material);
+        }
+        for (const Entry& entry : table)
+        {
+            std::vector<Meshlet> meshMeshlets(entry.meshletCount);
+            if (entry.meshletCount > 0)
+                std::memcpy(meshMeshlets.data(), meshlets + entry.firstMeshlet * sizeof(Meshlet), entry.meshletCount * sizeof(Meshlet));
+            meshes.push_back(Mesh(vertices + entry.firstVertex * stride, entry.vertexCount, format,
+                                  indices + entry.indexOffset, entry.indexCount,
+                                  entry.indexSize == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+                                  glm::vec3(entry.boundsMin[0], entry.boundsMin[1], entry.boundsMin[2]),
+                                  glm::vec3(entry.boundsMax[0], entry.boundsMax[1], entry.boundsMax[2]),
+                                  std::vector<MeshLod>(entry.lods, entry.lods + entry.lodCount), std::move(meshMeshlets)));
+            meshes.back().materialIndex = entry.materialIndex;
+        }
+        return true;
+    }
+
+    // writes the meshes of a fresh import (they have to carry their CPU-side vertices and indices and share one
+    // vertex format) and the materials they index, under a temporary name first and then renamed, so an
+    // interrupted write never leaves a truncated entry behind
+    bool save(uint64_t key, const std::vector<Mesh>& meshes, const std::vector<Material>& materials) const
+    {
+        const VertexFormat format = meshes.empty() ? VertexFormat::Float : meshes.front().format;
+        const size_t stride = VertexLayout::stride(format);
+        const std::string path = pathFor(key);
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+
+        Header header = {};
+        header.magic = MAGIC;
+        header.version = VERSION;
+        header.key = key;
+        header.vertexFormat = static_cast<uint32_t>(format);
+        header.meshCount = meshes.size();
+        std::vector<Entry> table;
+        uint64_t vertexCount = 0, indexBytes = 0, meshletCount = 0;
+        for (const Mesh& mesh : meshes)
+        {
+            Entry entry = {};
+            entry.firstVertex = vertexCount;
+            entry.vertexCount = mesh.vertices.size();
+            entry.indexOffset = indexBytes;
+            entry.indexCount = mesh.indices.size();
+            entry.indexSize = static_cast<uint32_t>(VertexLayout::indexSize(mesh.indexType));
+            entry.materialIndex = mesh.materialIndex;
+            entry.lodCount = static_cast<uint32_t>(std::min<size_t>(mesh.lods.size(), MeshSimplifier::MAX_LEVELS));
+            std::copy(mesh.lods.begin(), mesh.lods.begin() + entry.lodCount, entry.lods);
+            entry.firstMeshlet = meshletCount;
+            entry.meshletCount = mesh.meshlets.size();
+            meshletCount += entry.meshletCount;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                entry.boundsMin[axis] = mesh.boundsMin[axis];
+                entry.boundsMax[axis] = mesh.boundsMax[axis];
+            }
+            table.push_back(entry);
+            vertexCount += entry.vertexCount;
+            // keeps every mesh's indices aligned to their size
+            indexBytes = (indexBytes + entry.indexCount * entry.indexSize + 3) / 4 * 4;
+        }
+        header.vertexOffset = align(sizeof(Header) + table.size() * sizeof(Entry));
+        header.vertexBytes = vertexCount * stride;
+        header.indexOffset = align(header.vertexOffset + header.vertexBytes);
+        header.indexBytes = indexBytes;
+        header.meshletOffset = align(header.indexOffset + header.indexBytes);
+        header.meshletCount = meshletCount;
+        std::vector<MaterialEntry> materialTable;
+        std::string strings;
+        for (const Material& material : materials)
+        {
+            MaterialEntry entry = {};
+            for (int channel = 0; channel < 4; ++channel)
+                entry.baseColorFactor[channel] = material.baseColorFactor[channel];
+            entry.metallicFactor = material.metallicFactor;
+            entry.roughnessFactor = material.roughnessFactor;
+            entry.metallicChannel = static_cast<uint32_t>(material.metallicChannel);
+            entry.roughnessChannel = static_cast<uint32_t>(material.roughnessChannel);
+            for (int slot = 0; slot < MATERIAL_TEXTURE_COUNT; ++slot)
+            {
+                entry.pathOffset[slot] = static_cast<uint32_t>(strings.size());
+                entry.pathLength[slot] = static_cast<uint32_t>(material.texturePaths[slot].size());
+                strings += material.texturePaths[slot];
+            }
+            materialTable.push_back(entry);
+        }
+        header.materialOffset = align(header.meshletOffset + header.meshletCount * sizeof(Meshlet));
+        header.materialCount = materialTable.size();
+        header.stringOffset = align(header.materialOffset + header.materialCount * sizeof(MaterialEntry));
+        header.stringBytes = strings.size();
+
+        const std::string tempPath = path + ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            if (!file)
+            {
+                std::cout << "Mesh cache: can't write " << tempPath << std::endl;
+                return false;
+            }
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(Entry));
+            pad(file, header.vertexOffset);
+            for (const Mesh& mesh : meshes)
+            {
+                std::vector<unsigned char> packed = mesh.packedVertices();
+                file.write(reinterpret_cast<const char*>(packed.data()), packed.size());
+            }
+            pad(file, header.indexOffset);
+            for (size_t i = 0; i < meshes.size(); i++)
+            {
+                pad(file, header.indexOffset + table[i].indexOffset);
+                std::vector<unsigned char> packed = meshes[i].packedIndices();
+                file.write(reinterpret_cast<const char*>(packed.data()), packed.size());
+            }
+            pad(file, header.meshletOffset);
+            for (const Mesh& mesh : meshes)
+                file.write(reinterpret_cast<const char*>(mesh.meshlets.data()), mesh.meshlets.size() * sizeof(Meshlet));
+            pad(file, header.materialOffset);
+            file.write(reinterpret_cast<const char*>(materialTable.data()), materialTable.size() * sizeof(MaterialEntry));
+            pad(file, header.stringOffset);
+            file.write(strings.data(), strings.size());
+            if (!file)
+            {
+                std::cout << "Mesh cache: failed writing " << tempPath << std::endl;
+                file.close();
+                std::filesystem::remove(tempPath, error);
+                return false;
+            }
+        }
+        std::filesystem::rename(tempPath, path, error);
+        if (error)
+        {
+            std::filesystem::remove(tempPath, error);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr uint64_t BLOB_ALIGNMENT = 64;
+
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t key;
+        uint32_t vertexFormat;
+        uint32_t reserved;
+        uint64_t meshCount;
+        uint64_t vertexOffset;
+        uint64_t vertexBytes;
+        uint64_t indexOffset;
+        uint64_t indexBytes;
+        uint64_t meshletOffset;
+        uint64_t meshletCount;
+        uint64_t materialOffset;
+        uint64_t materialCount;
+        uint64_t stringOffset;
+        uint64_t stringBytes;
+    };
+
+    struct Entry
+    {
+        uint64_t firstVertex;
+        uint64_t vertexCount;
+        uint64_t indexOffset;
+        uint64_t indexCount;
+        uint32_t indexSize;
+        uint32_t materialIndex;
+        float boundsMin[3];
+        float boundsMax[3];
+        uint32_t lodCount;
+        MeshLod lods[MeshSimplifier::MAX_LEVELS];
+        uint64_t firstMeshlet;
+        uint64_t meshletCount;
+    };
+
+    struct MaterialEntry
+    {
+        float baseColorFactor[4];
+        float metallicFactor;
+        float roughnessFactor;
+        uint32_t metallicChannel;
+        uint32_t roughnessChannel;
+        uint32_t pathOffset[MATERIAL_TEXTURE_COUNT];
+        uint32_t pathLength[MATERIAL_TEXTURE_COUNT];
+    };
+
+    std::string directory;
+
+    static uint64_t align(uint64_t offset)
+    {
+        return (offset + BLOB_ALIGNMENT - 1) / BLOB_ALIGNMENT * BLOB_ALIGNMENT;
+    }
+
+    static void pad(std::ofstream& file, uint64_t offset)
+    {
+        static const char zeros[BLOB_ALIGNMENT] = {};
+        const uint64_t position = static_cast<uint64_t>(file.tellp());
+        if (offset > position)
+            file.write(zeros, static_cast<std::streamsize>(offset - position));
+    }
+};
@@ -0,0 +1,318 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include "VertexLayout.h"
+#include "MeshOptimizer.h"
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Level of detail chains for imported meshes: every level is an index buffer over the mesh's unchanged vertex
+// buffer, made by quadric error edge collapses (Garland & Heckbert, "Surface Simplification Using Quadric Error
+// Metrics").
+//
+// Collapses are half-edge collapses: a position moves onto a neighbouring one, so no new vertices are needed and
+// all levels share the vertex buffer. Where several vertices share a position (attribute seams, e.g. UV seams) they
+// move together, each onto the target vertex of its own side of the seam, so seams can only collapse along
+// themselves and the texture layout stays intact. Positions on open borders and non-manifold edges are locked,
+// which keeps the silhouette of open meshes. Meshes cut into many small charts run out of collapses sooner, their
+// chain simply ends early (the DamagedHelmet stops at 45% of its triangles).
+//
+// Each level stores its error: the square root of the largest quadric error of its collapses, i.e. an object space
+// distance that Model turns into pixels to pick a level (see Model::Draw).
+namespace MeshSimplifier
+{
+    // bump when the output changes, it's part of the mesh cache key
+    const uint32_t VERSION = 1;
+    // levels per mesh, the full detail one included
+    const unsigned int MAX_LEVELS = 6;
+    // each level aims for this fraction of the previous level's triangles...
+    const float LEVEL_RATIO = 0.5f;
+    // ...and the chain ends once a level can't get below this fraction of the previous one
+    const float MIN_REDUCTION = 0.8f;
+    // meshes and levels this small aren't simplified further
+    const size_t MIN_TRIANGLES = 32;
+    // a collapse is rejected if it turns a triangle's normal by more than ~75 degrees
+    const double MIN_NORMAL_COSINE = 0.25;
+
+    // one simplified level: its indices and its object space error
+    struct Level
+    {
+        std::vector<unsigned int> indices;
+        float error = 0.0f;
+    };
+
+    // symmetric 4x4 matrix of the plane quadrics of a vertex, weighted by triangle area
+    struct Quadric
+    {
+        double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+        double b0 = 0, b1 = 0, b2 = 0;
+        double c = 0;
+        double weight = 0;
+
+        static Quadric fromPlane(const glm::dvec3& normal, double distance, double weight)
+        {
+            Quadric q;
+            q.a00 = normal.x * normal.x * weight;
+            q.a01 = normal.x * normal.y * weight;
+            q.a02 = normal.x * normal.z * weight;
+            q.a11 = normal.y * normal.y * weight;
+            q.a12 = normal.y * normal.z * weight;
+            q.a22 = normal.z * normal.z * weight;
+            q.b0 = normal.x * distance * weight;
+            q.b1 = normal.y * distance * weight;
+            q.b2 = normal.z * distance * weight;
+            q.c = distance * distance * weight;
+            q.weight = weight;
+            return q;
+        }
+
+        Quadric& operator+=(const Quadric& other)
+        {
+            a00 += other.a00; a01 += other.a01; a02 += other.a02;
+            a11 += other.a11; a12 += other.a12; a22 += other.a22;
+            b0 += other.b0; b1 += other.b1; b2 += other.b2;
+            c += other.c;
+            weight += other.weight;
+            return *this;
+        }
+
+        // area weighted mean of the squared distances of p to the planes
+        double error(const glm::dvec3& p) const
+        {
+            const double e = a00 * p.x * p.x + 2.0 * a01 * p.x * p.y + 2.0 * a02 * p.x * p.z + a11 * p.y * p.y + 2.0 * a12 * p.y * p.z +
+                             a22 * p.z * p.z + 2.0 * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+            return weight > 0.0 ? std::max(e, 0.0) / weight : 0.0;
+        }
+    };
+
+    // builds the levels below the full detail indices (which are not part of the result), coarsest last. Every
+    // level is reordered for the vertex cache. Returns an empty chain for meshes that aren't plain triangle lists.
+    inline std::vector<Level> buildChain(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+                                         unsigned int maxLevels = MAX_LEVELS)
+    {
+        std::vector<Level> chain;
+        const size_t vertexCount = vertices.size();
+        if (indices.size() % 3 != 0 || indices.size() / 3 < MIN_TRIANGLES || maxLevels < 2)
+            return chain;
+        for (unsigned int index : indices)
+            if (index >= vertexCount)
+                return chain;
+
+        // vertices sharing a position: the first one of them stands for the position
+        std::vector<unsigned int> canonical = VertexLayout::weldPositions(vertices);
+
+        // locked positions: the ends of edges that don't have exactly one opposite edge (open borders and
+        // non-manifold edges)
+        std::vector<bool> locked(vertexCount, false);
+        {
+            std::unordered_map<uint64_t, int> edges;
+            edges.reserve(indices.size());
+            auto edgeKey = [&](unsigned int a, unsigned int b) { return (uint64_t(canonical[a]) << 32) | canonical[b]; };
+            for (size_t i = 0; i < indices.size(); i += 3)
+                for (int k = 0; k < 3; ++k)
+                    ++edges[edgeKey(indices[i + k], indices[i + (k + 1) % 3])];
+            for (size_t i = 0; i < indices.size(); i += 3)
+            {
+                for (int k = 0; k < 3; ++k)
+                {
+                    const unsigned int a = indices[i + k], b = indices[i + (k + 1) % 3];
+                    auto opposite = edges.find(edgeKey(b, a));
+                    if (opposite == edges.end() || opposite->second != 1 || edges[edgeKey(a, b)] != 1)
+                        locked[canonical[a]] = locked[canonical[b]] = true;
+                }
+            }
+        }
+
+        std::vector<Quadric> quadrics(vertexCount);
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            const glm::dvec3 p0 = vertices[indices[i]].Position;
+            const glm::dvec3 p1 = vertices[indices[i + 1]].Position;
+            const glm::dvec3 p2 = vertices[indices[i + 2]].Position;
+            const glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+            const double area = glm::length(normal);
+            if (area <= 0.0)
+                continue;
+            const Quadric q = Quadric::fromPlane(normal / area, -glm::dot(normal / area, p0), area);
+            for (int k = 0; k < 3; ++k)
+                quadrics[canonical[indices[i + k]]] += q;
+        }
+
+        // the vertices of each position as a ring
+        std::vector<unsigned int> nextWedge(vertexCount);
+        for (size_t v = 0; v < vertexCount; ++v)
+        {
+            nextWedge[v] = static_cast<unsigned int>(v);
+            if (canonical[v] != v)
+            {
+                nextWedge[v] = nextWedge[canonical[v]];
+                nextWedge[canonical[v]] = static_cast<unsigned int>(v);
+            }
+        }
+
+        // a collapse moves the position from onto the position to
+        struct Collapse
+        {
+            unsigned int from, to;
+            double error;
+        };
+        std::vector<unsigned int> current = indices;
+        std::vector<unsigned int> remap(vertexCount);
+        std::vector<bool> touched(vertexCount);
+        std::vector<unsigned int> adjacencyOffset(vertexCount + 1), adjacency;
+        std::vector<Collapse> collapses;
+        std::vector<std::pair<unsigned int, unsigned int>> wedgeMap;
+        double maxError = 0.0;
+        while (chain.size() + 1 < maxLevels && current.size() / 3 >= MIN_TRIANGLES)
+        {
+            const size_t levelStart = current.size() / 3;
+            const size_t target = static_cast<size_t>(levelStart * LEVEL_RATIO);
+            while (current.size() / 3 > target)
+            {
+                // triangles around each vertex
+                std::fill(adjacencyOffset.begin(), adjacencyOffset.end(), 0);
+                for (unsigned int index : current)
+                    ++adjacencyOffset[index + 1];
+                for (size_t v = 0; v < vertexCount; ++v)
+                    adjacencyOffset[v + 1] += adjacencyOffset[v];
+                adjacency.resize(current.size());
+                std::vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+                for (size_t i = 0; i < current.size(); ++i)
+                    adjacency[fill[current[i]]++] = static_cast<unsigned int>(i / 3);
+
+                // every edge in both directions, cheapest first
+                collapses.clear();
+                for (size_t i = 0; i < current.size(); i += 3)
+                {
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        const unsigned int a = canonical[current[i + k]], b = canonical[current[i + (k + 1) % 3]];
+                        Quadric q = quadrics[a];
+                        q += quadrics[b];
+                        if (!locked[a])
+                            collapses.push_back({ a, b, q.error(vertices[b].Position) });
+                        if (!locked[b])
+                            collapses.push_back({ b, a, q.error(vertices[a].Position) });
+                    }
+                }
+                if (collapses.empty())
+                    break;
+                std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.error < y.error; });
+
+                // independent collapses (no shared triangles) in that order until the target is in reach, each one
+                // removes about two triangles. Every edge is listed up to four times, so the error of the collapse
+                // at four times the wanted count bounds the pass: collapses above it wait for a later pass rather
+                // than being taken only because cheaper ones were blocked by their neighbours.
+                for (size_t v = 0; v < vertexCount; ++v)
+                    remap[v] = static_cast<unsigned int>(v);
+                std::fill(touched.begin(), touched.end(), false);
+                const size_t wanted = (current.size() / 3 - target + 1) / 2;
+                const double errorLimit = collapses[std::min(collapses.size() - 1, wanted * 4)].error * 1.5;
+                size_t performed = 0;
+                for (const Collapse& collapse : collapses)
+                {
+                    if (performed >= wanted || collapse.error > errorLimit)
+                        break;
+                    if (touched[collapse.from] || touched[collapse.to])
+                        continue;
+
+                    // every vertex at the moving position needs a vertex at the target position that it shares an
+                    // edge with, whose attributes it takes over: inside a UV chart that's the one vertex there, on a
+                    // seam the seam is collapsed along itself. Collapses across a seam have no such vertex.
+                    wedgeMap.clear();
+                    bool mapped = true;
+                    unsigned int wedge = collapse.from;
+                    do
+                    {
+                        unsigned int match = ~0u;
+                        for (unsigned int k = adjacencyOffset[wedge]; k < adjacencyOffset[wedge + 1] && mapped; ++k)
+                        {
+                            const unsigned int* triangle = &current[adjacency[k] * 3];
+                            for (int j = 0; j < 3; ++j)
+                            {
+                                if (canonical[triangle[j]] != collapse.to)
+                                    continue;
+                                if (match != ~0u && match != triangle[j])
+                                    mapped = false;
+                                match = triangle[j];
+                            }
+                        }
+                        if (adjacencyOffset[wedge] != adjacencyOffset[wedge + 1])
+                        {
+                            if (match == ~0u)
+                                mapped = false;
+                            wedgeMap.push_back({ wedge, match });
+                        }
+                        wedge = nextWedge[wedge];
+                    } while (wedge != collapse.from && mapped);
+                    if (!mapped)
+                        continue;
+
+                    // reject collapses that flip or squash a triangle around the moving position
+                    const glm::dvec3 target = vertices[collapse.to].Position;
+                    bool flips = false;
+                    for (const auto& pair : wedgeMap)
+                    {
+                        for (unsigned int k = adjacencyOffset[pair.first]; k < adjacencyOffset[pair.first + 1] && !flips; ++k)
+                        {
+                            const unsigned int* triangle = &current[adjacency[k] * 3];
+                            if (canonical[triangle[0]] == collapse.to || canonical[triangle[1]] == collapse.to || canonical[triangle[2]] == collapse.to)
+                                continue;
+                            glm::dvec3 before[3], after[3];
+                            for (int j = 0; j < 3; ++j)
+                            {
+                                before[j] = vertices[triangle[j]].Position;
+                                after[j] = triangle[j] == pair.first ? target : before[j];
+                            }
+                            const glm::dvec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+                            const glm::dvec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+                            flips = glm::dot(n0, n1) <= MIN_NORMAL_COSINE * glm::length(n0) * glm::length(n1);
+                        }
+                    }
+                    if (flips)
+                        continue;
+
+                    for (const auto& pair : wedgeMap)
+                    {
+                        for (unsigned int k = adjacencyOffset[pair.first]; k < adjacencyOffset[pair.first + 1]; ++k)
+                            for (int j = 0; j < 3; ++j)
+                                touched[canonical[current[adjacency[k] * 3 + j]]] = true;
+                        remap[pair.first] = pair.second;
+                    }
+                    quadrics[collapse.to] += quadrics[collapse.from];
+                    maxError = std::max(maxError, collapse.error);
+                    ++performed;
+                }
+                if (performed == 0)
+                    break;
+
+                // apply the collapses and drop the triangles that became degenerate
+                size_t write = 0;
+                for (size_t i = 0; i < current.size(); i += 3)
+                {
+                    const unsigned int a = remap[current[i]], b = remap[current[i + 1]], c = remap[current[i + 2]];
+                    if (canonical[a] == canonical[b] || canonical[b] == canonical[c] || canonical[a] == canonical[c])
+                        continue;
+                    current[write++] = a;
+                    current[write++] = b;
+                    current[write++] = c;
+                }
+                current.resize(write);
+            }
+
+            if (current.size() / 3 > levelStart * MIN_REDUCTION)
+                break;
+            Level level;
+            level.indices = current;
+            level.error = static_cast<float>(std::sqrt(maxError));
+            MeshOptimizer::optimizeVertexCache(level.indices, vertexCount);
+            chain.push_back(std::move(level));
+        }
+        return chain;
+    }
+}
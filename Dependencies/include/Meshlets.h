@@ -0,0 +1,249 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include "VertexLayout.h"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// a cluster of a mesh's triangles: a range of its index buffer with the bounds the per-frame culling tests
+struct Meshlet
+{
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    // object space bounding sphere
+    glm::vec3 center;
+    float radius;
+    // normal cone: every triangle normal is within asin(coneCutoff) of coneAxis; a cutoff of 1 is never culled
+    glm::vec3 coneAxis;
+    float coneCutoff;
+};
+
+// Splitting index ranges into meshlets (clusters of up to MAX_TRIANGLES triangles touching up to MAX_VERTICES
+// vertices) and the CPU culling of those against the view: clusters outside the frustum and clusters whose
+// triangles all face away from the eye (tested on their normal cone) are dropped before the draw, so the GPU never
+// transforms or rasterizes them.
+//
+// Building a level's meshlets reorders its triangles so that every meshlet is a range of the index buffer; the
+// visible ones are drawn as index ranges straight out of it, neighbouring ranges merged.
+namespace Meshlets
+{
+    // bump when the output changes, it's part of the mesh cache key
+    const uint32_t VERSION = 1;
+    const unsigned int MAX_VERTICES = 64;
+    const unsigned int MAX_TRIANGLES = 124;
+    // clusters whose normals spread further than this from their axis (cosine) are never backface culled
+    const float MIN_CONE_COSINE = 0.1f;
+    // once a meshlet has CONE_SEED_TRIANGLES triangles, triangles more than 60 degrees off its average normal no
+    // longer join it: smaller meshlets, but cones narrow enough to be culled (on the DamagedHelmet 12% of the
+    // triangles from random views, against 4% without the limit)
+    const unsigned int CONE_SEED_TRIANGLES = 4;
+    const float MIN_GROW_COSINE = 0.5f;
+
+    // bounds of the triangles indices[first, first + count)
+    inline Meshlet computeBounds(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, size_t first, size_t count)
+    {
+        Meshlet meshlet;
+        meshlet.firstIndex = static_cast<unsigned int>(first);
+        meshlet.indexCount = static_cast<unsigned int>(count);
+
+        // Ritter's bounding sphere: start from the points farthest apart along one sweep, then grow to cover the rest
+        const glm::vec3 p0 = vertices[indices[first]].Position;
+        glm::vec3 a = p0, b = p0;
+        for (size_t i = first; i < first + count; ++i)
+            if (glm::dot(vertices[indices[i]].Position - p0, vertices[indices[i]].Position - p0) > glm::dot(a - p0, a - p0))
+                a = vertices[indices[i]].Position;
+        for (size_t i = first; i < first + count; ++i)
+            if (glm::dot(vertices[indices[i]].Position - a, vertices[indices[i]].Position - a) > glm::dot(b - a, b - a))
+                b = vertices[indices[i]].Position;
+        glm::vec3 center = (a + b) * 0.5f;
+        float radius = glm::length(b - a) * 0.5f;
+        for (size_t i = first; i < first + count; ++i)
+        {
+            const glm::vec3 p = vertices[indices[i]].Position;
+            const float distance = glm::length(p - center);
+            if (distance > radius)
+            {
+                const float grown = (radius + distance) * 0.5f;
+                center += (p - center) * ((grown - radius) / distance);
+                radius = grown;
+            }
+        }
+        meshlet.center = center;
+        meshlet.radius = radius;
+
+        // the cone around the average of the unit triangle normals
+        std::vector<glm::vec3> normals;
+        normals.reserve(count / 3);
+        glm::vec3 axis(0.0f);
+        for (size_t i = first; i + 2 < first + count; i += 3)
+        {
+            const glm::vec3 v0 = vertices[indices[i]].Position;
+            const glm::vec3 normal = glm::cross(vertices[indices[i + 1]].Position - v0, vertices[indices[i + 2]].Position - v0);
+            const float length = glm::length(normal);
+            if (length <= 0.0f)
+                continue;
+            normals.push_back(normal / length);
+            axis += normals.back();
+        }
+        meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+        meshlet.coneCutoff = 1.0f; // never culled
+        const float axisLength = glm::length(axis);
+        if (axisLength > 0.0f)
+        {
+            axis /= axisLength;
+            float minCosine = 1.0f;
+            for (const glm::vec3& normal : normals)
+                minCosine = std::min(minCosine, glm::dot(axis, normal));
+            meshlet.coneAxis = axis;
+            if (minCosine >= MIN_CONE_COSINE)
+                meshlet.coneCutoff = std::sqrt(1.0f - minCosine * minCosine); // sine of the spread
+        }
+        return meshlet;
+    }
+
+    // Splits the triangles indices[first, first + count) into meshlets and rewrites that range in meshlet order.
+    // Meshlets are grown greedily from a seed triangle: the next triangle is the neighbour that adds the fewest new
+    // vertices, then the one closest to the meshlet's centre and normal, which keeps the spheres small and the cones
+    // narrow. A meshlet ends at its limits or when no neighbour fits any more.
+    inline void build(const std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, size_t first, size_t count,
+                      std::vector<Meshlet>& meshlets)
+    {
+        const size_t triangleCount = count / 3;
+        if (triangleCount == 0)
+            return;
+        const unsigned int* source = &indices[first];
+
+        // triangles around each position (so that growing crosses UV seams, where vertices are split), and each
+        // triangle's centroid and unit normal
+        const size_t vertexCount = vertices.size();
+        std::vector<unsigned int> canonical = VertexLayout::weldPositions(vertices);
+        std::vector<unsigned int> adjacencyOffset(vertexCount + 1, 0);
+        for (size_t i = 0; i < triangleCount * 3; ++i)
+            ++adjacencyOffset[canonical[source[i]] + 1];
+        for (size_t v = 0; v < vertexCount; ++v)
+            adjacencyOffset[v + 1] += adjacencyOffset[v];
+        std::vector<unsigned int> adjacency(triangleCount * 3);
+        {
+            std::vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+            for (size_t i = 0; i < triangleCount * 3; ++i)
+                adjacency[fill[canonical[source[i]]]++] = static_cast<unsigned int>(i / 3);
+        }
+        std::vector<glm::vec3> centroids(triangleCount), normals(triangleCount);
+        for (size_t t = 0; t < triangleCount; ++t)
+        {
+            const glm::vec3 p0 = vertices[source[t * 3]].Position, p1 = vertices[source[t * 3 + 1]].Position,
+                            p2 = vertices[source[t * 3 + 2]].Position;
+            centroids[t] = (p0 + p1 + p2) / 3.0f;
+            const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            const float length = glm::length(normal);
+            normals[t] = length > 0.0f ? normal / length : glm::vec3(0.0f);
+        }
+
+        std::vector<unsigned int> ordered;
+        ordered.reserve(triangleCount * 3);
+        std::vector<bool> emitted(triangleCount, false);
+        std::vector<unsigned int> used; // vertices of the meshlet being grown
+        used.reserve(MAX_VERTICES);
+        size_t cursor = 0;
+        while (true)
+        {
+            while (cursor < triangleCount && emitted[cursor])
+                ++cursor;
+            if (cursor == triangleCount)
+                break;
+
+            const size_t start = ordered.size();
+            used.clear();
+            glm::vec3 centroidSum(0.0f), normalSum(0.0f);
+            unsigned int triangles = 0;
+            size_t next = cursor;
+            while (next != size_t(-1))
+            {
+                emitted[next] = true;
+                for (int k = 0; k < 3; ++k)
+                {
+                    ordered.push_back(source[next * 3 + k]);
+                    if (std::find(used.begin(), used.end(), source[next * 3 + k]) == used.end())
+                        used.push_back(source[next * 3 + k]);
+                }
+                centroidSum += centroids[next];
+                normalSum += normals[next];
+                if (++triangles >= MAX_TRIANGLES)
+                    break;
+
+                // best neighbour that still fits
+                const glm::vec3 center = centroidSum / float(triangles);
+                const float normalLength = glm::length(normalSum);
+                const glm::vec3 axis = normalLength > 0.0f ? normalSum / normalLength : glm::vec3(0.0f);
+                next = size_t(-1);
+                unsigned int bestAdded = 4;
+                float bestScore = 0.0f;
+                for (unsigned int vertex : used)
+                {
+                    const unsigned int v = canonical[vertex];
+                    for (unsigned int k = adjacencyOffset[v]; k < adjacencyOffset[v + 1]; ++k)
+                    {
+                        const unsigned int t = adjacency[k];
+                        if (emitted[t])
+                            continue;
+                        unsigned int added = 0;
+                        for (int j = 0; j < 3; ++j)
+                            if (std::find(used.begin(), used.end(), source[t * 3 + j]) == used.end())
+                                ++added;
+                        if (used.size() + added > MAX_VERTICES || added > bestAdded ||
+                            (triangles >= CONE_SEED_TRIANGLES && glm::dot(normals[t], axis) < MIN_GROW_COSINE))
+                            continue;
+                        // distance, stretched for normals turning away from the meshlet's
+                        const float score = glm::length(centroids[t] - center) * (2.0f - glm::dot(normals[t], axis));
+                        if (added < bestAdded || score < bestScore)
+                        {
+                            bestAdded = added;
+                            bestScore = score;
+                            next = t;
+                        }
+                    }
+                }
+            }
+
+            Meshlet meshlet = computeBounds(vertices, ordered, start, ordered.size() - start);
+            meshlet.firstIndex += static_cast<unsigned int>(first);
+            meshlets.push_back(meshlet);
+        }
+        std::copy(ordered.begin(), ordered.end(), indices.begin() + first);
+    }
+
+    // the six frustum planes (xyz the inward normal, w the distance) of a view-projection matrix, in the space that
+    // matrix maps from: pass projection * view * model for object space planes (Gribb & Hartmann)
+    inline void frustumPlanes(const glm::mat4& matrix, glm::vec4 planes[6])
+    {
+        const glm::mat4 m = glm::transpose(matrix);
+        planes[0] = m[3] + m[0]; // left
+        planes[1] = m[3] - m[0]; // right
+        planes[2] = m[3] + m[1]; // bottom
+        planes[3] = m[3] - m[1]; // top
+        planes[4] = m[3] + m[2]; // near
+        planes[5] = m[3] - m[2]; // far
+        for (int i = 0; i < 6; ++i)
+            planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+
+    inline bool outsideFrustum(const Meshlet& meshlet, const glm::vec4 planes[6])
+    {
+        for (int i = 0; i < 6; ++i)
+            if (glm::dot(glm::vec3(planes[i]), meshlet.center) + planes[i].w < -meshlet.radius)
+                return true;
+        return false;
+    }
+
+    // true if every triangle of the meshlet faces away from eye: the direction to the cluster is inside the cone
+    // of directions all its normals turn away from, with the bounding sphere as margin
+    inline bool backfacing(const Meshlet& meshlet, const glm::vec3& eye)
+    {
+        const glm::vec3 toCenter = meshlet.center - eye;
+        return glm::dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius;
+    }
+}
@@ -8,143 +8,417 @@
 #include <assimp/postprocess.h>
 
 #include "mesh.h"
+#include "Material.h"
+#include "TextureCache.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
 #include "Shader.h"
+#include "ThreadPool.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <iomanip>
 #include <map>
 #include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <initializer_list>
 using namespace std;
 
+// the view Model::Draw picks levels of detail and culls meshlets for
+struct DrawView
+{
+    glm::vec3 eye;
+    glm::mat4 viewProjection;
+    // pixels covered by one world unit at distance one: viewport height / (2 tan(fovy / 2))
+    float pixelsPerUnit;
+    // the largest error, in pixels, a level may show on screen; 0 always draws full detail
+    float maxErrorPixels;
+    // drop meshlets outside the frustum or facing away from the eye (for meshes that have them)
+    bool cullMeshlets;
+
+    DrawView(const glm::vec3& eye, const glm::mat4& view, const glm::mat4& projection, float viewportHeight, float maxErrorPixels,
+             bool cullMeshlets = false)
+        : eye(eye), viewProjection(projection * view), pixelsPerUnit(projection[1][1] * viewportHeight * 0.5f), maxErrorPixels(maxErrorPixels),
+          cullMeshlets(cullMeshlets)
+    {
+    }
+};
+
 class Model
 {
 public:
     // model data 
     vector<Mesh>    meshes;
+    // the materials of the model file, indexed by Mesh::materialIndex
+    vector<Material> materials;
     string directory;
     bool gammaCorrection;
+    // how the meshes' vertices are stored on the GPU
+    VertexFormat vertexFormat;
+    // whether the meshes are split into meshlets for culling (Meshlets.h)
+    bool buildMeshlets;
+    // how the materials' textures are bound (the shader has to be compiled for it, Material::shaderDefines)
+    MaterialLayout materialLayout;
 
     // constructor, expects a filepath to a 3D model.
-    Model(string const& path, bool gamma = false) : gammaCorrection(gamma)
+    Model(string const& path, bool gamma = false, VertexFormat format = VertexFormat::Float, bool meshlets = false,
+          MaterialLayout layout = MaterialLayout::Separate)
+        : gammaCorrection(gamma), vertexFormat(format), buildMeshlets(meshlets), materialLayout(layout)
+    {
+        ThreadPool pool;
+        loadModel(path, pool);
+    }
+
+    // constructor that converts the meshes on an existing pool instead of starting one
+    Model(string const& path, ThreadPool& pool, bool gamma = false, VertexFormat format = VertexFormat::Float, bool meshlets = false,
+          MaterialLayout layout = MaterialLayout::Separate)
+        : gammaCorrection(gamma), vertexFormat(format), buildMeshlets(meshlets), materialLayout(layout)
     {
-        loadModel(path);
+        loadModel(path, pool);
     }
 
-    // draws the model, and thus all its meshes
+    // draws the model, and thus all its meshes. They all live in the GeometryArena's vertex array of the model's
+    // vertex format, which is bound once for all of them; a material is bound when it differs from the previous
+    // mesh's. The last material stays bound.
     void Draw(Shader& shader)
     {
+        int boundMaterial = -1;
+        GeometryArena::shared().bind(vertexFormat);
         for (unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+        {
+            if (!meshes[i].uploaded())
+                continue;
+            bindMaterial(shader, meshes[i], boundMaterial);
+            meshes[i].Draw(shader, 0, false);
+        }
+        glBindVertexArray(0);
+    }
+
+    // draws every mesh at the coarsest level of detail whose error, projected at the point of the mesh's bounds
+    // closest to the eye, stays below view.maxErrorPixels, culling its meshlets if view.cullMeshlets is set.
+    // modelMatrix is the one the shader got. Materials are bound as by Draw(shader). Returns the number of triangles
+    // drawn.
+    size_t Draw(Shader& shader, const glm::mat4& modelMatrix, const DrawView& view)
+    {
+        // the culling runs in object space: the eye and the frustum planes are moved there, not every meshlet out
+        glm::vec4 planes[6];
+        glm::vec3 objectEye(0.0f);
+        if (view.cullMeshlets)
+        {
+            Meshlets::frustumPlanes(view.viewProjection * modelMatrix, planes);
+            objectEye = glm::vec3(glm::inverse(modelMatrix) * glm::vec4(view.eye, 1.0f));
+        }
+        // errors scale with the largest axis scale of the model matrix
+        const float scale = std::max(glm::length(glm::vec3(modelMatrix[0])), std::max(glm::length(glm::vec3(modelMatrix[1])),
+                                                                                        glm::length(glm::vec3(modelMatrix[2]))));
+        size_t triangles = 0;
+        int boundMaterial = -1;
+        GeometryArena::shared().bind(vertexFormat);
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            Mesh& mesh = meshes[i];
+            if (!mesh.uploaded())
+                continue;
+            const glm::vec3 center = glm::vec3(modelMatrix * glm::vec4((mesh.boundsMin + mesh.boundsMax) * 0.5f, 1.0f));
+            const float radius = glm::length(mesh.boundsMax - mesh.boundsMin) * 0.5f * scale;
+            const float distance = glm::length(center - view.eye) - radius;
+            // an eye inside the bounding sphere always gets full detail
+            unsigned int lod = 0;
+            if (distance > 0.0f && view.maxErrorPixels > 0.0f && scale > 0.0f)
+                lod = mesh.selectLod(view.maxErrorPixels * distance / (view.pixelsPerUnit * scale));
+            bindMaterial(shader, mesh, boundMaterial);
+            if (view.cullMeshlets)
+                triangles += mesh.DrawCulled(shader, lod, planes, objectEye, false);
+            else
+            {
+                mesh.Draw(shader, lod, false);
+                triangles += mesh.lods[lod].indexCount / 3;
+            }
+        }
+        glBindVertexArray(0);
+        return triangles;
     }
 
 private:
+    // a mesh converted from assimp's representation, ready to be handed to Mesh
+    struct ImportedMesh
+    {
+        vector<Vertex> vertices;
+        vector<unsigned int> indices;
+        glm::vec3 boundsMin = glm::vec3(0.0f);
+        glm::vec3 boundsMax = glm::vec3(0.0f);
+        // post-transform cache statistics before and after MeshOptimizer
+        MeshOptimizer::CacheStats original;
+        MeshOptimizer::CacheStats optimized;
+        // the full detail indices followed by the simplified levels
+        vector<MeshLod> lods;
+        vector<Meshlet> meshlets;
+        unsigned int materialIndex = 0;
+    };
+
+    // binds the material of mesh unless it is the one bound (bound is -1 before the first)
+    void bindMaterial(Shader& shader, const Mesh& mesh, int& bound) const
+    {
+        if (mesh.materialIndex >= materials.size() || static_cast<int>(mesh.materialIndex) == bound)
+            return;
+        materials[mesh.materialIndex].bind(shader);
+        bound = static_cast<int>(mesh.materialIndex);
+    }
+
+    // fetches the materials' textures, decoded on pool while the caller goes on (TextureCache::update uploads
+    // them); textures shared between materials or models are loaded once
+    void loadMaterials(ThreadPool& pool)
+    {
+        TextureCache& cache = TextureCache::shared();
+        const size_t loaded = cache.textureCount(), hits = cache.hitCount();
+        for (Material& material : materials)
+            material.loadTextures(cache, pool, materialLayout);
+        cout << "Model: " << materials.size() << " materials, " << cache.textureCount() - loaded << " textures queued, "
+             << cache.hitCount() - hits << " shared" << endl;
+    }
+
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string const& path)
+    // The result of the import is kept in the mesh cache, so later runs map it instead of importing again.
+    void loadModel(string const& path, ThreadPool& pool)
     {
+        // retrieve the directory path of the filepath
+        const size_t separator = path.find_last_of("/\\");
+        directory = separator == string::npos ? string(".") : path.substr(0, separator);
+
+        // identical vertices have to be joined for the indices to share anything in the vertex cache
+        const unsigned int importFlags = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace |
+                                         aiProcess_JoinIdenticalVertices;
+        MeshCache cache;
+        uint64_t key = MeshCache::computeKey(path, importFlags, vertexFormat, buildMeshlets);
+        if (cache.load(key, meshes, materials))
+        {
+            loadMaterials(pool);
+            return;
+        }
+
         // read file via ASSIMP
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        const aiScene* scene = importer.ReadFile(path, importFlags);
         // check for errors
         if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
             cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
             return;
         }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of("\\"));
+        // the materials, in the scene's order so that the meshes' material indices stay valid. Meshes referencing
+        // none get a default one (white, fully rough).
+        for (unsigned int i = 0; i < scene->mNumMaterials; i++)
+            materials.push_back(processMaterial(scene->mMaterials[i], directory));
+        if (materials.empty())
+            materials.push_back(Material());
+        // process ASSIMP's root node recursively to find the meshes in drawing order
+        vector<const aiMesh*> sceneMeshes;
+        processNode(scene->mRootNode, scene, sceneMeshes);
+
+        // the conversion only reads the scene, so every mesh is converted and optimized on its own worker
+        vector<ImportedMesh> imported(sceneMeshes.size());
+        pool.parallelFor(sceneMeshes.size(), [&](size_t i)
+        {
+            imported[i] = processMesh(sceneMeshes[i]);
+            ImportedMesh& mesh = imported[i];
+            MeshOptimizer::optimize(mesh.vertices, mesh.indices, mesh.original, mesh.optimized);
+            // the levels of detail go behind the full detail indices, into the same index buffer
+            vector<MeshSimplifier::Level> chain = MeshSimplifier::buildChain(mesh.vertices, mesh.indices);
+            mesh.lods.push_back({ 0, static_cast<unsigned int>(mesh.indices.size()), 0.0f, 0, 0 });
+            for (const MeshSimplifier::Level& level : chain)
+            {
+                mesh.lods.push_back({ static_cast<unsigned int>(mesh.indices.size()), static_cast<unsigned int>(level.indices.size()), level.error, 0, 0 });
+                mesh.indices.insert(mesh.indices.end(), level.indices.begin(), level.indices.end());
+            }
+            if (buildMeshlets)
+            {
+                for (MeshLod& lod : mesh.lods)
+                {
+                    lod.firstMeshlet = static_cast<unsigned int>(mesh.meshlets.size());
+                    Meshlets::build(mesh.vertices, mesh.indices, lod.firstIndex, lod.indexCount, mesh.meshlets);
+                    lod.meshletCount = static_cast<unsigned int>(mesh.meshlets.size()) - lod.firstMeshlet;
+                }
+            }
+        });
 
-        // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        // the GL objects are created here, on the GL thread, in one go
+        MeshOptimizer::CacheStats original, optimized;
+        size_t shortIndexMeshes = 0;
+        vector<size_t> lodTriangles;
+        meshes.reserve(meshes.size() + imported.size());
+        for (ImportedMesh& mesh : imported)
+        {
+            original += mesh.original;
+            optimized += mesh.optimized;
+            for (size_t lod = 0; lod < mesh.lods.size(); lod++)
+            {
+                lodTriangles.resize(std::max(lodTriangles.size(), lod + 1), 0);
+                lodTriangles[lod] += mesh.lods[lod].indexCount / 3;
+            }
+            meshes.push_back(Mesh(std::move(mesh.vertices), std::move(mesh.indices), mesh.boundsMin, mesh.boundsMax, vertexFormat,
+                                  std::move(mesh.lods), std::move(mesh.meshlets)));
+            meshes.back().materialIndex = mesh.materialIndex < materials.size() ? mesh.materialIndex : 0;
+            if (meshes.back().indexType == GL_UNSIGNED_SHORT)
+                shortIndexMeshes++;
+        }
+        cout << fixed << setprecision(3) << "Model: optimized " << imported.size() << " meshes of " << path << ", ACMR " << original.acmr()
+             << " -> " << optimized.acmr() << ", ATVR " << original.atvr() << " -> " << optimized.atvr() << ", 16-bit indices in "
+             << shortIndexMeshes << "/" << imported.size() << defaultfloat << endl;
+        cout << "Model: triangles per level of detail";
+        for (size_t triangles : lodTriangles)
+            cout << " " << triangles;
+        cout << endl;
+        loadMaterials(pool);
+        cache.save(key, meshes, materials);
     }
 
-    // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode* node, const aiScene* scene)
+    // processes a node in a recursive fashion. Collects each individual mesh located at the node and repeats this process on its children nodes (if any).
+    void processNode(const aiNode* node, const aiScene* scene, vector<const aiMesh*>& sceneMeshes)
     {
-        // process each mesh located at the current node
+        // collect each mesh located at the current node
         for (unsigned int i = 0; i < node->mNumMeshes; i++)
         {
             // the node object only contains indices to index the actual objects in the scene. 
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            sceneMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
         }
-        // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
+        // after we've collected all of the meshes (if any) we then recursively process each of the children nodes
         for (unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, sceneMeshes);
         }
 
     }
 
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+    // converts one mesh; runs on a worker thread, so it must not touch GL or the model
+    static ImportedMesh processMesh(const aiMesh* mesh)
     {
-        // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
+        // data to fill, sized up front and written in place
+        ImportedMesh result;
+        vector<Vertex>& vertices = result.vertices;
+        vector<unsigned int>& indices = result.indices;
+        vertices.resize(mesh->mNumVertices);
 
         // walk through each of the mesh's vertices
+        const bool hasTexCoords = mesh->mTextureCoords[0] != nullptr; // does the mesh contain texture coordinates?
         for (unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
-            Vertex vertex;
-            glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
+            Vertex& vertex = vertices[i];
             // positions
-            vector.x = mesh->mVertices[i].x;
-            vector.y = mesh->mVertices[i].y;
-            vector.z = mesh->mVertices[i].z;
-            vertex.Position = vector;
+            vertex.Position = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+            result.boundsMin = i == 0 ? vertex.Position : glm::min(result.boundsMin, vertex.Position);
+            result.boundsMax = i == 0 ? vertex.Position : glm::max(result.boundsMax, vertex.Position);
             // normals
             if (mesh->HasNormals())
-            {
-                vector.x = mesh->mNormals[i].x;
-                vector.y = mesh->mNormals[i].y;
-                vector.z = mesh->mNormals[i].z;
-                vertex.Normal = vector;
-            }
+                vertex.Normal = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
+            else
+                vertex.Normal = glm::vec3(0.0f);
             // texture coordinates
-            if (mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
+            if (hasTexCoords)
             {
-                glm::vec2 vec;
                 // a vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't 
                 // use models where a vertex can have multiple texture coordinates so we always take the first set (0).
-                vec.x = mesh->mTextureCoords[0][i].x;
-                vec.y = mesh->mTextureCoords[0][i].y;
-                vertex.TexCoords = vec;
+                vertex.TexCoords = glm::vec2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y);
                 // tangent
-                vector.x = mesh->mTangents[i].x;
-                vector.y = mesh->mTangents[i].y;
-                vector.z = mesh->mTangents[i].z;
-                vertex.Tangent = vector;
+                vertex.Tangent = glm::vec3(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z);
                 // bitangent
-                vector.x = mesh->mBitangents[i].x;
-                vector.y = mesh->mBitangents[i].y;
-                vector.z = mesh->mBitangents[i].z;
-                vertex.Bitangent = vector;
+                vertex.Bitangent = glm::vec3(mesh->mBitangents[i].x, mesh->mBitangents[i].y, mesh->mBitangents[i].z);
             }
             else
+            {
                 vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-
-            vertices.push_back(vertex);
+                vertex.Tangent = glm::vec3(0.0f);
+                vertex.Bitangent = glm::vec3(0.0f);
+            }
         }
-        // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
+        // now walk through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
+        // After aiProcess_Triangulate almost every face has 3 indices (point and line primitives have fewer).
+        indices.reserve(static_cast<size_t>(mesh->mNumFaces) * 3);
         for (unsigned int i = 0; i < mesh->mNumFaces; i++)
         {
-            aiFace face = mesh->mFaces[i];
+            const aiFace& face = mesh->mFaces[i];
             // retrieve all indices of the face and store them in the indices vector
-            for (unsigned int j = 0; j < face.mNumIndices; j++)
-                indices.push_back(face.mIndices[j]);
+            indices.insert(indices.end(), face.mIndices, face.mIndices + face.mNumIndices);
         }
-        // process materials
-        aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
-        // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
-        // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER. 
-        // Same applies to other texture as the following list summarizes:
-        // diffuse: texture_diffuseN
-        // specular: texture_specularN
-        // normal: texture_normalN
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices);
+        // process materials: just the index, the scene's materials are converted once by loadModel
+        result.materialIndex = mesh->mMaterialIndex;
+        return result;
+    }
+
+    // reads a material's factors and texture paths. glTF's metallic-roughness maps and the classic maps of FBX and
+    // OBJ files land in the same slots: for each slot the first texture type the material has wins.
+    static Material processMaterial(const aiMaterial* material, const string& directory)
+    {
+        Material result;
+        auto texture = [&](std::initializer_list<aiTextureType> types) -> string
+        {
+            for (aiTextureType type : types)
+            {
+                aiString path;
+                if (material->GetTextureCount(type) == 0 || material->GetTexture(type, 0, &path) != AI_SUCCESS)
+                    continue;
+                // textures embedded in the model file ("*0") aren't supported, their slot keeps its stand-in
+                if (path.C_Str()[0] == '*')
+                {
+                    cout << "Model: ignoring embedded texture " << path.C_Str() << endl;
+                    return string();
+                }
+                return resolveTexturePath(directory, path.C_Str());
+            }
+            return string();
+        };
+        result.texturePaths[MATERIAL_ALBEDO] = texture({ aiTextureType_BASE_COLOR, aiTextureType_DIFFUSE });
+        // glTF's packed metallic-roughness image is reported as UNKNOWN by older importers
+        // (AI_MATKEY_GLTF_PBRMETALLICROUGHNESS_METALLICROUGHNESS_TEXTURE)
+        result.texturePaths[MATERIAL_METALLIC] = texture({ aiTextureType_METALNESS, aiTextureType_UNKNOWN });
+        result.texturePaths[MATERIAL_ROUGHNESS] = texture({ aiTextureType_DIFFUSE_ROUGHNESS, aiTextureType_UNKNOWN });
+        // OBJ files commonly put their normal map in the bump (height) slot
+        result.texturePaths[MATERIAL_NORMAL] = texture({ aiTextureType_NORMALS, aiTextureType_NORMAL_CAMERA, aiTextureType_HEIGHT });
+        // glTF's occlusion map arrives as LIGHTMAP
+        result.texturePaths[MATERIAL_OCCLUSION] = texture({ aiTextureType_AMBIENT_OCCLUSION, aiTextureType_LIGHTMAP, aiTextureType_AMBIENT });
+        // one image for both is the glTF packing: metallic in B, roughness in G
+        if (!result.texturePaths[MATERIAL_METALLIC].empty() && result.texturePaths[MATERIAL_METALLIC] == result.texturePaths[MATERIAL_ROUGHNESS])
+        {
+            result.metallicChannel = 2;
+            result.roughnessChannel = 1;
+        }
+
+        // the base color factor multiplies the texture (glTF); a classic diffuse color only stands in for a missing one
+        aiColor4D color;
+        if (material->Get(AI_MATKEY_BASE_COLOR, color) == AI_SUCCESS ||
+            (result.texturePaths[MATERIAL_ALBEDO].empty() && material->Get(AI_MATKEY_COLOR_DIFFUSE, color) == AI_SUCCESS))
+            result.baseColorFactor = glm::vec4(color.r, color.g, color.b, color.a);
+        // without a factor, a metallic map is taken as it is and a material without one is a dielectric
+        float factor;
+        if (material->Get(AI_MATKEY_METALLIC_FACTOR, factor) == AI_SUCCESS)
+            result.metallicFactor = factor;
+        else
+            result.metallicFactor = result.texturePaths[MATERIAL_METALLIC].empty() ? 0.0f : 1.0f;
+        if (material->Get(AI_MATKEY_ROUGHNESS_FACTOR, factor) == AI_SUCCESS)
+            result.roughnessFactor = factor;
+        return result;
+    }
+
+    // texture paths are relative to the model file. Exporters also write absolute paths from the artist's machine,
+    // which are looked up as a file name next to the model.
+    static string resolveTexturePath(const string& directory, string path)
+    {
+        std::replace(path.begin(), path.end(), '\\', '/');
+        std::error_code error;
+        const std::filesystem::path relative = std::filesystem::path(directory) / path;
+        if (std::filesystem::exists(relative, error))
+            return relative.generic_string();
+        if (std::filesystem::exists(path, error))
+            return path;
+        const std::filesystem::path sibling = std::filesystem::path(directory) / std::filesystem::path(path).filename();
+        if (std::filesystem::exists(sibling, error))
+            return sibling.generic_string();
+        // reported by the TextureCache when it's loaded
+        return relative.generic_string();
     }
 
 };
@@ -0,0 +1,100 @@
+#pragma once
+#include <glad/glad.h>
+
+#include "Shader.h"
+#include "IBLCache.h"
+#include "IBLConfig.h"
+#include "OctahedralMap.h"
+
+#include <iostream>
+
+// Turns baked IBL cubemaps into octahedral maps (see OctahedralMap.h) on the GPU. Each level of the result is
+// rendered from the matching cubemap level with a full-screen triangle, border texels included, so the
+// seam handling costs nothing at bake time beyond the border itself.
+class OctahedralEncoder
+{
+public:
+    OctahedralEncoder() : shader("Shaders/octahedral_encode.vs", "Shaders/octahedral_encode.fs")
+    {
+        shader.use();
+        shader.setInt("sourceMap", 0);
+        glGenFramebuffers(1, &fbo);
+        // the triangle comes from gl_VertexID, but the core profile still wants a vertex array bound
+        glGenVertexArrays(1, &vao);
+    }
+    ~OctahedralEncoder()
+    {
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteVertexArrays(1, &vao);
+        glDeleteProgram(shader.ID);
+    }
+    OctahedralEncoder(const OctahedralEncoder&) = delete;
+    OctahedralEncoder& operator=(const OctahedralEncoder&) = delete;
+
+    // creates an RGB16F 2D texture with the octahedral version of the first levels of a cubemap
+    unsigned int encode(unsigned int cubemap, int faceSize, int levels, GLint minFilter)
+    {
+        const int size = OctahedralMap::sizeForFace(faceSize);
+        levels = OctahedralMap::levelCount(size, levels);
+
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        for (int level = 0; level < levels; ++level)
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGB16F, size >> level, size >> level, 0, GL_RGB, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        shader.use();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glBindVertexArray(vao);
+        for (int level = 0; level < levels; ++level)
+        {
+            const int levelSize = size >> level;
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, level);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            {
+                std::cout << "ERROR::FRAMEBUFFER:: Octahedral encode framebuffer is not complete!" << std::endl;
+                break;
+            }
+            glViewport(0, 0, levelSize, levelSize);
+            shader.setFloat("sourceLevel", static_cast<float>(level));
+            shader.setInt("levelSize", levelSize);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        glBindVertexArray(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return texture;
+    }
+
+    // replaces the cubemaps of freshly baked maps with their octahedral versions
+    void convert(IBLMaps& maps, const IBLConfig& config)
+    {
+        if (maps.octahedral)
+            return;
+        int environmentLevels = 1;
+        while ((config.environmentSize >> environmentLevels) > 0)
+            ++environmentLevels;
+        replace(maps.envCubemap, encode(maps.envCubemap, config.environmentSize, environmentLevels, GL_LINEAR_MIPMAP_LINEAR));
+        replace(maps.prefilterMap, encode(maps.prefilterMap, config.prefilterSize, config.prefilterMipLevels, GL_LINEAR_MIPMAP_LINEAR));
+        if (maps.irradianceMap)
+            replace(maps.irradianceMap, encode(maps.irradianceMap, config.irradianceSize, 1, GL_LINEAR));
+        maps.octahedral = true;
+    }
+
+private:
+    Shader shader;
+    unsigned int fbo = 0;
+    unsigned int vao = 0;
+
+    static void replace(unsigned int& texture, unsigned int replacement)
+    {
+        glDeleteTextures(1, &texture);
+        texture = replacement;
+    }
+};
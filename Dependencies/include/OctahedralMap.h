@@ -0,0 +1,79 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <algorithm>
+
+// Octahedral environment maps: the sphere folded onto an octahedron and unfolded into a square 2D texture, used
+// instead of cubemaps when IBLConfig::octahedral is set. One 2D texture (with an ordinary mip chain) per IBL
+// product streams and atlases like any other texture and takes 2/3 of the texels of the cubemap it replaces.
+//
+// Seams: the outer edges of the square are mirrored copies of each other, so plain bilinear filtering would blend
+// texels from opposite sides of the sphere there. Every mip level therefore carries a one-texel border holding the
+// wrapped neighbours, and lookups map into the interior of the level they sample (levelCoordinates()). The shader
+// side (2.2.2.pbr.fs, 2.2.2.background.fs, octahedral_encode.fs) follows the same functions.
+namespace OctahedralMap
+{
+    // smallest level still stored; below it the border would be most of the texture
+    const int MIN_LEVEL_SIZE = 8;
+
+    // the octahedral level replacing a cubemap level of the given face size
+    inline int sizeForFace(int faceSize)
+    {
+        return 2 * faceSize;
+    }
+
+    // how many of the requested levels of a texture of the given size are large enough to be stored
+    inline int levelCount(int size, int requestedLevels)
+    {
+        int levels = 0;
+        while (levels < requestedLevels && (size >> levels) >= MIN_LEVEL_SIZE)
+            ++levels;
+        return std::max(levels, 1);
+    }
+
+    // direction -> coordinates in [0, 1]^2 of the unfolded octahedron (+Z in the centre, -Z in the corners)
+    inline glm::vec2 encode(glm::vec3 n)
+    {
+        n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+        glm::vec2 p(n.x, n.y);
+        if (n.z < 0.0f)
+            p = glm::vec2((1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f), (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+        return p * 0.5f + 0.5f;
+    }
+
+    // coordinates in [0, 1]^2 -> unit direction, the inverse of encode()
+    inline glm::vec3 decode(glm::vec2 uv)
+    {
+        glm::vec2 f = uv * 2.0f - 1.0f;
+        glm::vec3 n(f.x, f.y, 1.0f - std::abs(f.x) - std::abs(f.y));
+        float t = std::max(-n.z, 0.0f);
+        n.x += n.x >= 0.0f ? -t : t;
+        n.y += n.y >= 0.0f ? -t : t;
+        return glm::normalize(n);
+    }
+
+    // folds coordinates that ran over an edge back onto the square: the octahedron continues mirrored across
+    // each edge, so (1 + e, v) is the same direction as (1 - e, 1 - v)
+    inline glm::vec2 wrap(glm::vec2 uv)
+    {
+        if (uv.x < 0.0f) uv = glm::vec2(-uv.x, 1.0f - uv.y);
+        if (uv.x > 1.0f) uv = glm::vec2(2.0f - uv.x, 1.0f - uv.y);
+        if (uv.y < 0.0f) uv = glm::vec2(1.0f - uv.x, -uv.y);
+        if (uv.y > 1.0f) uv = glm::vec2(1.0f - uv.x, 2.0f - uv.y);
+        return uv;
+    }
+
+    // direction stored at texel (x, y) of a level of the given size, border texels included
+    inline glm::vec3 texelDirection(int x, int y, int levelSize)
+    {
+        const float interior = float(levelSize - 2);
+        return decode(wrap(glm::vec2((x + 0.5f - 1.0f) / interior, (y + 0.5f - 1.0f) / interior)));
+    }
+
+    // texture coordinates of encode()d coordinates inside the interior of a level
+    inline glm::vec2 levelCoordinates(glm::vec2 uv, int levelSize)
+    {
+        return (uv * float(levelSize - 2) + 1.0f) / float(levelSize);
+    }
+}
@@ -0,0 +1,365 @@
+#pragma once
+#include "MappedFile.h"
+#include "HalfFloat.h"
+#include "ThreadPool.h"
+
+// x86 builds convert floats to halves with SIMD whatever the compiler's target: F16C (every AVX2 CPU) where CPUID
+// reports it at runtime, SSE2 (every x64 CPU) otherwise. The projects don't set /arch:AVX2, so the F16C path is
+// compiled for that instruction set alone and only called after the check.
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#define EVC_HDR_SIMD 1
+#define EVC_HDR_F16C_TARGET
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define EVC_HDR_SIMD 1
+#define EVC_HDR_F16C_TARGET __attribute__((target("f16c")))
+#endif
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <algorithm>
+
+// Radiance .hdr (RGBE) decoder for large environment maps, a replacement for stbi_loadf.
+// open() maps the file and walks the scanlines once to find where each one starts: new-style RLE scanlines
+// have a variable length, so that walk has to be sequential, but it only reads the run headers. decode() then
+// expands the scanlines in parallel chunks and writes RGB half floats (ready for a GL_HALF_FLOAT upload) or
+// floats, so there is never a float32 copy of the whole image in between.
+// Orientation and values match stbi_loadf: rows come out top-down unless flipped, and a texel is
+// mantissa * 2^(exponent - 136) without rounding offset.
+class RadianceHDR
+{
+public:
+    bool open(const std::string& path)
+    {
+        scanlines.clear();
+        imageWidth = imageHeight = 0;
+        if (!file.open(path))
+        {
+            std::cout << "ERROR::HDR::FILE_NOT_FOUND: " << path << std::endl;
+            return false;
+        }
+        size_t offset = 0;
+        if (!parseHeader(offset) || !indexScanlines(offset))
+        {
+            std::cout << "ERROR::HDR::UNSUPPORTED_OR_DAMAGED_FILE: " << path << std::endl;
+            file.close();
+            imageWidth = imageHeight = 0;
+            return false;
+        }
+        return true;
+    }
+
+    int width() const { return imageWidth; }
+    int height() const { return imageHeight; }
+    // number of values decode() writes: three per texel
+    size_t valueCount() const { return static_cast<size_t>(imageWidth) * imageHeight * 3; }
+
+    // decodes into valueCount() RGB half floats
+    bool decode(ThreadPool& pool, uint16_t* rgb, bool flipVertically) const
+    {
+        const size_t rowValues = static_cast<size_t>(imageWidth) * 3;
+        return decodeRows(pool, flipVertically, [rgb, rowValues](const float* row, int outputRow)
+        {
+            floatsToHalves(row, rgb + outputRow * rowValues, rowValues);
+        });
+    }
+
+    // decodes into valueCount() RGB floats
+    bool decode(ThreadPool& pool, float* rgb, bool flipVertically) const
+    {
+        const size_t rowValues = static_cast<size_t>(imageWidth) * 3;
+        return decodeRows(pool, flipVertically, [rgb, rowValues](const float* row, int outputRow)
+        {
+            std::memcpy(rgb + outputRow * rowValues, row, rowValues * sizeof(float));
+        });
+    }
+
+    // the largest finite half; brighter texels (the sun) are clamped to it instead of turning into infinity and
+    // spreading through every filtered mip
+    static constexpr float HALF_MAX = 65504.0f;
+
+    static void floatsToHalves(const float* source, uint16_t* destination, size_t count)
+    {
+        size_t i = 0;
+#ifdef EVC_HDR_SIMD
+        static const bool f16c = hasF16C();
+        i = f16c ? floatsToHalvesF16C(source, destination, count) : floatsToHalvesSSE2(source, destination, count);
+#endif
+        for (; i < count; ++i)
+            destination[i] = HalfFloat::fromFloat(std::min(source[i], HALF_MAX));
+    }
+
+private:
+    static const int ROWS_PER_CHUNK = 16;
+
+#ifdef EVC_HDR_SIMD
+    // F16C needs the AVX state enabled by the OS as well (its instructions are VEX encoded)
+    static bool hasF16C()
+    {
+        unsigned int ecx = 0;
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+        ecx = static_cast<unsigned int>(info[2]);
+#else
+        unsigned int eax, ebx, edx;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+            return false;
+#endif
+        const unsigned int osxsave = 1u << 27, avx = 1u << 28, f16c = 1u << 29;
+        if ((ecx & (osxsave | avx | f16c)) != (osxsave | avx | f16c))
+            return false;
+#ifdef _MSC_VER
+        const unsigned long long xcr0 = _xgetbv(0);
+#else
+        unsigned int xcr0Low, xcr0High;
+        __asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+        const unsigned long long xcr0 = xcr0Low;
+#endif
+        return (xcr0 & 6) == 6; // XMM and YMM state
+    }
+
+    // converts the leading multiple of 8 values, returns how many
+    EVC_HDR_F16C_TARGET static size_t floatsToHalvesF16C(const float* source, uint16_t* destination, size_t count)
+    {
+        const __m128 limit = _mm_set1_ps(HALF_MAX);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128 low = _mm_min_ps(_mm_loadu_ps(source + i), limit);
+            __m128 high = _mm_min_ps(_mm_loadu_ps(source + i + 4), limit);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(destination + i), _mm_cvtps_ph(low, _MM_FROUND_TO_NEAREST_INT));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(destination + i + 4), _mm_cvtps_ph(high, _MM_FROUND_TO_NEAREST_INT));
+        }
+        return i;
+    }
+
+    // HalfFloat::fromFloat four lanes at a time, bit for bit: the same overflow, denormal and round-to-nearest-even
+    // cases, selected with masks. Converts the leading multiple of 8 values, returns how many.
+    static size_t floatsToHalvesSSE2(const float* source, uint16_t* destination, size_t count)
+    {
+        const __m128 limit = _mm_set1_ps(HALF_MAX);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i low = halvesSSE2(_mm_min_ps(_mm_loadu_ps(source + i), limit));
+            __m128i high = halvesSSE2(_mm_min_ps(_mm_loadu_ps(source + i + 4), limit));
+            // SSE2 only packs with signed saturation: sign extend the 16 bit results so they pass unchanged
+            low = _mm_srai_epi32(_mm_slli_epi32(low, 16), 16);
+            high = _mm_srai_epi32(_mm_slli_epi32(high, 16), 16);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm_packs_epi32(low, high));
+        }
+        return i;
+    }
+
+    // four halves in the low 16 bits of each lane
+    static __m128i halvesSSE2(__m128 value)
+    {
+        const __m128i signMask = _mm_set1_epi32(static_cast<int>(0x80000000u));
+        const __m128i overflow = _mm_set1_epi32((127 + 16) << 23);
+        const __m128i minNormal = _mm_set1_epi32(113 << 23);
+        const __m128i denormalMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+        const __m128i normalBias = _mm_set1_epi32(static_cast<int>((static_cast<uint32_t>(15 - 127) << 23) + 0xFFFu));
+
+        const __m128i bits = _mm_castps_si128(value);
+        const __m128i sign = _mm_and_si128(bits, signMask);
+        const __m128i magnitude = _mm_xor_si128(bits, sign); // below 2^31, so the signed compares below hold
+        const __m128 magnitudeFloat = _mm_castsi128_ps(magnitude);
+
+        const __m128i isNan = _mm_castps_si128(_mm_cmpunord_ps(magnitudeFloat, magnitudeFloat));
+        const __m128i inRange = _mm_cmpgt_epi32(overflow, magnitude);
+        const __m128i isDenormal = _mm_cmpgt_epi32(minNormal, magnitude);
+
+        const __m128i infOrNan = _mm_or_si128(_mm_set1_epi32(0x7C00), _mm_and_si128(isNan, _mm_set1_epi32(0x200)));
+        const __m128i denormal =
+            _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(magnitudeFloat, _mm_castsi128_ps(denormalMagic))), denormalMagic);
+        const __m128i mantissaOdd = _mm_srai_epi32(_mm_slli_epi32(magnitude, 31 - 13), 31); // -1 where odd
+        const __m128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(magnitude, normalBias), mantissaOdd), 13);
+
+        const __m128i finite = _mm_or_si128(_mm_and_si128(isDenormal, denormal), _mm_andnot_si128(isDenormal, normal));
+        const __m128i half = _mm_or_si128(_mm_and_si128(inRange, finite), _mm_andnot_si128(inRange, infOrNan));
+        return _mm_or_si128(half, _mm_srli_epi32(sign, 16));
+    }
+#endif
+
+    MappedFile file;
+    int imageWidth = 0;
+    int imageHeight = 0;
+    std::vector<size_t> scanlines; // offset of every scanline in the file, in file order (top row first)
+
+    // reads one header line starting at offset, without its newline
+    bool readLine(size_t& offset, std::string& line) const
+    {
+        const uint8_t* bytes = file.data();
+        const size_t end = file.size();
+        line.clear();
+        while (offset < end && bytes[offset] != '\n')
+            line += static_cast<char>(bytes[offset++]);
+        if (offset >= end)
+            return false;
+        ++offset;
+        return true;
+    }
+
+    bool parseHeader(size_t& offset)
+    {
+        std::string line;
+        if (!readLine(offset, line) || (line != "#?RADIANCE" && line != "#?RGBE"))
+            return false;
+        bool rgbe = false;
+        for (;;)
+        {
+            if (!readLine(offset, line))
+                return false;
+            if (line.empty())
+                break;
+            if (line == "FORMAT=32-bit_rle_rgbe")
+                rgbe = true;
+        }
+        if (!rgbe || !readLine(offset, line))
+            return false;
+        // only the standard orientation, like stb_image
+        int height = 0, width = 0;
+        if (std::sscanf(line.c_str(), "-Y %d +X %d", &height, &width) != 2 || width <= 0 || height <= 0 || width > (1 << 16) ||
+            height > (1 << 16))
+            return false;
+        imageWidth = width;
+        imageHeight = height;
+        return true;
+    }
+
+    bool isRLEScanline(size_t offset) const
+    {
+        const uint8_t* p = file.data() + offset;
+        return imageWidth >= 8 && imageWidth < 32768 && offset + 4 <= file.size() && p[0] == 2 && p[1] == 2 && !(p[2] & 0x80) &&
+               ((p[2] << 8) | p[3]) == imageWidth;
+    }
+
+    // finds the start of every scanline, validating the run structure on the way so decode() can trust it
+    bool indexScanlines(size_t offset)
+    {
+        const uint8_t* bytes = file.data();
+        const size_t end = file.size();
+        scanlines.resize(imageHeight);
+        for (int y = 0; y < imageHeight; ++y)
+        {
+            scanlines[y] = offset;
+            if (!isRLEScanline(offset))
+            {
+                // flat scanline: 4 bytes per texel
+                offset += static_cast<size_t>(imageWidth) * 4;
+                if (offset > end)
+                    return false;
+                continue;
+            }
+            offset += 4;
+            for (int channel = 0; channel < 4; ++channel)
+            {
+                int x = 0;
+                while (x < imageWidth)
+                {
+                    if (offset >= end)
+                        return false;
+                    int count = bytes[offset++];
+                    if (count > 128)
+                    {
+                        count -= 128;
+                        offset += 1;
+                    }
+                    else
+                    {
+                        offset += count;
+                    }
+                    if (count == 0 || x + count > imageWidth || offset > end)
+                        return false;
+                    x += count;
+                }
+            }
+        }
+        return true;
+    }
+
+    // expands scanline y into width RGBE texels
+    void readScanline(int y, uint8_t* rgbe) const
+    {
+        const uint8_t* p = file.data() + scanlines[y];
+        if (!isRLEScanline(scanlines[y]))
+        {
+            std::memcpy(rgbe, p, static_cast<size_t>(imageWidth) * 4);
+            return;
+        }
+        p += 4;
+        // every channel is run-length encoded separately
+        for (int channel = 0; channel < 4; ++channel)
+        {
+            int x = 0;
+            while (x < imageWidth)
+            {
+                int count = *p++;
+                if (count > 128)
+                {
+                    count -= 128;
+                    const uint8_t value = *p++;
+                    for (int i = 0; i < count; ++i)
+                        rgbe[(x + i) * 4 + channel] = value;
+                }
+                else
+                {
+                    for (int i = 0; i < count; ++i)
+                        rgbe[(x + i) * 4 + channel] = *p++;
+                }
+                x += count;
+            }
+        }
+    }
+
+    static void rgbeToFloat(const uint8_t* rgbe, float* rgb, int count)
+    {
+        // 2^(exponent - 136) for every exponent byte, 0 meaning black
+        static const std::vector<float> scales = []()
+        {
+            std::vector<float> table(256, 0.0f);
+            for (int exponent = 1; exponent < 256; ++exponent)
+                table[exponent] = std::ldexp(1.0f, exponent - (128 + 8));
+            return table;
+        }();
+        for (int i = 0; i < count; ++i)
+        {
+            const uint8_t* texel = rgbe + i * 4;
+            const float scale = scales[texel[3]];
+            rgb[i * 3 + 0] = texel[0] * scale;
+            rgb[i * 3 + 1] = texel[1] * scale;
+            rgb[i * 3 + 2] = texel[2] * scale;
+        }
+    }
+
+    template <typename Store>
+    bool decodeRows(ThreadPool& pool, bool flipVertically, Store store) const
+    {
+        if (!file.isOpen())
+            return false;
+        const int chunkCount = (imageHeight + ROWS_PER_CHUNK - 1) / ROWS_PER_CHUNK;
+        pool.parallelFor(static_cast<size_t>(chunkCount), [&](size_t chunk)
+        {
+            std::vector<uint8_t> rgbe(static_cast<size_t>(imageWidth) * 4);
+            std::vector<float> rgb(static_cast<size_t>(imageWidth) * 3);
+            const int firstRow = static_cast<int>(chunk) * ROWS_PER_CHUNK;
+            const int lastRow = std::min(imageHeight, firstRow + ROWS_PER_CHUNK);
+            for (int y = firstRow; y < lastRow; ++y)
+            {
+                readScanline(y, rgbe.data());
+                rgbeToFloat(rgbe.data(), rgb.data(), imageWidth);
+                store(rgb.data(), flipVertically ? imageHeight - 1 - y : y);
+            }
+        });
+        return true;
+    }
+};
@@ -0,0 +1,355 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "CubemapCapture.h"
+#include "GLExtensions.h"
+#include "IBLConfig.h"
+#include "IBLSampling.h"
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <iostream>
+#include <algorithm>
+
+// Local reflection probes: cubemaps of the scene itself (not just the distant HDR) rendered from placed positions,
+// pre-filtered with the same roughness mip scheme as the environment's pre-filter map. A draw selects the probes
+// nearest to it (select()) and 2.2.2.pbr.fs blends their reflections over the environment with box projection.
+//
+// Storage: with GLExtensions::cubeMapArrays every pre-filtered probe is a slice of one GL_TEXTURE_CUBE_MAP_ARRAY
+// atlas, and positions, boxes and slices live in the ReflectionProbeData uniform block. Both are bound once per pass
+// (bindPass()), so a draw only sets two probe indices and nothing is rebound between objects. Without the
+// extension every probe is its own cubemap and select() binds the selected ones to two samplerCube units.
+//
+// Updates are time-sliced: update() does one face per frame, first rendering the scene into one face of a shared
+// capture cubemap, then pre-filtering one face (all mips) into a spare slice (or cubemap) that is swapped with the
+// probe's once complete, so a probe never shows a half-updated state. A probe takes 12 frames, and the probes are
+// refreshed round-robin for as long as they exist.
+class ReflectionProbes
+{
+public:
+    // renders the scene for a capture; a probe capture wants linear HDR output and no probes of its own
+    typedef std::function<void(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& position)> DrawScene;
+
+    static const int MAX_PROBES = 8;
+    // probes blended per draw
+    static const int MAX_BLENDED = 2;
+    // uniform block binding point of ReflectionProbeData (0 and 1 are the SH irradiance and the pre-filter samples)
+    static const unsigned int DATA_BINDING = 2;
+
+    // #defines for 2.2.2.pbr.fs matching the storage the probes will use
+    static std::string shaderDefines()
+    {
+        return "#define MAX_REFLECTION_PROBES " + std::to_string(MAX_PROBES) + "\n" +
+               (GLExtensions::cubeMapArrays ? "#define REFLECTION_PROBE_ATLAS\n" : "");
+    }
+
+    ReflectionProbes(const IBLConfig& config, std::function<void()> drawCube, DrawScene drawScene)
+        : atlas(GLExtensions::cubeMapArrays), size(config.prefilterSize), mipLevels(config.prefilterMipLevels), drawCube(drawCube),
+          drawScene(drawScene),
+          prefilterShader("Shaders/2.2.2.cubemap.vs", "Shaders/prefilter.fs", CubemapCapture::GEOMETRY_SHADER, config.shaderDefines())
+    {
+        CubemapCapture::prepare(prefilterShader);
+        prefilterShader.setInt("environmentMap", 0);
+        glUniformBlockBinding(prefilterShader.ID, glGetUniformBlockIndex(prefilterShader.ID, "PrefilterSamples"), SAMPLES_BINDING);
+
+        // the sample sets never change, so every mip gets its own uniform buffer up front
+        sampleUbos.resize(mipLevels);
+        sampleCounts.resize(mipLevels);
+        glGenBuffers(static_cast<GLsizei>(mipLevels), sampleUbos.data());
+        for (unsigned int mip = 0; mip < mipLevels; ++mip)
+        {
+            const float roughness = mipLevels > 1 ? float(mip) / float(mipLevels - 1) : 0.0f;
+            std::vector<glm::vec4> samples = IBLSampling::prefilterSamples(roughness, IBLSampling::prefilterSampleCount(mip, config.sampleCount), size);
+            sampleCounts[mip] = static_cast<int>(samples.size());
+            glBindBuffer(GL_UNIFORM_BUFFER, sampleUbos[mip]);
+            glBufferData(GL_UNIFORM_BUFFER, samples.size() * sizeof(glm::vec4), samples.data(), GL_STATIC_DRAW);
+        }
+        glGenBuffers(1, &dataUbo);
+        glBindBuffer(GL_UNIFORM_BUFFER, dataUbo);
+        glBufferData(GL_UNIFORM_BUFFER, MAX_PROBES * sizeof(ProbeData), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        // the block is active in the PBR shader even while no probe is selected, so it always needs a buffer
+        glBindBufferBase(GL_UNIFORM_BUFFER, DATA_BINDING, dataUbo);
+
+        captureMap = createCubemap(true);
+        // one slice per probe plus the spare one updates pre-filter into
+        if (atlas)
+            atlasMap = createAtlas(MAX_PROBES + 1);
+        else
+            spareMap = createPrefilterMap();
+        spareSlice = MAX_PROBES;
+
+        glGenFramebuffers(1, &sceneFbo);
+        glGenRenderbuffers(1, &sceneDepth);
+        glBindRenderbuffer(GL_RENDERBUFFER, sceneDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, sceneDepth);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    ~ReflectionProbes()
+    {
+        release();
+    }
+    ReflectionProbes(const ReflectionProbes&) = delete;
+    ReflectionProbes& operator=(const ReflectionProbes&) = delete;
+
+    // frees all GL objects. Call it before the context goes away; the destructor only does it if it hasn't happened yet.
+    void release()
+    {
+        if (!sceneFbo)
+            return;
+        for (Probe& probe : probes)
+            glDeleteTextures(1, &probe.prefilterMap); // 0 with the atlas, which glDeleteTextures ignores
+        probes.clear();
+        glDeleteTextures(1, &captureMap);
+        glDeleteTextures(1, &spareMap);
+        glDeleteTextures(1, &atlasMap);
+        glDeleteFramebuffers(1, &sceneFbo);
+        glDeleteRenderbuffers(1, &sceneDepth);
+        glDeleteBuffers(static_cast<GLsizei>(sampleUbos.size()), sampleUbos.data());
+        glDeleteBuffers(1, &dataUbo);
+        glDeleteProgram(prefilterShader.ID);
+        sceneFbo = 0;
+    }
+
+    // places a probe at position. The box is both the region it lights and the proxy geometry its reflections
+    // are projected onto, so it should match the surroundings (a room's walls). Returns false when full.
+    bool add(const glm::vec3& position, const glm::vec3& boxMin, const glm::vec3& boxMax)
+    {
+        if (probes.size() >= MAX_PROBES)
+        {
+            std::cout << "ERROR::REFLECTION_PROBES:: No more than " << MAX_PROBES << " probes" << std::endl;
+            return false;
+        }
+        Probe probe;
+        probe.position = position;
+        probe.boxMin = glm::min(boxMin, boxMax);
+        probe.boxMax = glm::max(boxMin, boxMax);
+        // the swaps in update() only trade slices between a probe and the spare, so with n probes the slices in
+        // use are always 0 .. n - 1 plus the spare's, and slice n is free
+        probe.slice = static_cast<int>(probes.size());
+        if (!atlas)
+            probe.prefilterMap = createPrefilterMap();
+        probes.push_back(probe);
+        uploadData(probes.size() - 1);
+        // a new probe goes to the front of the queue rather than waiting for a whole round
+        if (probes.size() > 1 && step == 0)
+            updating = probes.size() - 1;
+        return true;
+    }
+
+    size_t count() const { return probes.size(); }
+
+    // advances the probe update by one face. Call it once per frame, outside of the main pass; it leaves the
+    // default framebuffer bound and restores the viewport.
+    void update()
+    {
+        if (probes.empty())
+            return;
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+
+        Probe& probe = probes[updating];
+        if (step < 6)
+            captureFace(probe, step);
+        else
+            prefilterFace(step - 6);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+        if (++step < 12)
+            return;
+        std::swap(probe.prefilterMap, spareMap);
+        std::swap(probe.slice, spareSlice);
+        probe.ready = true;
+        uploadData(updating);
+        step = 0;
+        updating = (updating + 1) % probes.size();
+    }
+
+    // binds what every draw of a pass shares: the probe data block and, with the atlas, the atlas itself on
+    // texture unit firstUnit. The shader's ReflectionProbeData block has to be bound to DATA_BINDING.
+    void bindPass(int firstUnit) const
+    {
+        glBindBufferBase(GL_UNIFORM_BUFFER, DATA_BINDING, dataUbo);
+        if (atlas)
+        {
+            glActiveTexture(GL_TEXTURE0 + firstUnit);
+            glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, atlasMap);
+        }
+    }
+
+    // selects the (up to MAX_BLENDED) probes nearest to position for the next draw, nearest first, and sets the
+    // reflectionProbeIndices uniforms of shader, which has to be in use. Only without the atlas are textures bound
+    // (the selected probes' cubemaps on texture units firstUnit onwards).
+    void select(const Shader& shader, const glm::vec3& position, int firstUnit) const
+    {
+        std::vector<std::pair<float, int>> candidates;
+        for (size_t i = 0; i < probes.size(); ++i)
+        {
+            const Probe& probe = probes[i];
+            if (!probe.ready)
+                continue;
+            // distance to the box (0 inside it), ties broken by the distance to the capture point
+            glm::vec3 outside = glm::max(glm::max(probe.boxMin - position, position - probe.boxMax), glm::vec3(0.0f));
+            float score = glm::length(outside) * 1e3f + glm::length(position - probe.position);
+            candidates.push_back({ score, static_cast<int>(i) });
+        }
+        const size_t blended = std::min<size_t>(candidates.size(), MAX_BLENDED);
+        std::partial_sort(candidates.begin(), candidates.begin() + blended, candidates.end());
+
+        int indices[MAX_BLENDED] = {};
+        for (size_t i = 0; i < blended; ++i)
+        {
+            indices[i] = candidates[i].second;
+            if (!atlas)
+            {
+                glActiveTexture(GL_TEXTURE0 + firstUnit + static_cast<int>(i));
+                glBindTexture(GL_TEXTURE_CUBE_MAP, probes[indices[i]].prefilterMap);
+            }
+        }
+        shader.setInt("reflectionProbeCount", static_cast<int>(blended));
+        glUniform1iv(glGetUniformLocation(shader.ID, "reflectionProbeIndices"), MAX_BLENDED, indices);
+    }
+
+private:
+    static const unsigned int SAMPLES_BINDING = 1;
+    static constexpr float NEAR_PLANE = 0.1f;
+    static constexpr float FAR_PLANE = 100.0f;
+
+    struct Probe
+    {
+        glm::vec3 position;
+        glm::vec3 boxMin;
+        glm::vec3 boxMax;
+        int slice = 0;                 // atlas slice
+        unsigned int prefilterMap = 0; // own cubemap, without the atlas
+        bool ready = false;            // has been through one complete update
+    };
+
+    // std140 layout of one ReflectionProbe in the ReflectionProbeData block
+    struct ProbeData
+    {
+        glm::vec4 position; // w: atlas slice
+        glm::vec4 boxMin;
+        glm::vec4 boxMax;
+    };
+
+    bool atlas;
+    unsigned int size;
+    unsigned int mipLevels;
+    std::function<void()> drawCube;
+    DrawScene drawScene;
+    Shader prefilterShader;
+    CubemapCapture capture;
+    std::vector<unsigned int> sampleUbos;
+    std::vector<int> sampleCounts;
+    unsigned int dataUbo = 0;
+
+    unsigned int captureMap = 0; // the scene as seen from the probe being updated, with a full mip chain
+    unsigned int atlasMap = 0;   // every probe's pre-filtered cubemap, one slice each plus a spare
+    unsigned int spareMap = 0;   // without the atlas: pre-filter target, swapped with the probe's map when complete
+    int spareSlice = 0;          // with the atlas: the same as a slice
+    unsigned int sceneFbo = 0;
+    unsigned int sceneDepth = 0;
+
+    std::vector<Probe> probes;
+    size_t updating = 0; // probe being updated
+    int step = 0;        // 0-5 capture a face, 6-11 pre-filter a face
+
+    void uploadData(size_t index) const
+    {
+        const Probe& probe = probes[index];
+        ProbeData data = { glm::vec4(probe.position, float(probe.slice)), glm::vec4(probe.boxMin, 0.0f), glm::vec4(probe.boxMax, 0.0f) };
+        glBindBuffer(GL_UNIFORM_BUFFER, dataUbo);
+        glBufferSubData(GL_UNIFORM_BUFFER, index * sizeof(ProbeData), sizeof(ProbeData), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    unsigned int createCubemap(bool mipmapped) const
+    {
+        unsigned int cubemap;
+        glGenTextures(1, &cubemap);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+        for (unsigned int i = 0; i < 6; ++i)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, size, size, 0, GL_RGB, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        if (mipmapped)
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP); // allocates the chain
+        return cubemap;
+    }
+
+    unsigned int createPrefilterMap() const
+    {
+        unsigned int cubemap = createCubemap(true);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, mipLevels - 1);
+        return cubemap;
+    }
+
+    // a cube map array with the pre-filter mip chain; its depth counts layer-faces, six per slice
+    unsigned int createAtlas(int slices) const
+    {
+        unsigned int array;
+        glGenTextures(1, &array);
+        glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, array);
+        for (unsigned int mip = 0; mip < mipLevels; ++mip)
+        {
+            const unsigned int mipSize = std::max(1u, size >> mip);
+            glTexImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, mip, GL_RGB16F, mipSize, mipSize, slices * 6, 0, GL_RGB, GL_FLOAT, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAX_LEVEL, mipLevels - 1);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        return array;
+    }
+
+    // renders the scene into one face of the capture cubemap
+    void captureFace(const Probe& probe, int face)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, captureMap, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "ERROR::FRAMEBUFFER:: Reflection probe capture framebuffer is not complete!" << std::endl;
+            return;
+        }
+        glViewport(0, 0, size, size);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        drawScene(CubemapCapture::faceView(probe.position, face), CubemapCapture::faceProjection(NEAR_PLANE, FAR_PLANE), probe.position);
+    }
+
+    // pre-filters one face of every mip of the spare slice (or cubemap) from the finished capture
+    void prefilterFace(int face)
+    {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, captureMap);
+        // the filtered importance samples read the capture's mips
+        if (face == 0)
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+        prefilterShader.use();
+        prefilterShader.setInt("captureFace", face);
+        prefilterShader.setInt("captureSlice", atlas ? spareSlice : 0);
+        for (unsigned int mip = 0; mip < mipLevels; ++mip)
+        {
+            const int mipSize = std::max(1, int(size) >> mip);
+            glBindBufferBase(GL_UNIFORM_BUFFER, SAMPLES_BINDING, sampleUbos[mip]);
+            prefilterShader.setInt("sampleCount", sampleCounts[mip]);
+            if (capture.begin(atlas ? atlasMap : spareMap, mip, mipSize, false))
+                drawCube();
+        }
+        capture.end();
+    }
+};
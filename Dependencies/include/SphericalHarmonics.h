@@ -0,0 +1,131 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include "ThreadPool.h"
+
+#include <vector>
+#include <cmath>
+
+// Order-2 (9 coefficient) spherical harmonics for diffuse irradiance.
+// project() integrates a cubemap against the SH basis on the thread pool, irradiance() turns those radiance
+// coefficients into irradiance coefficients by convolving with the clamped cosine lobe. The irradiance is scaled
+// by 1/PI to match what the irradiance cubemap stores, so the PBR shader keeps using diffuse = irradiance * albedo.
+namespace SphericalHarmonics
+{
+    const float PI = 3.14159265359f;
+    // largest environment mip worth projecting; 9 coefficients can't resolve more detail than that
+    const int SOURCE_SIZE = 64;
+
+    // real SH basis, bands 0..2 in the usual (l, m) order
+    inline void basis(const glm::vec3& n, float* Y)
+    {
+        Y[0] = 0.282095f;
+        Y[1] = 0.488603f * n.y;
+        Y[2] = 0.488603f * n.z;
+        Y[3] = 0.488603f * n.x;
+        Y[4] = 1.092548f * n.x * n.y;
+        Y[5] = 1.092548f * n.y * n.z;
+        Y[6] = 0.315392f * (3.0f * n.z * n.z - 1.0f);
+        Y[7] = 1.092548f * n.x * n.z;
+        Y[8] = 0.546274f * (n.x * n.x - n.y * n.y);
+    }
+
+    // direction through texel (s, t) of a cubemap face, following the GL cubemap face conventions
+    inline glm::vec3 faceDirection(int face, float s, float t)
+    {
+        float sc = 2.0f * s - 1.0f;
+        float tc = 2.0f * t - 1.0f;
+        switch (face)
+        {
+        case 0: return glm::vec3(1.0f, -tc, -sc);
+        case 1: return glm::vec3(-1.0f, -tc, sc);
+        case 2: return glm::vec3(sc, 1.0f, tc);
+        case 3: return glm::vec3(sc, -1.0f, -tc);
+        case 4: return glm::vec3(sc, -tc, 1.0f);
+        default: return glm::vec3(-sc, -tc, -1.0f);
+        }
+    }
+
+    // projects an RGB float cubemap (faces in GL order, rows tightly packed) onto the SH basis.
+    // Every face row is reduced by its own job; the partial sums are added up afterwards.
+    inline void project(ThreadPool& pool, const float* const faces[6], int size, glm::vec3* coefficients)
+    {
+        struct Partial
+        {
+            glm::vec3 sum[9];
+            float weight;
+        };
+        std::vector<Partial> partials(6 * size);
+
+        pool.parallelFor(6 * size, [&](size_t job)
+        {
+            const int face = static_cast<int>(job / size);
+            const int y = static_cast<int>(job % size);
+            Partial& partial = partials[job];
+            for (int i = 0; i < 9; ++i)
+                partial.sum[i] = glm::vec3(0.0f);
+            partial.weight = 0.0f;
+
+            const float* row = faces[face] + static_cast<size_t>(y) * size * 3;
+            for (int x = 0; x < size; ++x)
+            {
+                glm::vec3 d = faceDirection(face, (x + 0.5f) / size, (y + 0.5f) / size);
+                // solid angle of the texel, up to a constant factor that the normalisation below removes
+                float lengthSquared = glm::dot(d, d);
+                float solidAngle = 1.0f / (lengthSquared * std::sqrt(lengthSquared));
+                float Y[9];
+                basis(d / std::sqrt(lengthSquared), Y);
+
+                glm::vec3 radiance(row[x * 3 + 0], row[x * 3 + 1], row[x * 3 + 2]);
+                for (int i = 0; i < 9; ++i)
+                    partial.sum[i] += radiance * (Y[i] * solidAngle);
+                partial.weight += solidAngle;
+            }
+        });
+
+        float totalWeight = 0.0f;
+        for (int i = 0; i < 9; ++i)
+            coefficients[i] = glm::vec3(0.0f);
+        for (const Partial& partial : partials)
+        {
+            for (int i = 0; i < 9; ++i)
+                coefficients[i] += partial.sum[i];
+            totalWeight += partial.weight;
+        }
+        // the texel solid angles have to add up to the whole sphere
+        const float normalisation = 4.0f * PI / totalWeight;
+        for (int i = 0; i < 9; ++i)
+            coefficients[i] *= normalisation;
+    }
+
+    // radiance SH -> irradiance SH (Ramamoorthi & Hanrahan), divided by PI
+    inline void irradiance(glm::vec3* coefficients)
+    {
+        const float band[3] = { 1.0f, 2.0f / 3.0f, 1.0f / 4.0f };
+        coefficients[0] *= band[0];
+        for (int i = 1; i < 4; ++i)
+            coefficients[i] *= band[1];
+        for (int i = 4; i < 9; ++i)
+            coefficients[i] *= band[2];
+    }
+
+    // evaluates irradiance coefficients in a direction (reference for the shader's irradianceSH())
+    inline glm::vec3 evaluate(const glm::vec3* coefficients, const glm::vec3& n)
+    {
+        float Y[9];
+        basis(n, Y);
+        glm::vec3 result(0.0f);
+        for (int i = 0; i < 9; ++i)
+            result += coefficients[i] * Y[i];
+        return result;
+    }
+
+    // coefficients with the basis constants folded in, laid out as a std140 vec4 array for the IrradianceSH
+    // uniform block in 2.2.2.pbr.fs
+    inline void shaderConstants(const glm::vec3* coefficients, glm::vec4* constants)
+    {
+        const float scale[9] = { 0.282095f, 0.488603f, 0.488603f, 0.488603f, 1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f };
+        for (int i = 0; i < 9; ++i)
+            constants[i] = glm::vec4(coefficients[i] * scale[i], 0.0f);
+    }
+}
@@ -0,0 +1,522 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <stb_image.h>
+
+#include "GLExtensions.h"
+#include "Hash.h"
+#include "KTX2.h"
+#include "TextureCompression.h"
+#include "ThreadPool.h"
+#include "UploadContext.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <future>
+#include <memory>
+#include <functional>
+#include <array>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+// The material textures of every model, loaded once each. A texture is looked up by its normalized path first and,
+// on a miss, by a hash of the file's content, so a texture referenced by several materials, several models or
+// under two names (a copy next to each model) is decoded and uploaded a single time.
+//
+// Decoding is asynchronous: get() reads the file, creates a 1x1 placeholder texture and queues the decode on a
+// ThreadPool; update(), called on the GL thread once per frame, uploads every image that finished and generates its
+// mips. With an UploadContext (setUploadContext) the upload runs on the upload thread and the texture is swapped in
+// when it is published. Images EVCBake --textures compiled (TextureCompression.h) are read from the compiled KTX2
+// file instead: their block-compressed mip chain is uploaded as it is, with no decode and no glGenerateMipmap, and
+// takes a quarter (BC7, BC5) or an eighth (BC4) of the memory. get() hands out a handle, a stable pointer to the
+// texture's current name, so materials render with the placeholder until the image arrives and with the image from
+// then on.
+//
+// Like the GeometryArena the cache lives as long as the application and its textures are never freed one by one;
+// release() deletes them all while the context still exists.
+class TextureCache
+{
+public:
+    // the cache materials load their textures from
+    static TextureCache& shared()
+    {
+        static TextureCache cache;
+        return cache;
+    }
+
+    TextureCache() = default;
+    TextureCache(const TextureCache&) = delete;
+    TextureCache& operator=(const TextureCache&) = delete;
+
+    // uploads go through context from now on (nullptr: on the GL thread again)
+    void setUploadContext(UploadContext* context)
+    {
+        uploads = context;
+    }
+
+    // where compiled textures are looked for, TextureCompression::DIRECTORY by default ("": always decode the
+    // source images)
+    void setCompiledDirectory(const std::string& directory)
+    {
+        compiledDirectory = directory;
+    }
+
+    // the texture handle of an image file, decoded on pool the first time it's asked for. It names a texture of
+    // placeholder (RGBA) until the image is uploaded. Returns nullptr if the file can't be read (a failure is
+    // remembered too, so a missing texture is reported once); an image that fails to decode keeps its placeholder.
+    const unsigned int* get(const std::string& path, ThreadPool& pool, const unsigned char placeholder[4])
+    {
+        const std::string key = normalize(path);
+        auto found = byPath.find(key);
+        if (found != byPath.end())
+        {
+            hits++;
+            return found->second;
+        }
+
+        // the compressed file is small next to the decoded image: reading and hashing it here keeps the
+        // content lookup on this thread, the worker decodes straight from the buffer
+        unsigned int* texture = nullptr;
+        std::shared_ptr<std::vector<unsigned char>> file = std::make_shared<std::vector<unsigned char>>();
+        if (readFile(path, *file))
+        {
+            const uint64_t content = Hasher().update(file->data(), file->size()).digest();
+            const std::string compiled =
+                compiledDirectory.empty() ? std::string() : TextureCompression::compiledPath(compiledDirectory, file->data(), file->size());
+            texture = queue(content, path, placeholder, pool, [file, compiled]()
+            {
+                Image image;
+                if (loadCompiled(compiled, image))
+                    return image;
+                image.pixels.reset(stbi_load_from_memory(file->data(), static_cast<int>(file->size()), &image.width, &image.height,
+                                                         &image.components, 0),
+                                   stbi_image_free);
+                return image;
+            });
+        }
+        else
+            std::cout << "Texture failed to load at path: " << path << std::endl;
+        byPath.emplace(key, texture);
+        return texture;
+    }
+
+    // the handle of an RGB texture whose R, G and B are channel channels[i] of image paths[i], packed on pool the
+    // first time it's asked for (occlusion, roughness and metallic of a material, MaterialLayout::PackedORM). A
+    // channel without an image, or whose image can't be read, is 255; the images are resampled (nearest) to the
+    // largest of them. Returns nullptr if none of the images can be read. The same image in R, G and B channel
+    // order, like a glTF occlusion map sharing the metallic-roughness image, is loaded as it is with get().
+    // A packing EVCBake --textures compiled is loaded from its KTX2 file like get()'s images; one that isn't is
+    // packed here and listed for the compiler (TextureCompression::appendPacking).
+    const unsigned int* getPacked(const std::string paths[3], const int channels[3], ThreadPool& pool, const unsigned char placeholder[4])
+    {
+        if (!paths[0].empty() && paths[0] == paths[1] && paths[0] == paths[2] && channels[0] == 0 && channels[1] == 1 && channels[2] == 2)
+            return get(paths[0], pool, placeholder);
+
+        std::string key = "packed";
+        for (int i = 0; i < 3; ++i)
+            key += "|" + (paths[i].empty() ? std::string() : normalize(paths[i])) + ":" + std::to_string(channels[i]);
+        auto found = byPath.find(key);
+        if (found != byPath.end())
+        {
+            hits++;
+            return found->second;
+        }
+
+        // the sources, read here like get()'s (an image used for two channels is read and decoded once), and the
+        // content key of the packed texture
+        std::shared_ptr<std::vector<unsigned char>> sources[3];
+        const std::vector<unsigned char>* sourceData[3] = {};
+        bool any = false;
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < i && !sources[i]; ++j)
+                if (sources[j] && paths[j] == paths[i])
+                    sources[i] = sources[j];
+            if (!sources[i] && !paths[i].empty())
+            {
+                sources[i] = std::make_shared<std::vector<unsigned char>>();
+                if (!readFile(paths[i], *sources[i]))
+                {
+                    std::cout << "Texture failed to load at path: " << paths[i] << std::endl;
+                    sources[i].reset();
+                }
+            }
+            sourceData[i] = sources[i].get();
+            any = any || sources[i];
+        }
+
+        unsigned int* texture = nullptr;
+        if (any)
+        {
+            std::string compiled;
+            if (!compiledDirectory.empty())
+            {
+                compiled = TextureCompression::packedPath(compiledDirectory, sourceData, channels);
+                std::error_code error;
+                if (!std::filesystem::exists(compiled, error))
+                {
+                    TextureCompression::Packing packing;
+                    for (int i = 0; i < 3; ++i)
+                    {
+                        packing.paths[i] = sources[i] ? normalize(paths[i]) : std::string();
+                        packing.channels[i] = channels[i];
+                    }
+                    if (TextureCompression::appendPacking(compiledDirectory, packing))
+                        std::cout << "Texture packing isn't compiled, listed it for EVCBake --textures: " << paths[0] << " + " << paths[1]
+                                  << " + " << paths[2] << std::endl;
+                }
+            }
+            const std::array<int, 3> packedChannels = { channels[0], channels[1], channels[2] };
+            texture = queue(TextureCompression::packedContent(sourceData, channels), paths[0] + " + " + paths[1] + " + " + paths[2], placeholder,
+                            pool, [sources, packedChannels, compiled]()
+                            {
+                                Image image;
+                                if (loadCompiled(compiled, image))
+                                    return image;
+                                return pack(sources, packedChannels.data());
+                            });
+        }
+        byPath.emplace(key, texture);
+        return texture;
+    }
+
+    // uploads the images whose decode finished, or hands them to the upload thread. Returns the number handled.
+    size_t update()
+    {
+        size_t handled = 0;
+        for (size_t i = 0; i < pending.size();)
+        {
+            if (pending[i].image.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            {
+                i++;
+                continue;
+            }
+            std::shared_ptr<Image> image = std::make_shared<Image>(pending[i].image.get());
+            unsigned int* texture = pending[i].texture;
+            if (image->compressedFormat)
+                batchCompressed++;
+            if (!image->pixels && !image->compressedFormat)
+            {
+                std::cout << "Texture failed to load at path: " << pending[i].path << std::endl;
+                finished();
+            }
+            else if (uploads)
+            {
+                std::shared_ptr<unsigned int> created = std::make_shared<unsigned int>(0);
+                uploads->submit([image, created]() { *created = createTexture(*image); },
+                                [this, texture, created]() { swap(texture, *created); });
+            }
+            else
+                swap(texture, createTexture(*image));
+            pending[i] = std::move(pending.back());
+            pending.pop_back();
+            handled++;
+        }
+        return handled;
+    }
+
+    // waits for every queued decode and upload
+    void finish()
+    {
+        for (Pending& job : pending)
+            job.image.wait();
+        update();
+        if (uploads)
+            uploads->finish();
+    }
+
+    // 1x1 stand-ins for textures a material doesn't have: white leaves a factor as it is, the flat normal points
+    // straight out of the surface
+    const unsigned int* white()
+    {
+        static const unsigned char texel[4] = { 255, 255, 255, 255 };
+        if (!whiteTexture)
+            whiteTexture = createSolid(texel);
+        return whiteTexture;
+    }
+
+    const unsigned int* flatNormal()
+    {
+        static const unsigned char texel[4] = { 128, 128, 255, 255 };
+        if (!flatNormalTexture)
+            flatNormalTexture = createSolid(texel);
+        return flatNormalTexture;
+    }
+
+    // distinct textures created, lookups answered without loading anything and textures still being loaded
+    size_t textureCount() const { return textures.size(); }
+    size_t hitCount() const { return hits; }
+    size_t pendingCount() const { return inFlight; }
+
+    // deletes the textures; loads still in flight are finished first
+    void release()
+    {
+        finish();
+        for (unsigned int texture : textures)
+            glDeleteTextures(1, &texture);
+        textures.clear();
+        byPath.clear();
+        byContent.clear();
+        whiteTexture = flatNormalTexture = nullptr;
+        hits = 0;
+        batchTextures = 0;
+        batchCompressed = 0;
+    }
+
+private:
+    struct Image
+    {
+        std::shared_ptr<unsigned char> pixels;
+        int width = 0;
+        int height = 0;
+        int components = 0;
+        // set instead of pixels for a compiled texture: its GL format and compressed levels, level 0 first
+        GLenum compressedFormat = 0;
+        std::vector<std::vector<uint8_t>> levels;
+    };
+
+    // a texture whose image is being decoded
+    struct Pending
+    {
+        unsigned int* texture = nullptr;
+        std::string path;
+        std::future<Image> image;
+    };
+
+    std::unordered_map<std::string, unsigned int*> byPath;
+    std::unordered_map<uint64_t, unsigned int*> byContent;
+    // the current name of every texture, the handles point into it (a deque never moves its elements)
+    std::deque<unsigned int> textures;
+    std::vector<Pending> pending;
+    UploadContext* uploads = nullptr;
+    std::string compiledDirectory = TextureCompression::DIRECTORY;
+    unsigned int* whiteTexture = nullptr;
+    unsigned int* flatNormalTexture = nullptr;
+    size_t hits = 0;
+    // textures still decoding or uploading, the ones finished since there were none (and how many of those were
+    // compiled), and when that was
+    size_t inFlight = 0;
+    size_t batchTextures = 0;
+    size_t batchCompressed = 0;
+    std::chrono::steady_clock::time_point batchStart;
+
+    // the lookup key of a path: two spellings of one file share it
+    static std::string normalize(const std::string& path)
+    {
+        std::error_code error;
+        std::string key = std::filesystem::weakly_canonical(path, error).generic_string();
+        return error ? path : key;
+    }
+
+    // the texture of content (a hash of what it's made of), or a placeholder texture for it whose image load queues
+    // on pool; path names it in the log
+    unsigned int* queue(uint64_t content, const std::string& path, const unsigned char placeholder[4], ThreadPool& pool,
+                        std::function<Image()> load)
+    {
+        auto sameContent = byContent.find(content);
+        if (sameContent != byContent.end())
+        {
+            hits++;
+            return sameContent->second;
+        }
+        unsigned int* texture = createSolid(placeholder);
+        byContent.emplace(content, texture);
+        if (inFlight == 0)
+            batchStart = std::chrono::steady_clock::now();
+        inFlight++;
+        Pending job;
+        job.texture = texture;
+        job.path = path;
+        job.image = pool.submit(std::move(load));
+        pending.push_back(std::move(job));
+        return texture;
+    }
+
+    // reads a compiled texture (KTX2) into image, if the file exists and its format can be sampled
+    static bool loadCompiled(const std::string& compiled, Image& image)
+    {
+        KTX2Texture compressed;
+        if (compiled.empty() || !KTX2::read(compiled, compressed))
+            return false;
+        image.compressedFormat = compressedFormat(compressed.vkFormat);
+        if (!image.compressedFormat)
+            return false;
+        image.width = static_cast<int>(compressed.width);
+        image.height = static_cast<int>(compressed.height);
+        image.levels = std::move(compressed.levels);
+        return true;
+    }
+
+    // decodes the sources of getPacked and packs their channels (TextureCompression::pack, as EVCBake does)
+    static Image pack(const std::shared_ptr<std::vector<unsigned char>> sources[3], const int channels[3])
+    {
+        std::shared_ptr<unsigned char> decoded[3];
+        const uint8_t* rgba[3] = {};
+        int widths[3] = {}, heights[3] = {};
+        for (int i = 0; i < 3; ++i)
+        {
+            if (!sources[i])
+                continue;
+            for (int j = 0; j < i && !decoded[i]; ++j)
+                if (sources[j] == sources[i])
+                {
+                    decoded[i] = decoded[j];
+                    widths[i] = widths[j];
+                    heights[i] = heights[j];
+                }
+            if (!decoded[i])
+            {
+                // as RGBA, so any channel index reads something (a grey image has its value in R, G and B)
+                int components = 0;
+                decoded[i].reset(stbi_load_from_memory(sources[i]->data(), static_cast<int>(sources[i]->size()), &widths[i], &heights[i],
+                                                       &components, 4),
+                                 stbi_image_free);
+            }
+            rgba[i] = decoded[i].get();
+        }
+
+        Image image;
+        std::shared_ptr<std::vector<uint8_t>> packed =
+            std::make_shared<std::vector<uint8_t>>(TextureCompression::pack(rgba, widths, heights, channels, image.width, image.height));
+        if (image.width == 0)
+            return image;
+        image.components = 4;
+        // shares the vector's ownership
+        image.pixels = std::shared_ptr<unsigned char>(packed, packed->data());
+        return image;
+    }
+
+    static bool readFile(const std::string& path, std::vector<unsigned char>& data)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file)
+            return false;
+        data.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        return static_cast<bool>(file);
+    }
+
+    // puts a loaded texture in place of a handle's placeholder
+    void swap(unsigned int* texture, unsigned int loaded)
+    {
+        glDeleteTextures(1, texture);
+        *texture = loaded;
+        finished();
+    }
+
+    void finished()
+    {
+        batchTextures++;
+        if (--inFlight > 0)
+            return;
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - batchStart).count();
+        std::cout << std::fixed << std::setprecision(1) << "Textures: " << batchTextures << " decoded and uploaded (" << batchCompressed
+                  << " precompressed) in " << ms << " ms" << std::defaultfloat << std::endl;
+        batchTextures = 0;
+        batchCompressed = 0;
+    }
+
+    // the GL format of a KTX2 block format, 0 if the context can't sample it (the source image is decoded then)
+    static GLenum compressedFormat(uint32_t vkFormat)
+    {
+        switch (vkFormat)
+        {
+        case KTX2::FORMAT_BC1_RGB_UNORM:
+            return GLExtensions::textureCompressionS3TC ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : 0;
+        case KTX2::FORMAT_BC1_RGBA_UNORM:
+            return GLExtensions::textureCompressionS3TC ? GL_COMPRESSED_RGBA_S3TC_DXT1_EXT : 0;
+        case KTX2::FORMAT_BC3_UNORM:
+            return GLExtensions::textureCompressionS3TC ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : 0;
+        case KTX2::FORMAT_BC4_UNORM:
+            return GL_COMPRESSED_RED_RGTC1;
+        case KTX2::FORMAT_BC5_UNORM:
+            return GL_COMPRESSED_RG_RGTC2;
+        case KTX2::FORMAT_BC7_UNORM:
+            return GLExtensions::textureCompressionBPTC ? GL_COMPRESSED_RGBA_BPTC_UNORM : 0;
+        default:
+            return 0;
+        }
+    }
+
+    // a texture of a decoded image with a full mip chain
+    static unsigned int createTexture(const Image& image)
+    {
+        if (image.compressedFormat)
+            return createCompressedTexture(image);
+        GLenum format = GL_RGBA;
+        if (image.components == 1)
+            format = GL_RED;
+        else if (image.components == 2)
+            format = GL_RG;
+        else if (image.components == 3)
+            format = GL_RGB;
+
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        // rows of 1 and 3 channel images aren't 4 byte aligned unless their width happens to be
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels.get());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+
+    // a texture of a compiled image, its mip chain uploaded as it was compressed
+    static unsigned int createCompressedTexture(const Image& image)
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        for (size_t level = 0; level < image.levels.size(); ++level)
+        {
+            const GLsizei width = std::max(1, image.width >> level), height = std::max(1, image.height >> level);
+            glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(level), image.compressedFormat, width, height, 0,
+                                   static_cast<GLsizei>(image.levels[level].size()), image.levels[level].data());
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(image.levels.size()) - 1);
+        // grey images are stored in R alone; sample them as grey, like the RGB image they came from
+        if (image.compressedFormat == GL_COMPRESSED_RED_RGTC1)
+        {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_RED);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
+        }
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+
+    // a 1x1 texture of one texel, sampled like a loaded image (repeat, linear), and its handle
+    unsigned int* createSolid(const unsigned char texel[4])
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, texel);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        textures.push_back(texture);
+        return &textures.back();
+    }
+};
@@ -0,0 +1,488 @@
+#pragma once
+#include "KTX2.h"
+#include "Hash.h"
+#include "ThreadPool.h"
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <filesystem>
+
+// The offline texture compiler behind EVCBake --textures: a material image becomes a KTX2 file (KTX2.h) holding
+// its whole mip chain block-compressed, which the renderer's TextureCache uploads as it is with
+// glCompressedTexImage2D instead of decoding the source and letting the driver build mips.
+//
+//   BC7 (mode 6, RGBA)  colour images: albedo, emissive, glTF's packed metallic-roughness
+//   BC5 (RG)            normal maps; 2.2.2.pbr.fs rebuilds Z from X and Y
+//   BC4 (R)             images whose channels are all equal (occlusion, single metallic or roughness maps); the
+//                       TextureCache swizzles R into G and B so they still sample as grey
+//
+// Compiled files are named after a hash of the source file's content and VERSION, in DIRECTORY: the renderer
+// finds them from the source image alone, and an edited source or a changed encoder simply misses.
+//
+// Packed occlusion-roughness-metallic textures (MaterialLayout::PackedORM) are compiled to BC7 the same way, named
+// after the hash of their sources and channels. The compiler can't know which images a material packs, so the
+// renderer lists every packing it had to build itself in PACKINGS_FILE, and EVCBake --textures compiles the
+// packings listed there.
+namespace TextureCompression
+{
+    // bump when the output changes
+    const uint32_t VERSION = 1;
+    const char* const DIRECTORY = "Cache/Textures";
+
+    enum class Kind
+    {
+        Color,
+        Normal,
+        Grey
+    };
+
+    // the compiled file of a source image, from the image file's bytes
+    inline std::string compiledPath(const std::string& directory, const void* sourceData, size_t sourceSize)
+    {
+        Hasher hasher;
+        hasher.update(static_cast<uint64_t>(VERSION));
+        hasher.update(sourceData, sourceSize);
+        return directory + "/" + hasher.hex() + ".ktx2";
+    }
+
+    // a texture whose R, G and B are channel channels[i] of image paths[i] (no path: 255)
+    struct Packing
+    {
+        std::string paths[3];
+        int channels[3] = { 0, 0, 0 };
+    };
+
+    const char* const PACKINGS_FILE = "orm-packings.txt";
+
+    // the content key of a packing, from the image files' bytes (null for a channel without an image)
+    inline uint64_t packedContent(const std::vector<unsigned char>* const sources[3], const int channels[3])
+    {
+        Hasher hasher;
+        hasher.update(std::string("packed"));
+        for (int i = 0; i < 3; ++i)
+        {
+            hasher.update(static_cast<uint64_t>(channels[i]));
+            if (sources[i])
+                hasher.update(sources[i]->data(), sources[i]->size());
+            else
+                hasher.update(std::string("<none>"));
+        }
+        return hasher.digest();
+    }
+
+    // the compiled file of a packing
+    inline std::string packedPath(const std::string& directory, const std::vector<unsigned char>* const sources[3], const int channels[3])
+    {
+        Hasher hasher;
+        hasher.update(static_cast<uint64_t>(VERSION));
+        hasher.update(packedContent(sources, channels));
+        return directory + "/" + hasher.hex() + ".ktx2";
+    }
+
+    // packs the channels of decoded RGBA8 images (null: 255) into the RGB of an RGBA8 image as large as the largest
+    // of them, resampling the others (nearest); width and height are 0 if there is no image
+    inline std::vector<uint8_t> pack(const uint8_t* const rgba[3], const int widths[3], const int heights[3], const int channels[3],
+                                     int& width, int& height)
+    {
+        width = height = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            if (rgba[i] && widths[i] * heights[i] > width * height)
+            {
+                width = widths[i];
+                height = heights[i];
+            }
+        }
+        std::vector<uint8_t> result(static_cast<size_t>(width) * height * 4, 255);
+        uint8_t* out = result.data();
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x, out += 4)
+            {
+                for (int i = 0; i < 3; ++i)
+                {
+                    if (!rgba[i])
+                        continue;
+                    const size_t sx = static_cast<size_t>(x) * widths[i] / width, sy = static_cast<size_t>(y) * heights[i] / height;
+                    out[i] = rgba[i][(sy * widths[i] + sx) * 4 + std::min(std::max(channels[i], 0), 3)];
+                }
+            }
+        }
+        return result;
+    }
+
+    // the packings listed in directory's PACKINGS_FILE, one per line: channel and path of R, G and B, tab separated
+    inline std::vector<Packing> readPackings(const std::string& directory)
+    {
+        std::vector<Packing> packings;
+        std::ifstream file(directory + "/" + PACKINGS_FILE);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            Packing packing;
+            size_t start = 0;
+            bool complete = true;
+            for (int field = 0; field < 6 && complete; ++field)
+            {
+                const size_t end = field == 5 ? line.size() : line.find('\t', start);
+                if (end == std::string::npos)
+                {
+                    complete = false;
+                    break;
+                }
+                const std::string value = line.substr(start, end - start);
+                if (field % 2 == 0)
+                    packing.channels[field / 2] = std::atoi(value.c_str());
+                else
+                    packing.paths[field / 2] = value;
+                start = end + 1;
+            }
+            if (complete)
+                packings.push_back(packing);
+        }
+        return packings;
+    }
+
+    // adds a packing to directory's PACKINGS_FILE unless it is listed already
+    inline bool appendPacking(const std::string& directory, const Packing& packing)
+    {
+        for (const Packing& listed : readPackings(directory))
+        {
+            bool same = true;
+            for (int i = 0; i < 3; ++i)
+                same = same && listed.paths[i] == packing.paths[i] && listed.channels[i] == packing.channels[i];
+            if (same)
+                return true;
+        }
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        std::ofstream file(directory + "/" + PACKINGS_FILE, std::ios::app);
+        for (int i = 0; i < 3; ++i)
+            file << packing.channels[i] << '\t' << packing.paths[i] << (i < 2 ? '\t' : '\n');
+        return static_cast<bool>(file);
+    }
+
+    // normal maps are told by their name (glTF and most exporters call them *normal*, *_n), everything else by
+    // its content
+    inline Kind classify(const std::string& fileName, const uint8_t* rgba, size_t pixelCount)
+    {
+        std::string name = fileName;
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        const size_t dot = name.find_last_of('.');
+        const std::string stem = dot == std::string::npos ? name : name.substr(0, dot);
+        if (stem.find("normal") != std::string::npos || (stem.size() > 2 && stem.compare(stem.size() - 2, 2, "_n") == 0))
+            return Kind::Normal;
+        // JPEG noise leaves the channels of grey images a few steps apart
+        for (size_t i = 0; i < pixelCount; ++i)
+        {
+            const uint8_t* p = rgba + i * 4;
+            if (std::abs(p[0] - p[1]) > 4 || std::abs(p[0] - p[2]) > 4 || p[3] != 255)
+                return Kind::Color;
+        }
+        return Kind::Grey;
+    }
+
+    // the next mip level (half size, rounded down, at least 1) of an RGBA8 image, 2x2 box filtered; normals are
+    // averaged as vectors and renormalized
+    inline std::vector<uint8_t> downsample(const std::vector<uint8_t>& rgba, uint32_t width, uint32_t height, Kind kind)
+    {
+        const uint32_t w = std::max(1u, width / 2), h = std::max(1u, height / 2);
+        std::vector<uint8_t> result(static_cast<size_t>(w) * h * 4);
+        for (uint32_t y = 0; y < h; ++y)
+        {
+            for (uint32_t x = 0; x < w; ++x)
+            {
+                glm::vec4 sum(0.0f);
+                for (uint32_t dy = 0; dy < 2; ++dy)
+                    for (uint32_t dx = 0; dx < 2; ++dx)
+                    {
+                        const uint32_t sx = std::min(x * 2 + dx, width - 1), sy = std::min(y * 2 + dy, height - 1);
+                        const uint8_t* p = &rgba[(static_cast<size_t>(sy) * width + sx) * 4];
+                        sum += glm::vec4(p[0], p[1], p[2], p[3]);
+                    }
+                glm::vec4 average = sum * 0.25f;
+                if (kind == Kind::Normal)
+                {
+                    glm::vec3 n = glm::vec3(average) / 127.5f - 1.0f;
+                    const float length = glm::length(n);
+                    n = length > 0.0f ? n / length : glm::vec3(0.0f, 0.0f, 1.0f);
+                    average = glm::vec4((n + 1.0f) * 127.5f, average.w);
+                }
+                uint8_t* out = &result[(static_cast<size_t>(y) * w + x) * 4];
+                for (int c = 0; c < 4; ++c)
+                    out[c] = static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, std::round(average[c]))));
+            }
+        }
+        return result;
+    }
+
+    // one 8 byte BC4 block of 16 values: the two extremes as endpoints, six values between them
+    inline void encodeBC4(const uint8_t values[16], uint8_t out[8])
+    {
+        uint8_t high = values[0], low = values[0];
+        for (int i = 1; i < 16; ++i)
+        {
+            high = std::max(high, values[i]);
+            low = std::min(low, values[i]);
+        }
+        out[0] = high;
+        out[1] = low;
+        uint64_t indices = 0;
+        if (high > low)
+        {
+            // palette order: high, low, then 6/7 high + 1/7 low ... 1/7 high + 6/7 low
+            int palette[8] = { high, low };
+            for (int i = 1; i <= 6; ++i)
+                palette[i + 1] = ((7 - i) * high + i * low + 3) / 7;
+            for (int i = 0; i < 16; ++i)
+            {
+                int best = 0, bestError = 256;
+                for (int k = 0; k < 8; ++k)
+                {
+                    const int error = std::abs(palette[k] - values[i]);
+                    if (error < bestError)
+                    {
+                        bestError = error;
+                        best = k;
+                    }
+                }
+                indices |= static_cast<uint64_t>(best) << (3 * i);
+            }
+        }
+        for (int i = 0; i < 6; ++i)
+            out[2 + i] = static_cast<uint8_t>(indices >> (8 * i));
+    }
+
+    namespace detail
+    {
+        const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+        // the 7 bit endpoint and p-bit closest to an 8 bit RGBA value, for each of the two p-bits
+        inline void quantizeEndpoint(const glm::vec4& value, int pbit, int quantized[4])
+        {
+            for (int c = 0; c < 4; ++c)
+                quantized[c] = std::min(127, std::max(0, static_cast<int>(std::round((value[c] - pbit) * 0.5f))));
+        }
+
+        struct Mode6
+        {
+            int endpoints[2][4]; // 7 bit
+            int pbits[2];
+            int indices[16];
+            float error;
+        };
+
+        // indices and total squared error of the block for fixed endpoints
+        inline void assignIndices(const glm::vec4 pixels[16], Mode6& mode)
+        {
+            glm::vec4 palette[16];
+            glm::vec4 e[2];
+            for (int i = 0; i < 2; ++i)
+                for (int c = 0; c < 4; ++c)
+                    e[i][c] = static_cast<float>((mode.endpoints[i][c] << 1) | mode.pbits[i]);
+            for (int k = 0; k < 16; ++k)
+                for (int c = 0; c < 4; ++c)
+                    palette[k][c] = std::floor((e[0][c] * (64 - BC7_WEIGHTS[k]) + e[1][c] * BC7_WEIGHTS[k] + 32.0f) / 64.0f);
+            mode.error = 0.0f;
+            for (int i = 0; i < 16; ++i)
+            {
+                float bestError = 1e30f;
+                for (int k = 0; k < 16; ++k)
+                {
+                    const glm::vec4 d = palette[k] - pixels[i];
+                    const float error = glm::dot(d, d);
+                    if (error < bestError)
+                    {
+                        bestError = error;
+                        mode.indices[i] = k;
+                    }
+                }
+                mode.error += bestError;
+            }
+        }
+
+        // the best mode 6 encoding with the given 8 bit endpoints, over the four p-bit combinations
+        inline Mode6 fitEndpoints(const glm::vec4 pixels[16], const glm::vec4& a, const glm::vec4& b)
+        {
+            Mode6 best;
+            best.error = 1e30f;
+            for (int p0 = 0; p0 < 2; ++p0)
+                for (int p1 = 0; p1 < 2; ++p1)
+                {
+                    Mode6 mode;
+                    mode.pbits[0] = p0;
+                    mode.pbits[1] = p1;
+                    quantizeEndpoint(a, p0, mode.endpoints[0]);
+                    quantizeEndpoint(b, p1, mode.endpoints[1]);
+                    assignIndices(pixels, mode);
+                    if (mode.error < best.error)
+                        best = mode;
+                }
+            return best;
+        }
+    }
+
+    // one 16 byte BC7 block of 16 RGBA8 pixels, in mode 6 (one subset, 7 bit RGBA endpoints with a p-bit each, 4 bit
+    // indices): endpoints along the principal axis of the colours, refined once by least squares on the indices
+    inline void encodeBC7(const uint8_t rgba[64], uint8_t out[16])
+    {
+        using namespace detail;
+        glm::vec4 pixels[16];
+        glm::vec4 mean(0.0f);
+        for (int i = 0; i < 16; ++i)
+        {
+            pixels[i] = glm::vec4(rgba[i * 4], rgba[i * 4 + 1], rgba[i * 4 + 2], rgba[i * 4 + 3]);
+            mean += pixels[i];
+        }
+        mean /= 16.0f;
+
+        // principal axis by power iteration on the covariance
+        glm::mat4 covariance(0.0f);
+        for (int i = 0; i < 16; ++i)
+        {
+            const glm::vec4 d = pixels[i] - mean;
+            covariance += glm::outerProduct(d, d);
+        }
+        glm::vec4 axis(1.0f, 1.0f, 1.0f, 0.0f);
+        for (int iteration = 0; iteration < 8; ++iteration)
+        {
+            const glm::vec4 next = covariance * axis;
+            const float length = glm::length(next);
+            if (length < 1e-6f)
+                break;
+            axis = next / length;
+        }
+        float low = 0.0f, high = 0.0f;
+        for (int i = 0; i < 16; ++i)
+        {
+            const float t = glm::dot(pixels[i] - mean, axis);
+            low = std::min(low, t);
+            high = std::max(high, t);
+        }
+        const glm::vec4 clampLow(0.0f), clampHigh(255.0f);
+        Mode6 mode = fitEndpoints(pixels, glm::clamp(mean + axis * low, clampLow, clampHigh), glm::clamp(mean + axis * high, clampLow, clampHigh));
+
+        // least squares endpoints for the chosen indices
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        glm::vec4 ax(0.0f), bx(0.0f);
+        for (int i = 0; i < 16; ++i)
+        {
+            const float w = BC7_WEIGHTS[mode.indices[i]] / 64.0f;
+            aa += (1.0f - w) * (1.0f - w);
+            ab += (1.0f - w) * w;
+            bb += w * w;
+            ax += (1.0f - w) * pixels[i];
+            bx += w * pixels[i];
+        }
+        const float determinant = aa * bb - ab * ab;
+        if (std::fabs(determinant) > 1e-6f)
+        {
+            const glm::vec4 a = glm::clamp((ax * bb - bx * ab) / determinant, clampLow, clampHigh);
+            const glm::vec4 b = glm::clamp((bx * aa - ax * ab) / determinant, clampLow, clampHigh);
+            Mode6 refined = fitEndpoints(pixels, a, b);
+            if (refined.error < mode.error)
+                mode = refined;
+        }
+
+        // the first index's top bit is implied 0: swap the endpoints to make it so
+        if (mode.indices[0] >= 8)
+        {
+            for (int c = 0; c < 4; ++c)
+                std::swap(mode.endpoints[0][c], mode.endpoints[1][c]);
+            std::swap(mode.pbits[0], mode.pbits[1]);
+            for (int i = 0; i < 16; ++i)
+                mode.indices[i] = 15 - mode.indices[i];
+        }
+
+        // pack: mode bits (0000001), R0 R1 G0 G1 B0 B1 A0 A1, P0 P1, indices (3 bits for the first, 4 for the rest)
+        std::memset(out, 0, 16);
+        int bit = 0;
+        auto put = [&](uint32_t value, int count)
+        {
+            for (int i = 0; i < count; ++i, ++bit)
+                out[bit >> 3] |= static_cast<uint8_t>(((value >> i) & 1) << (bit & 7));
+        };
+        put(1 << 6, 7);
+        for (int c = 0; c < 4; ++c)
+        {
+            put(mode.endpoints[0][c], 7);
+            put(mode.endpoints[1][c], 7);
+        }
+        put(mode.pbits[0], 1);
+        put(mode.pbits[1], 1);
+        put(mode.indices[0], 3);
+        for (int i = 1; i < 16; ++i)
+            put(mode.indices[i], 4);
+    }
+
+    // compresses one mip level of an RGBA8 image; edge blocks repeat the last row and column
+    inline std::vector<uint8_t> compressLevel(const std::vector<uint8_t>& rgba, uint32_t width, uint32_t height, uint32_t vkFormat, ThreadPool& pool)
+    {
+        const uint32_t blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+        const uint32_t blockBytes = KTX2::blockBytes(vkFormat);
+        std::vector<uint8_t> result(static_cast<size_t>(blocksX) * blocksY * blockBytes);
+        pool.parallelFor(blocksY, [&](size_t by)
+        {
+            for (uint32_t bx = 0; bx < blocksX; ++bx)
+            {
+                uint8_t block[64];
+                for (uint32_t y = 0; y < 4; ++y)
+                    for (uint32_t x = 0; x < 4; ++x)
+                    {
+                        const uint32_t sx = std::min(bx * 4 + x, width - 1), sy = std::min(static_cast<uint32_t>(by) * 4 + y, height - 1);
+                        std::memcpy(&block[(y * 4 + x) * 4], &rgba[(static_cast<size_t>(sy) * width + sx) * 4], 4);
+                    }
+                uint8_t* out = &result[(by * blocksX + bx) * blockBytes];
+                if (vkFormat == KTX2::FORMAT_BC7_UNORM)
+                    encodeBC7(block, out);
+                else
+                {
+                    // BC4 takes R, BC5 R and G
+                    const int channels = vkFormat == KTX2::FORMAT_BC5_UNORM ? 2 : 1;
+                    for (int c = 0; c < channels; ++c)
+                    {
+                        uint8_t values[16];
+                        for (int i = 0; i < 16; ++i)
+                            values[i] = block[i * 4 + c];
+                        encodeBC4(values, out + c * 8);
+                    }
+                }
+            }
+        });
+        return result;
+    }
+
+    // the block format of a kind of image
+    inline uint32_t formatFor(Kind kind)
+    {
+        return kind == Kind::Normal ? KTX2::FORMAT_BC5_UNORM : kind == Kind::Grey ? KTX2::FORMAT_BC4_UNORM : KTX2::FORMAT_BC7_UNORM;
+    }
+
+    // the full, compressed mip chain of an RGBA8 image
+    inline KTX2Texture compile(std::vector<uint8_t> rgba, uint32_t width, uint32_t height, Kind kind, ThreadPool& pool)
+    {
+        KTX2Texture texture;
+        texture.vkFormat = formatFor(kind);
+        texture.width = width;
+        texture.height = height;
+        for (;;)
+        {
+            texture.levels.push_back(compressLevel(rgba, width, height, texture.vkFormat, pool));
+            if (width == 1 && height == 1)
+                break;
+            rgba = downsample(rgba, width, height, kind);
+            width = std::max(1u, width / 2);
+            height = std::max(1u, height / 2);
+        }
+        return texture;
+    }
+}
@@ -0,0 +1,140 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <atomic>
+#include <queue>
+#include <vector>
+#include <algorithm>
+
+// Fixed-size pool of worker threads. Jobs are plain callables; submit() hands back a future for the result,
+// parallelFor() splits an index range over the workers and the calling thread and blocks until it's done.
+class ThreadPool
+{
+public:
+    // a thread count of 0 picks one worker per hardware thread
+    explicit ThreadPool(unsigned int threadCount = 0)
+    {
+        if (threadCount == 0)
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned int i = 0; i < threadCount; ++i)
+            workers.emplace_back([this]() { workerLoop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned int size() const
+    {
+        return static_cast<unsigned int>(workers.size());
+    }
+
+    // queues a job and returns a future for its result
+    template <typename F>
+    auto submit(F job) -> std::future<decltype(job())>
+    {
+        typedef decltype(job()) Result;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::move(job));
+        std::future<Result> result = task->get_future();
+        enqueue([task]() { (*task)(); });
+        return result;
+    }
+
+    // runs body(i) for every i in [0, count). The calling thread takes part in the work, so this may also be
+    // used from inside a job without dead-locking the pool.
+    void parallelFor(size_t count, const std::function<void(size_t)>& body)
+    {
+        if (count == 0)
+            return;
+        if (count == 1 || workers.empty())
+        {
+            for (size_t i = 0; i < count; ++i)
+                body(i);
+            return;
+        }
+
+        // the state is shared with the helper jobs: a helper that only gets scheduled after the range has been
+        // finished must still find valid memory, even though it won't do anything with it.
+        struct Range
+        {
+            std::atomic<size_t> next{ 0 };
+            std::atomic<size_t> done{ 0 };
+            size_t count = 0;
+            std::function<void(size_t)> body;
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+        std::shared_ptr<Range> range = std::make_shared<Range>();
+        range->count = count;
+        range->body = body;
+
+        auto work = [range]()
+        {
+            size_t i;
+            while ((i = range->next++) < range->count)
+            {
+                range->body(i);
+                if (++range->done == range->count)
+                {
+                    std::lock_guard<std::mutex> lock(range->mutex);
+                    range->finished.notify_all();
+                }
+            }
+        };
+
+        size_t helpers = std::min(count - 1, workers.size());
+        for (size_t i = 0; i < helpers; ++i)
+            enqueue(work);
+        work();
+
+        std::unique_lock<std::mutex> lock(range->mutex);
+        range->finished.wait(lock, [&range]() { return range->done == range->count; });
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping = false;
+
+    void enqueue(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push(std::move(job));
+        }
+        condition.notify_one();
+    }
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (stopping && jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop();
+            }
+            job();
+        }
+    }
+};
@@ -0,0 +1,189 @@
+#pragma once
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <iostream>
+
+// A second GL context, shared with the render context, current on a thread of its own: texture and buffer uploads
+// (glTexImage2D, glGenerateMipmap, glBufferSubData) run there instead of stalling the render loop.
+//
+// A job is a pair of callables. work runs on the upload thread with the upload context current, after everything
+// the render thread issued before submitting it (objects it created, buffers it resized); a fence is inserted
+// right after it. publish runs on the render thread, from update(), once that fence has signaled, which is the point
+// where the objects work created or filled may be used for rendering (shared contexts only guarantee to see each
+// other's changes after such a wait, and the objects have to be bound again afterwards, which every draw does).
+// Jobs are published in the order they were submitted.
+//
+// Only textures, buffers and syncs are shared between contexts: vertex arrays and framebuffers have to be created
+// on the render thread.
+class UploadContext
+{
+public:
+    // creates the hidden shared context and starts the upload thread; call it on the main thread (GLFW windows can
+    // only be created there) after glad has been loaded. valid() is false if the context couldn't be created, or
+    // if renderWindow is null (uploads stay on the render thread).
+    explicit UploadContext(GLFWwindow* renderWindow)
+    {
+        if (!renderWindow)
+            return;
+        // the same kind of context as the render window's (main.cpp), contexts can only be shared between those
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        window = glfwCreateWindow(1, 1, "upload", nullptr, renderWindow);
+        glfwDefaultWindowHints();
+        if (!window)
+        {
+            std::cout << "ERROR::UPLOAD_CONTEXT:: failed to create the shared context, uploading on the render thread" << std::endl;
+            return;
+        }
+        worker = std::thread([this]() { workerLoop(); });
+    }
+
+    ~UploadContext()
+    {
+        release();
+    }
+
+    UploadContext(const UploadContext&) = delete;
+    UploadContext& operator=(const UploadContext&) = delete;
+
+    bool valid() const { return window != nullptr; }
+
+    // queues work for the upload thread; publish runs on the render thread once the GPU is done with it. Call it
+    // on the render thread.
+    void submit(std::function<void()> work, std::function<void()> publish)
+    {
+        // the upload context waits for this fence before running work
+        GLsync ready = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back({ std::move(work), std::move(publish), ready, nullptr });
+        }
+        condition.notify_one();
+    }
+
+    // publishes the jobs whose fences have signaled, without waiting for the others. Call it once per frame on the
+    // render thread. Returns the number published.
+    size_t update()
+    {
+        return publish(false);
+    }
+
+    // blocks until every submitted job has run and is published; for the render thread, before it touches
+    // something an upload may still be writing to
+    void finish()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            idle.wait(lock, [this]() { return jobs.empty() && !working; });
+        }
+        publish(true);
+    }
+
+    // finishes the queued jobs, stops the thread and destroys the context; call it on the main thread before the
+    // render context goes away
+    void release()
+    {
+        if (!window)
+            return;
+        finish();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        worker.join();
+        glfwDestroyWindow(window);
+        window = nullptr;
+    }
+
+private:
+    static constexpr GLuint64 WAIT_FOREVER = ~GLuint64(0);
+
+    struct Job
+    {
+        std::function<void()> work;
+        std::function<void()> publish;
+        GLsync ready; // the render thread's state at submit
+        GLsync fence; // the upload's completion
+    };
+
+    GLFWwindow* window = nullptr;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::condition_variable idle;
+    std::deque<Job> jobs;      // submitted, not run yet
+    std::deque<Job> completed; // run, waiting for their fence and publication
+    bool working = false;
+    bool stopping = false;
+
+    void workerLoop()
+    {
+        glfwMakeContextCurrent(window);
+        for (;;)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (stopping && jobs.empty())
+                    break;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+                working = true;
+            }
+            glWaitSync(job.ready, 0, GL_TIMEOUT_IGNORED);
+            glDeleteSync(job.ready);
+            job.work();
+            job.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            // the fence has to reach the GPU for the render thread's wait on it to ever return
+            glFlush();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                completed.push_back(std::move(job));
+                working = false;
+            }
+            idle.notify_all();
+        }
+        glfwMakeContextCurrent(nullptr);
+    }
+
+    size_t publish(bool wait)
+    {
+        size_t published = 0;
+        for (;;)
+        {
+            GLsync fence;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (completed.empty())
+                    break;
+                fence = completed.front().fence;
+            }
+            // only this thread removes jobs from completed, so the front stays while the lock is released
+            const GLenum status = glClientWaitSync(fence, 0, wait ? WAIT_FOREVER : 0);
+            if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+                break;
+            Job job;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                job = std::move(completed.front());
+                completed.pop_front();
+            }
+            glDeleteSync(job.fence);
+            // the callbacks may submit more work
+            job.publish();
+            published++;
+        }
+        return published;
+    }
+};
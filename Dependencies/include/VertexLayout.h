@@ -0,0 +1,176 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "HalfFloat.h"
+#include "OctahedralMap.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+// full precision vertex, the layout of the import and of VertexFormat::Float buffers
+struct Vertex {
+    // position
+    glm::vec3 Position;
+    // normal
+    glm::vec3 Normal;
+    // texCoords
+    glm::vec2 TexCoords;
+    // tangent
+    glm::vec3 Tangent;
+    // bitangent
+    glm::vec3 Bitangent;
+};
+
+// 20 byte vertex of VertexFormat::Quantized (56 for Vertex):
+// - position as 16-bit unsigned normalized coordinates inside the mesh's bounding box; w holds the bitangent sign
+//   (0 for -1, 65535 for +1), the bitangent itself is cross(normal, tangent) * sign
+// - normal and tangent octahedral encoded (OctahedralMap::encode) into two 16-bit signed normalized values each
+// - texture coordinates as half floats
+struct QuantizedVertex {
+    uint16_t Position[4];
+    int16_t Normal[2];
+    int16_t Tangent[2];
+    uint16_t TexCoords[2];
+};
+
+// how a mesh's vertices are stored in its GL buffer; chosen per model
+enum class VertexFormat : uint32_t
+{
+    Float = 0,
+    Quantized = 1
+};
+
+// The vertex formats' GL side and the conversion between them. Both formats feed the same attribute locations:
+// 0 position, 1 normal, 2 texture coordinates, 3 tangent, 4 bitangent (Float only). A shader tells them apart with
+// the quantizedVertices uniform and turns quantized positions back into object space with the mesh's
+// dequantizeOffset/dequantizeScale, which are its bounds (see 2.2.2.pbr.vs).
+namespace VertexLayout
+{
+    // hashes a position consistently with glm::vec3's ==, which std::hash<float> is and hashing the raw bits isn't:
+    // -0.0f and +0.0f compare equal
+    struct PositionHash
+    {
+        size_t operator()(const glm::vec3& p) const
+        {
+            return std::hash<float>()(p.x) ^ (std::hash<float>()(p.y) * 31) ^ (std::hash<float>()(p.z) * 131);
+        }
+    };
+
+    // for each vertex the index of the first vertex at the same position, so that vertices split at UV or normal
+    // seams share one id
+    inline std::vector<unsigned int> weldPositions(const std::vector<Vertex>& vertices)
+    {
+        std::vector<unsigned int> canonical(vertices.size());
+        std::unordered_map<glm::vec3, unsigned int, PositionHash> first;
+        first.reserve(vertices.size());
+        for (size_t v = 0; v < vertices.size(); ++v)
+            canonical[v] = first.emplace(vertices[v].Position, static_cast<unsigned int>(v)).first->second;
+        return canonical;
+    }
+
+    inline size_t stride(VertexFormat format)
+    {
+        return format == VertexFormat::Quantized ? sizeof(QuantizedVertex) : sizeof(Vertex);
+    }
+
+    inline const char* name(VertexFormat format)
+    {
+        return format == VertexFormat::Quantized ? "quantized" : "float";
+    }
+
+    // sets the attribute pointers of the bound vertex array for the buffer bound to GL_ARRAY_BUFFER
+    inline void setupAttributes(VertexFormat format)
+    {
+        if (format == VertexFormat::Quantized)
+        {
+            const GLsizei size = sizeof(QuantizedVertex);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, size, (void*)offsetof(QuantizedVertex, Position));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, size, (void*)offsetof(QuantizedVertex, Normal));
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, size, (void*)offsetof(QuantizedVertex, TexCoords));
+            glEnableVertexAttribArray(3);
+            glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, size, (void*)offsetof(QuantizedVertex, Tangent));
+            return;
+        }
+        // vertex Positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+        // vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+        // vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+        // vertex tangent
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+        // vertex bitangent
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+    }
+
+    // the narrowest GL index type that can address vertexCount vertices
+    inline GLenum indexTypeFor(size_t vertexCount)
+    {
+        return vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    }
+
+    inline size_t indexSize(GLenum indexType)
+    {
+        return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+    }
+
+    inline uint16_t quantizeUnorm(float value)
+    {
+        return static_cast<uint16_t>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 65535.0f));
+    }
+
+    inline int16_t quantizeSnorm(float value)
+    {
+        return static_cast<int16_t>(std::lround(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f));
+    }
+
+    // a unit vector as two signed normalized values in [-1, 1]; zero vectors come out as +Z
+    inline void encodeDirection(glm::vec3 direction, int16_t* encoded)
+    {
+        if (glm::dot(direction, direction) < 1e-12f)
+            direction = glm::vec3(0.0f, 0.0f, 1.0f);
+        const glm::vec2 uv = OctahedralMap::encode(glm::normalize(direction)) * 2.0f - 1.0f;
+        encoded[0] = quantizeSnorm(uv.x);
+        encoded[1] = quantizeSnorm(uv.y);
+    }
+
+    // converts count vertices to the quantized format, positions relative to the mesh's bounds
+    inline void quantize(const Vertex* vertices, size_t count, glm::vec3 boundsMin, glm::vec3 boundsMax, QuantizedVertex* out)
+    {
+        const glm::vec3 extent = boundsMax - boundsMin;
+        // a flat axis maps to 0 rather than dividing by zero
+        const glm::vec3 inverseExtent(extent.x > 0.0f ? 1.0f / extent.x : 0.0f, extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                                      extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const Vertex& vertex = vertices[i];
+            QuantizedVertex& packed = out[i];
+            const glm::vec3 position = (vertex.Position - boundsMin) * inverseExtent;
+            packed.Position[0] = quantizeUnorm(position.x);
+            packed.Position[1] = quantizeUnorm(position.y);
+            packed.Position[2] = quantizeUnorm(position.z);
+            const bool mirrored = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f;
+            packed.Position[3] = mirrored ? 0 : 65535;
+            encodeDirection(vertex.Normal, packed.Normal);
+            encodeDirection(vertex.Tangent, packed.Tangent);
+            packed.TexCoords[0] = HalfFloat::fromFloat(vertex.TexCoords.x);
+            packed.TexCoords[1] = HalfFloat::fromFloat(vertex.TexCoords.y);
+        }
+    }
+}
@@ -4,93 +4,251 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include"Shader.h"
+#include "VertexLayout.h"
+#include "Meshlets.h"
+#include "GeometryArena.h"
 
 #include <string>
 #include <vector>
+#include <utility>
+#include <cstring>
+#include <algorithm>
 using namespace std;
 
-struct Vertex {
-    // position
-    glm::vec3 Position;
-    // normal
-    glm::vec3 Normal;
-    // texCoords
-    glm::vec2 TexCoords;
-    // tangent
-    glm::vec3 Tangent;
-    // bitangent
-    glm::vec3 Bitangent;
+// one level of detail: a range of the mesh's index buffer and the object space error of drawing it instead of the
+// full detail level (MeshSimplifier.h), and the meshlets the range is split into, if any
+struct MeshLod {
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    float error;
+    unsigned int firstMeshlet;
+    unsigned int meshletCount;
 };
 
-
 class Mesh {
 public:
     // mesh Data
+    // CPU copies, only kept for meshes built from vectors (a fresh import); meshes from a mapped MeshCache file
+    // go straight to the GPU and leave them empty
     vector<Vertex>       vertices;
     vector<unsigned int> indices;
+    unsigned int indexCount;
+    // levels of detail, finest first; level 0 is the full mesh. Their index ranges follow each other in indices.
+    vector<MeshLod> lods;
+    // clusters of the levels' triangles for DrawCulled (Meshlets.h); empty unless the model was imported with them
+    vector<Meshlet> meshlets;
+    // GL_UNSIGNED_SHORT when the mesh has few enough vertices, GL_UNSIGNED_INT otherwise
+    GLenum indexType = GL_UNSIGNED_INT;
+    // object space bounding box
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    // layout of the GL vertex buffer
+    VertexFormat format = VertexFormat::Float;
+    // the mesh's material in its model's materials (Model::materials)
+    unsigned int materialIndex = 0;
+    // the GeometryArena vertex array of the format, shared with every other mesh in it
     unsigned int VAO;
+    // where the mesh's vertices and indices are in the arena's buffers
+    GeometryArena::Range range;
 
-    // constructor
+    // constructor, takes over the vectors (pass them with std::move to avoid a copy)
     Mesh(vector<Vertex> vertices, vector<unsigned int> indices)
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        this->vertices = std::move(vertices);
+        this->indices = std::move(indices);
+        boundsMin = glm::vec3(0.0f);
+        boundsMax = glm::vec3(0.0f);
+        for (size_t i = 0; i < this->vertices.size(); i++)
+        {
+            boundsMin = i == 0 ? this->vertices[i].Position : glm::min(boundsMin, this->vertices[i].Position);
+            boundsMax = i == 0 ? this->vertices[i].Position : glm::max(boundsMax, this->vertices[i].Position);
+        }
+        upload();
+    }
+
+    // constructor for vertices whose bounds are already known (computed while importing), stored in the given format.
+    // lods describes the levels of detail in indices; empty means indices is just the full mesh.
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, glm::vec3 boundsMin, glm::vec3 boundsMax, VertexFormat format = VertexFormat::Float,
+         vector<MeshLod> lods = vector<MeshLod>(), vector<Meshlet> meshlets = vector<Meshlet>())
+        : vertices(std::move(vertices)), indices(std::move(indices)), lods(std::move(lods)), meshlets(std::move(meshlets)), boundsMin(boundsMin),
+          boundsMax(boundsMax), format(format)
+    {
+        upload();
+    }
+
+    // constructor for data that already is in its final layout somewhere in memory (a mapped MeshCache file);
+    // it is uploaded as is and not kept
+    Mesh(const void* vertexData, size_t vertexCount, VertexFormat format, const void* indexData, size_t indexCount, GLenum indexType,
+         glm::vec3 boundsMin, glm::vec3 boundsMax, vector<MeshLod> lods = vector<MeshLod>(), vector<Meshlet> meshlets = vector<Meshlet>())
+        : lods(std::move(lods)), meshlets(std::move(meshlets)), indexType(indexType), boundsMin(boundsMin), boundsMax(boundsMax), format(format)
+    {
+        setupMesh(vertexData, vertexCount, indexData, indexCount);
+    }
+
+    // the CPU vertices in the mesh's vertex format, as uploaded (and as stored by MeshCache)
+    vector<unsigned char> packedVertices() const
+    {
+        vector<unsigned char> packed(vertices.size() * VertexLayout::stride(format));
+        if (format == VertexFormat::Quantized)
+            VertexLayout::quantize(vertices.data(), vertices.size(), boundsMin, boundsMax, reinterpret_cast<QuantizedVertex*>(packed.data()));
+        else if (!vertices.empty())
+            memcpy(packed.data(), vertices.data(), packed.size());
+        return packed;
+    }
+
+    // the CPU indices in the mesh's index type, as uploaded (and as stored by MeshCache)
+    vector<unsigned char> packedIndices() const
+    {
+        vector<unsigned char> packed(indices.size() * VertexLayout::indexSize(indexType));
+        if (indexType == GL_UNSIGNED_SHORT)
+        {
+            for (size_t i = 0; i < indices.size(); i++)
+            {
+                const uint16_t index = static_cast<uint16_t>(indices[i]);
+                memcpy(packed.data() + i * sizeof(uint16_t), &index, sizeof(uint16_t));
+            }
+        }
+        else if (!indices.empty())
+            memcpy(packed.data(), indices.data(), packed.size());
+        return packed;
+    }
+
+    // false while the upload thread is still writing the mesh into the arena (GeometryArena::setUploadContext);
+    // the draws skip it until then
+    bool uploaded() const
+    {
+        return !range.uploaded || *range.uploaded;
+    }
+
+    // the coarsest level whose error stays within maxError (object space)
+    unsigned int selectLod(float maxError) const
+    {
+        unsigned int lod = 0;
+        while (lod + 1 < lods.size() && lods[lod + 1].error <= maxError)
+            lod++;
+        return lod;
     }
 
-    // render the mesh
-    void Draw(Shader& shader)
+    // render the mesh at a level of detail. bind = false leaves binding the vertex array to the caller, which
+    // draws several meshes of the same format in a row (Model::Draw).
+    void Draw(Shader& shader, unsigned int lod = 0, bool bind = true)
     {
-        // bind appropriate textures
+        if (!uploaded())
+            return;
+        beginDraw(shader, bind);
+        const MeshLod& level = lods[std::min<size_t>(lod, lods.size() - 1)];
+        glDrawElementsBaseVertex(GL_TRIANGLES, level.indexCount, indexType, indexPointer(level.firstIndex), range.baseVertex);
+        endDraw(shader, bind);
+    }
+
+    // render the meshlets of a level of detail that are inside the frustum planes and don't face away from eye,
+    // both in object space (Meshlets::frustumPlanes). Levels without meshlets are drawn whole. Returns the number
+    // of triangles drawn.
+    size_t DrawCulled(Shader& shader, unsigned int lod, const glm::vec4 planes[6], const glm::vec3& eye, bool bind = true)
+    {
+        const MeshLod& level = lods[std::min<size_t>(lod, lods.size() - 1)];
+        if (!uploaded())
+            return 0;
+        if (level.meshletCount == 0)
+        {
+            Draw(shader, lod, bind);
+            return level.indexCount / 3;
+        }
+        // meshlets follow each other in the index buffer, so visible neighbours merge into one range
+        drawCounts.clear();
+        drawOffsets.clear();
+        unsigned int rangeEnd = 0;
+        size_t triangles = 0;
+        for (unsigned int i = level.firstMeshlet; i < level.firstMeshlet + level.meshletCount; i++)
+        {
+            const Meshlet& meshlet = meshlets[i];
+            if (Meshlets::outsideFrustum(meshlet, planes) || Meshlets::backfacing(meshlet, eye))
+                continue;
+            if (!drawCounts.empty() && rangeEnd == meshlet.firstIndex)
+                drawCounts.back() += meshlet.indexCount;
+            else
+            {
+                drawCounts.push_back(static_cast<GLsizei>(meshlet.indexCount));
+                drawOffsets.push_back(indexPointer(meshlet.firstIndex));
+            }
+            rangeEnd = meshlet.firstIndex + meshlet.indexCount;
+            triangles += meshlet.indexCount / 3;
+        }
+        if (drawCounts.empty())
+            return 0;
+        drawBaseVertices.assign(drawCounts.size(), range.baseVertex);
+        beginDraw(shader, bind);
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, drawCounts.data(), indexType, drawOffsets.data(), static_cast<GLsizei>(drawCounts.size()),
+                                      drawBaseVertices.data());
+        endDraw(shader, bind);
+        return triangles;
+    }
+
+private:
+    // index ranges of the visible meshlets, rebuilt by every DrawCulled
+    vector<GLsizei> drawCounts;
+    vector<const void*> drawOffsets;
+    vector<GLint> drawBaseVertices;
+
+    // the element array "pointer" of one of the mesh's indices
+    const void* indexPointer(unsigned int index) const
+    {
+        return (const void*)(range.indexOffset + index * VertexLayout::indexSize(indexType));
+    }
+
+    void beginDraw(Shader& shader, bool bind)
+    {
+        // quantized positions are relative to the bounds
+        if (format == VertexFormat::Quantized)
+        {
+            shader.setBool("quantizedVertices", true);
+            shader.setVec3("dequantizeOffset", boundsMin);
+            shader.setVec3("dequantizeScale", boundsMax - boundsMin);
+        }
         // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+        if (bind)
+            glBindVertexArray(VAO);
+    }
+
+    void endDraw(Shader& shader, bool bind)
+    {
+        if (bind)
+            glBindVertexArray(0);
 
         // always good practice to set everything back to defaults once configured.
         glActiveTexture(GL_TEXTURE0);
+        if (format == VertexFormat::Quantized)
+            shader.setBool("quantizedVertices", false);
     }
 
-private:
-    // render data 
-    unsigned int VBO, EBO;
+    // converts the CPU vertices and indices to the mesh's formats and uploads them
+    void upload()
+    {
+        indexType = VertexLayout::indexTypeFor(vertices.size());
+        // now that we have all the required data, set the vertex buffers and its attribute pointers.
+        if (format == VertexFormat::Float && indexType == GL_UNSIGNED_INT)
+        {
+            setupMesh(vertices.data(), vertices.size(), indices.data(), indices.size());
+            return;
+        }
+        vector<unsigned char> packedVertexData = format == VertexFormat::Float ? vector<unsigned char>() : packedVertices();
+        vector<unsigned char> packedIndexData = packedIndices();
+        setupMesh(format == VertexFormat::Float ? static_cast<const void*>(vertices.data()) : packedVertexData.data(), vertices.size(),
+                  packedIndexData.data(), indices.size());
+    }
 
-    // initializes all the buffer objects/arrays
-    void setupMesh()
+    // copies the vertices and indices into the shared GeometryArena
+    void setupMesh(const void* vertexData, size_t vertexCount, const void* indexData, size_t indexCount)
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
-
-        glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        this->indexCount = static_cast<unsigned int>(indexCount);
+        if (lods.empty())
+            lods.push_back({ 0, this->indexCount, 0.0f, 0, 0 });
+
         // A great thing about structs is that their memory layout is sequential for all its items.
         // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
         // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-        glBindVertexArray(0);
+        GeometryArena& arena = GeometryArena::shared();
+        range = arena.allocate(format, vertexData, vertexCount, indexData, indexCount, indexType);
+        VAO = arena.vertexArray(format);
     }
 };
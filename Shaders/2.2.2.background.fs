@@ -2,11 +2,38 @@
 out vec4 FragColor;
 in vec3 WorldPos;
 
+#ifdef IBL_OCTAHEDRAL
+uniform sampler2D environmentMap;
+
+// see OctahedralMap.h and the same helper in 2.2.2.pbr.fs
+vec2 OctahedralEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 p = n.xy;
+    if (n.z < 0.0)
+        p = (1.0 - abs(p.yx)) * vec2(p.x >= 0.0 ? 1.0 : -1.0, p.y >= 0.0 ? 1.0 : -1.0);
+    return p * 0.5 + 0.5;
+}
+#else
 uniform samplerCube environmentMap;
+#endif
+// linear HDR output for scene captures (reflection probes) instead of the tonemapped image
+uniform bool linearOutput;
 
 void main()
 {
+#ifdef IBL_OCTAHEDRAL
+    // level 0 only, mapped into its interior past the one texel border
+    float size = float(textureSize(environmentMap, 0).x);
+    vec3 envColor = textureLod(environmentMap, (OctahedralEncode(normalize(WorldPos)) * (size - 2.0) + 1.0) / size, 0.0).rgb;
+#else
     vec3 envColor = textureLod(environmentMap, WorldPos, 0.0).rgb;
+#endif
+    if (linearOutput)
+    {
+        FragColor = vec4(envColor, 1.0);
+        return;
+    }
 
     // HDR tonemap and gamma correct
     envColor = envColor / (envColor + vec3(1.0));
@@ -1,20 +1,85 @@
 #version 330 core
+// set by ReflectionProbes::shaderDefines() when the probes live in a cube map array
+#ifdef REFLECTION_PROBE_ATLAS
+#extension GL_ARB_texture_cube_map_array : require
+#endif
 out vec4 FragColor;
 in vec2 TexCoords;
 in vec3 WorldPos;
 in vec3 Normal;
 
+// set by IBLConfig::shaderDefines(), the fallback matches the default configuration
+#ifndef IBL_PREFILTER_MIP_LEVELS
+#define IBL_PREFILTER_MIP_LEVELS 5
+#endif
+
 // material parameters
 uniform sampler2D albedoMap;
 uniform sampler2D normalMap;
+#ifdef MATERIAL_ORM
+// occlusion (R), roughness (G) and metallic (B), packed at import (MaterialLayout::PackedORM)
+uniform sampler2D ormMap;
+#else
 uniform sampler2D metallicMap;
 uniform sampler2D roughnessMap;
 uniform sampler2D aoMap;
+// the channel of metallicMap and roughnessMap holding the value (glTF packs metallic in B and roughness in G of
+// one image)
+uniform int metallicChannel;
+uniform int roughnessChannel;
+#endif
+// factors the maps are multiplied with, set by Material::bind
+uniform vec4 baseColorFactor;
+uniform float metallicFactor;
+uniform float roughnessFactor;
 
 // IBL
+#ifdef IBL_DIFFUSE_SH
+// irradiance as 9 SH coefficients with the basis constants folded in (SphericalHarmonics::shaderConstants)
+layout(std140) uniform IrradianceSH
+{
+    vec4 shCoefficients[9];
+};
+#elif defined(IBL_OCTAHEDRAL)
+uniform sampler2D irradianceMap;
+#else
 uniform samplerCube irradianceMap;
+#endif
+#ifdef IBL_OCTAHEDRAL
+uniform sampler2D prefilterMap;
+#else
 uniform samplerCube prefilterMap;
+#endif
+#ifndef IBL_BRDF_ANALYTIC
 uniform sampler2D brdfLUT;
+#endif
+
+// local reflection probes (ReflectionProbes.h), blended over the environment's pre-filter map. Every probe's data
+// stays in a uniform block for the whole pass, a draw only picks up to two of them by index, nearest first.
+#ifndef MAX_REFLECTION_PROBES
+#define MAX_REFLECTION_PROBES 8
+#endif
+struct ReflectionProbe
+{
+    vec4 position; // where the cubemap was captured, w: its slice of the atlas
+    vec4 boxMin;   // influence and parallax box
+    vec4 boxMax;
+};
+layout(std140) uniform ReflectionProbeData
+{
+    ReflectionProbe reflectionProbes[MAX_REFLECTION_PROBES];
+};
+uniform int reflectionProbeIndices[2];
+uniform int reflectionProbeCount;
+uniform float reflectionProbeFade; // distance over which a probe fades out towards its box's faces
+#ifdef REFLECTION_PROBE_ATLAS
+uniform samplerCubeArray reflectionProbeAtlas;
+#else
+uniform samplerCube reflectionProbeMaps[2]; // the selected probes' own cubemaps
+#endif
+
+// linear HDR output for scene captures (reflection probes) instead of the tonemapped image
+uniform bool linearOutput;
 
 // lights
 uniform vec3 lightPositions[4];
@@ -30,7 +95,9 @@ const float PI = 3.14159265359;
 // technique somewhere later in the normal mapping tutorial.
 vec3 getNormalFromMap()
 {
-    vec3 tangentNormal = texture(normalMap, TexCoords).xyz * 2.0 - 1.0;
+    // only X and Y are read: BC5 normal maps (TextureCompression.h) store no Z, it follows from the unit length
+    vec2 xy = texture(normalMap, TexCoords).xy * 2.0 - 1.0;
+    vec3 tangentNormal = vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
 
     vec3 Q1 = dFdx(WorldPos);
     vec3 Q2 = dFdy(WorldPos);
@@ -90,13 +157,106 @@ vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
     return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
 }
 // ----------------------------------------------------------------------------
+#ifdef IBL_BRDF_ANALYTIC
+// analytic fit of the split-sum BRDF LUT for low-end targets (Karis, "Physically Based Shading on Mobile")
+vec2 EnvBRDFApprox(float NdotV, float roughness)
+{
+    const vec4 c0 = vec4(-1.0, -0.0275, -0.572, 0.022);
+    const vec4 c1 = vec4(1.0, 0.0425, 1.04, -0.04);
+    vec4 r = roughness * c0 + c1;
+    float a004 = min(r.x * r.x, exp2(-9.28 * NdotV)) * r.x + r.y;
+    return vec2(-1.04, 1.04) * a004 + r.zw;
+}
+#endif
+// ----------------------------------------------------------------------------
+#ifdef IBL_DIFFUSE_SH
+vec3 irradianceSH(vec3 n)
+{
+    return shCoefficients[0].rgb
+         + shCoefficients[1].rgb * n.y
+         + shCoefficients[2].rgb * n.z
+         + shCoefficients[3].rgb * n.x
+         + shCoefficients[4].rgb * (n.x * n.y)
+         + shCoefficients[5].rgb * (n.y * n.z)
+         + shCoefficients[6].rgb * (3.0 * n.z * n.z - 1.0)
+         + shCoefficients[7].rgb * (n.x * n.z)
+         + shCoefficients[8].rgb * (n.x * n.x - n.y * n.y);
+}
+#endif
+// ----------------------------------------------------------------------------
+#ifdef IBL_OCTAHEDRAL
+// octahedral maps (OctahedralMap.h): direction -> [0, 1]^2, +Z in the centre and -Z in the corners
+vec2 OctahedralEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 p = n.xy;
+    if (n.z < 0.0)
+        p = (1.0 - abs(p.yx)) * vec2(p.x >= 0.0 ? 1.0 : -1.0, p.y >= 0.0 ? 1.0 : -1.0);
+    return p * 0.5 + 0.5;
+}
+// every level has a one texel border with the neighbours across the mirrored edges, so a lookup has to land in the
+// interior of the level it reads; trilinear filtering is done by hand for that reason
+vec3 OctahedralLevel(sampler2D map, vec2 uv, float level)
+{
+    float size = float(textureSize(map, int(level)).x);
+    return textureLod(map, (uv * (size - 2.0) + 1.0) / size, level).rgb;
+}
+vec3 textureOctahedral(sampler2D map, vec3 direction, float lod, float maxLod)
+{
+    vec2 uv = OctahedralEncode(direction);
+    float level = floor(lod);
+    vec3 color = OctahedralLevel(map, uv, level);
+    if (lod > level && level < maxLod)
+        color = mix(color, OctahedralLevel(map, uv, level + 1.0), lod - level);
+    return color;
+}
+#endif
+// ----------------------------------------------------------------------------
+// parallax correction: intersect the reflection ray with the probe's box and look up the direction from the
+// capture point to the hit, so that reflections of the surroundings line up with them wherever the fragment is
+vec3 BoxProjectedDirection(ReflectionProbe probe, vec3 R)
+{
+    vec3 toMax = (probe.boxMax.xyz - WorldPos) / R;
+    vec3 toMin = (probe.boxMin.xyz - WorldPos) / R;
+    vec3 exits = max(toMax, toMin);
+    float distance = min(min(exits.x, exits.y), exits.z);
+    return WorldPos + R * distance - probe.position.xyz;
+}
+// 1 inside the box, fading to 0 over reflectionProbeFade towards its faces and outside it
+float ReflectionProbeWeight(ReflectionProbe probe)
+{
+    vec3 inside = min(WorldPos - probe.boxMin.xyz, probe.boxMax.xyz - WorldPos);
+    return clamp(min(min(inside.x, inside.y), inside.z) / reflectionProbeFade, 0.0, 1.0);
+}
+// the reflection from the probe selected in the given slot (0 or 1)
+vec3 sampleReflectionProbe(int slot, vec3 R, float lod)
+{
+    ReflectionProbe probe = reflectionProbes[reflectionProbeIndices[slot]];
+    vec3 direction = BoxProjectedDirection(probe, R);
+#ifdef REFLECTION_PROBE_ATLAS
+    return textureLod(reflectionProbeAtlas, vec4(direction, probe.position.w), lod).rgb;
+#else
+    // sampler arrays only take constant indices in GLSL 3.30
+    if (slot == 0)
+        return textureLod(reflectionProbeMaps[0], direction, lod).rgb;
+    return textureLod(reflectionProbeMaps[1], direction, lod).rgb;
+#endif
+}
+// ----------------------------------------------------------------------------
 void main()
 {
     // material properties
-    vec3 albedo = pow(texture(albedoMap, TexCoords).rgb, vec3(2.2));
-    float metallic = texture(metallicMap, TexCoords).r;
-    float roughness = texture(roughnessMap, TexCoords).r;
+    vec3 albedo = pow(texture(albedoMap, TexCoords).rgb, vec3(2.2)) * baseColorFactor.rgb;
+#ifdef MATERIAL_ORM
+    vec3 orm = texture(ormMap, TexCoords).rgb;
+    float ao = orm.r;
+    float roughness = orm.g * roughnessFactor;
+    float metallic = orm.b * metallicFactor;
+#else
+    float metallic = texture(metallicMap, TexCoords)[metallicChannel] * metallicFactor;
+    float roughness = texture(roughnessMap, TexCoords)[roughnessChannel] * roughnessFactor;
     float ao = texture(aoMap, TexCoords).r;
+#endif
 
     // input lighting data
     vec3 N = getNormalFromMap();
@@ -153,18 +313,48 @@ void main()
     vec3 kD = 1.0 - kS;
     kD *= 1.0 - metallic;
 
+#ifdef IBL_DIFFUSE_SH
+    vec3 irradiance = max(irradianceSH(N), vec3(0.0));
+#elif defined(IBL_OCTAHEDRAL)
+    vec3 irradiance = textureOctahedral(irradianceMap, N, 0.0, 0.0);
+#else
     vec3 irradiance = texture(irradianceMap, N).rgb;
+#endif
     vec3 diffuse = irradiance * albedo;
 
     // sample both the pre-filter map and the BRDF lut and combine them together as per the Split-Sum approximation to get the IBL specular part.
-    const float MAX_REFLECTION_LOD = 4.0;
+    const float MAX_REFLECTION_LOD = float(IBL_PREFILTER_MIP_LEVELS - 1);
+#ifdef IBL_OCTAHEDRAL
+    vec3 prefilteredColor = textureOctahedral(prefilterMap, R, roughness * MAX_REFLECTION_LOD, MAX_REFLECTION_LOD);
+#else
     vec3 prefilteredColor = textureLod(prefilterMap, R, roughness * MAX_REFLECTION_LOD).rgb;
+#endif
+    // the nearest probe takes what its weight allows and the second one the rest, the environment fills in
+    // whatever is left
+    float probeWeight = 0.0;
+    vec3 probeColor = vec3(0.0);
+    for (int slot = 0; slot < reflectionProbeCount; ++slot)
+    {
+        float weight = min(ReflectionProbeWeight(reflectionProbes[reflectionProbeIndices[slot]]), 1.0 - probeWeight);
+        probeColor += weight * sampleReflectionProbe(slot, R, roughness * MAX_REFLECTION_LOD);
+        probeWeight += weight;
+    }
+    prefilteredColor = probeColor + prefilteredColor * (1.0 - probeWeight);
+#ifdef IBL_BRDF_ANALYTIC
+    vec2 brdf = EnvBRDFApprox(max(dot(N, V), 0.0), roughness);
+#else
     vec2 brdf = texture(brdfLUT, vec2(max(dot(N, V), 0.0), roughness)).rg;
+#endif
     vec3 specular = prefilteredColor * (F * brdf.x + brdf.y);
 
     vec3 ambient = (kD * diffuse + specular) * ao;
 
     vec3 color = ambient + Lo;
+    if (linearOutput)
+    {
+        FragColor = vec4(color, 1.0);
+        return;
+    }
 
     // HDR tonemapping
     color = color / (color + vec3(1.0));
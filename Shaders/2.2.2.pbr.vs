@@ -1,5 +1,5 @@
 #version 330 core
-layout(location = 0) in vec3 aPos;
+layout(location = 0) in vec4 aPos;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
 
@@ -11,10 +11,32 @@ uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// VertexFormat::Quantized meshes (VertexLayout.h): aPos.xyz is normalized to the mesh's bounds and aNormal.xy
+// holds an octahedral encoded normal
+uniform bool quantizedVertices;
+uniform vec3 dequantizeOffset;
+uniform vec3 dequantizeScale;
+
+// see OctahedralMap.h: [-1, 1]^2 -> unit direction
+vec3 OctahedralDecode(vec2 f)
+{
+    vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
 void main()
 {
-    WorldPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(model) * aNormal;
+    vec3 position = aPos.xyz;
+    vec3 normal = aNormal;
+    if (quantizedVertices)
+    {
+        position = dequantizeOffset + aPos.xyz * dequantizeScale;
+        normal = OctahedralDecode(aNormal.xy);
+    }
+    WorldPos = vec3(model * vec4(position, 1.0));
+    Normal = mat3(model) * normal;
     TexCoords = aTexCoord;
     gl_Position = projection * view * vec4(WorldPos, 1.0);
-}
\ No newline at end of file
+}
@@ -0,0 +1,30 @@
+#version 330 core
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 18) out;
+
+// single-pass cubemap capture: the vertex shader runs with identity projection and view, so gl_Position holds
+// the world-space position. Every triangle is emitted once per face and routed to that face's layer with gl_Layer.
+out vec3 WorldPos;
+
+uniform mat4 faceViewProjections[6];
+// >= 0 restricts the capture to that face, so a capture can be spread over several frames
+uniform int captureFace = -1;
+// cubemap of a cube map array to write to (layer-faces slice * 6 to slice * 6 + 5); 0 for a plain cubemap
+uniform int captureSlice = 0;
+
+void main()
+{
+    for (int face = 0; face < 6; ++face)
+    {
+        if (captureFace >= 0 && face != captureFace)
+            continue;
+        for (int i = 0; i < 3; ++i)
+        {
+            gl_Layer = captureSlice * 6 + face;
+            WorldPos = gl_in[i].gl_Position.xyz;
+            gl_Position = faceViewProjections[face] * gl_in[i].gl_Position;
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+}
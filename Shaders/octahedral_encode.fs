@@ -0,0 +1,35 @@
+#version 330 core
+out vec4 FragColor;
+
+// copies one level of a cubemap into one level of an octahedral map (OctahedralMap.h), border texels included
+uniform samplerCube sourceMap;
+uniform float sourceLevel;
+uniform int levelSize;
+
+vec3 OctahedralDecode(vec2 uv)
+{
+    vec2 f = uv * 2.0 - 1.0;
+    vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+// the octahedron continues mirrored across each edge of the square
+vec2 OctahedralWrap(vec2 uv)
+{
+    if (uv.x < 0.0) uv = vec2(-uv.x, 1.0 - uv.y);
+    if (uv.x > 1.0) uv = vec2(2.0 - uv.x, 1.0 - uv.y);
+    if (uv.y < 0.0) uv = vec2(1.0 - uv.x, -uv.y);
+    if (uv.y > 1.0) uv = vec2(1.0 - uv.x, 2.0 - uv.y);
+    return uv;
+}
+
+void main()
+{
+    // the outermost ring of texels is the border, the interior spans levelSize - 2 texels
+    vec2 uv = (gl_FragCoord.xy - 1.0) / float(levelSize - 2);
+    vec3 direction = OctahedralDecode(OctahedralWrap(uv));
+    FragColor = vec4(textureLod(sourceMap, direction, sourceLevel).rgb, 1.0);
+}
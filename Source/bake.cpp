@@ -0,0 +1,488 @@
+// EVCBake: headless IBL baker and texture compiler.
+// Bakes .hdr environments on the CPU (no GL context needed) into the same cache files the renderer loads at
+// startup, and compares two cache files so the CPU output can serve as a reference for the GPU bake. --textures
+// compiles material images, and the packed ORM textures the renderer listed in the output directory, into
+// block-compressed KTX2 files the renderer's TextureCache picks up instead.
+//
+//   EVCBake <file.hdr | directory> [-o <output directory>] [-j <threads>] [--quality <tier>] [--irradiance-cubemap] [--octahedral]
+//   EVCBake --compare <a.iblcache> <b.iblcache>
+//   EVCBake --brdf-lut <header.h>      regenerates Dependencies/include/BRDFLUTData.h
+//   EVCBake --textures [<image | directory>...] [-o <output directory>] [-j <threads>]
+
+#include <CpuIBLBaker.h>
+#include <IBLCacheFile.h>
+#include <ThreadPool.h>
+#include <RadianceHDR.h>
+#include <TextureCompression.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+void printUsage();
+bool parseThreads(const char* text, unsigned int& threads);
+bool bakeFile(const fs::path& hdrPath, const fs::path& outputDirectory, ThreadPool& pool, const IBLConfig& config);
+int compareFiles(const std::string& pathA, const std::string& pathB);
+int writeBRDFLUTHeader(const std::string& path);
+int compileTextures(int argc, char* argv[]);
+bool readFile(const fs::path& path, std::vector<unsigned char>& data);
+bool compileTexture(const fs::path& imagePath, const fs::path& outputDirectory, ThreadPool& pool);
+bool compilePacking(const TextureCompression::Packing& packing, const fs::path& outputDirectory, ThreadPool& pool);
+
+// resolution of the embedded BRDF LUT; the integral is smooth, 128x128 with bilinear filtering is plenty
+const int BRDF_LUT_SIZE = 128;
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        printUsage();
+        return 1;
+    }
+
+    std::string first = argv[1];
+    if (first == "--compare")
+    {
+        if (argc != 4)
+        {
+            printUsage();
+            return 1;
+        }
+        return compareFiles(argv[2], argv[3]);
+    }
+    if (first == "--brdf-lut")
+    {
+        if (argc != 3)
+        {
+            printUsage();
+            return 1;
+        }
+        return writeBRDFLUTHeader(argv[2]);
+    }
+    if (first == "--textures")
+        return compileTextures(argc, argv);
+
+    fs::path input = first;
+    fs::path outputDirectory = "Cache/IBL";
+    unsigned int threads = 0;
+    IBLQuality quality = IBLQuality::High;
+    bool irradianceSH = true;
+    bool octahedral = false;
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc)
+            outputDirectory = argv[++i];
+        else if (arg == "-j" && i + 1 < argc && parseThreads(argv[i + 1], threads))
+            ++i;
+        else if (arg == "--quality" && i + 1 < argc && IBLConfig::parseQuality(argv[i + 1], quality))
+            ++i;
+        else if (arg == "--irradiance-cubemap")
+            irradianceSH = false;
+        else if (arg == "--octahedral")
+            octahedral = true;
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+    IBLConfig config = IBLConfig::forQuality(quality);
+    config.irradianceSH = irradianceSH;
+    config.octahedral = octahedral;
+
+    // collect the environments to bake
+    std::vector<fs::path> hdrFiles;
+    std::error_code error;
+    if (fs::is_directory(input, error))
+    {
+        for (const fs::directory_entry& entry : fs::directory_iterator(input, error))
+        {
+            std::string extension = entry.path().extension().string();
+            for (char& c : extension)
+                c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            if (entry.is_regular_file() && extension == ".hdr")
+                hdrFiles.push_back(entry.path());
+        }
+        std::sort(hdrFiles.begin(), hdrFiles.end());
+    }
+    else
+    {
+        hdrFiles.push_back(input);
+    }
+    if (hdrFiles.empty())
+    {
+        std::cout << "No .hdr files found in " << input.string() << std::endl;
+        return 1;
+    }
+
+    ThreadPool pool(threads);
+    std::cout << "Baking " << hdrFiles.size() << " environment(s) on " << pool.size() << " thread(s)" << std::endl;
+
+    int failures = 0;
+    for (const fs::path& hdrPath : hdrFiles)
+    {
+        if (!bakeFile(hdrPath, outputDirectory, pool, config))
+            ++failures;
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+void printUsage()
+{
+    std::cout << "usage: EVCBake <file.hdr | directory> [-o <output directory>] [-j <threads>] [--quality <tier>] [--irradiance-cubemap] [--octahedral]" << std::endl;
+    std::cout << "       tiers: low, medium, high (default), ultra; must match the renderer's --ibl-quality" << std::endl;
+    std::cout << "       EVCBake --compare <a.iblcache> <b.iblcache>" << std::endl;
+    std::cout << "       EVCBake --brdf-lut <header.h>" << std::endl;
+    std::cout << "       EVCBake --textures [<image | directory>...] [-o <output directory>] [-j <threads>]" << std::endl;
+}
+
+// the thread count of -j: a whole number, 0 for one per core
+bool parseThreads(const char* text, unsigned int& threads)
+{
+    char* end = nullptr;
+    errno = 0;
+    const unsigned long value = std::strtoul(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE || value > 1024 || text[0] == '-')
+        return false;
+    threads = static_cast<unsigned int>(value);
+    return true;
+}
+
+// bakes one environment into <outputDirectory>/<key>.iblcache
+bool bakeFile(const fs::path& hdrPath, const fs::path& outputDirectory, ThreadPool& pool, const IBLConfig& config)
+{
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+
+    RadianceHDR hdr;
+    if (!hdr.open(hdrPath.string()))
+    {
+        std::cout << "Failed to load HDR image " << hdrPath.string() << std::endl;
+        return false;
+    }
+    CpuImage equirect;
+    equirect.width = hdr.width();
+    equirect.height = hdr.height();
+    equirect.pixels.resize(hdr.valueCount());
+    // same orientation as the renderer's upload of the equirectangular map
+    if (!hdr.decode(pool, equirect.pixels.data(), true))
+    {
+        std::cout << "Failed to decode HDR image " << hdrPath.string() << std::endl;
+        return false;
+    }
+
+    CpuIBLBaker baker(pool, config);
+    IBLCacheContents contents = baker.bake(equirect);
+
+    uint64_t key = IBLCacheFile::computeKey(hdrPath.string(), config);
+    fs::path outputPath = outputDirectory / IBLCacheFile::fileName(key);
+    bool written = IBLCacheFile::write(outputPath.string(), key, contents);
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << hdrPath.string() << " -> " << outputPath.string() << " (" << hdr.width() << "x" << hdr.height() << ", "
+              << seconds << " s)" << (written ? "" : " FAILED") << std::endl;
+    return written;
+}
+
+// per-slot, per-level RMSE and maximum difference between two cache files
+int compareFiles(const std::string& pathA, const std::string& pathB)
+{
+    IBLCacheContents contentsA, contentsB;
+    if (!IBLCacheFile::read(pathA, 0, contentsA) || !IBLCacheFile::read(pathB, 0, contentsB))
+    {
+        std::cout << "Failed to read the cache files" << std::endl;
+        return 1;
+    }
+    const std::vector<IBLCacheTexture>& texturesA = contentsA.textures;
+    const std::vector<IBLCacheTexture>& texturesB = contentsB.textures;
+
+    const char* slotNames[] = { "environment", "irradiance", "prefilter", "brdfLUT" };
+    for (const IBLCacheTexture& a : texturesA)
+    {
+        const IBLCacheTexture* match = nullptr;
+        for (const IBLCacheTexture& b : texturesB)
+            if (b.slot == a.slot)
+                match = &b;
+        const char* name = a.slot < 4 ? slotNames[a.slot] : "unknown";
+        if (!match || match->width != a.width || match->faces != a.faces || match->format != a.format || match->type != GL_HALF_FLOAT ||
+            a.type != GL_HALF_FLOAT)
+        {
+            std::cout << name << ": not comparable" << std::endl;
+            continue;
+        }
+
+        uint32_t levels = std::min(a.levels, match->levels);
+        for (uint32_t level = 0; level < levels; ++level)
+        {
+            double squaredError = 0.0, maxError = 0.0;
+            size_t count = 0;
+            for (uint32_t face = 0; face < a.faces; ++face)
+            {
+                const std::vector<char>& imageA = a.images[level * a.faces + face];
+                const std::vector<char>& imageB = match->images[level * match->faces + face];
+                const uint16_t* halvesA = reinterpret_cast<const uint16_t*>(imageA.data());
+                const uint16_t* halvesB = reinterpret_cast<const uint16_t*>(imageB.data());
+                size_t halves = std::min(imageA.size(), imageB.size()) / 2;
+                for (size_t i = 0; i < halves; ++i)
+                {
+                    double difference = glm::unpackHalf1x16(halvesA[i]) - glm::unpackHalf1x16(halvesB[i]);
+                    squaredError += difference * difference;
+                    maxError = std::max(maxError, std::abs(difference));
+                }
+                count += halves;
+            }
+            std::cout << name << " level " << level << ": rmse " << std::sqrt(squaredError / std::max<size_t>(count, 1))
+                      << ", max " << maxError << std::endl;
+        }
+    }
+
+    if (contentsA.hasIrradianceSH && contentsB.hasIrradianceSH)
+    {
+        double maxError = 0.0;
+        for (int i = 0; i < 9; ++i)
+            for (int c = 0; c < 3; ++c)
+                maxError = std::max(maxError, static_cast<double>(std::abs(contentsA.irradianceSH[i][c] - contentsB.irradianceSH[i][c])));
+        std::cout << "irradiance SH: max coefficient difference " << maxError << std::endl;
+    }
+    else if (contentsA.hasIrradianceSH != contentsB.hasIrradianceSH)
+    {
+        std::cout << "irradiance SH: only in one file" << std::endl;
+    }
+    return 0;
+}
+
+// integrates the split-sum BRDF LUT and writes it as RG16F texel data in a C++ header
+int writeBRDFLUTHeader(const std::string& path)
+{
+    ThreadPool pool;
+    CpuIBLBaker baker(pool, IBLConfig());
+    std::vector<float> lut;
+    baker.integrateBRDF(BRDF_LUT_SIZE, lut);
+
+    std::ofstream file(path, std::ios::trunc);
+    if (!file)
+    {
+        std::cout << "Can't write " << path << std::endl;
+        return 1;
+    }
+    file << "#pragma once\n";
+    file << "// Split-sum BRDF integration LUT (scale, bias) as RG16F texels, NdotV along x and roughness along y.\n";
+    file << "// Generated by EVCBake --brdf-lut from the same integral as Shaders/2.2.2.brdf.fs, don't edit by hand.\n\n";
+    file << "const unsigned int BRDF_LUT_SIZE = " << BRDF_LUT_SIZE << ";\n";
+    file << "const unsigned short BRDF_LUT_DATA[" << lut.size() << "] =\n{\n";
+    file << std::hex << std::setfill('0');
+    for (size_t i = 0; i < lut.size(); ++i)
+    {
+        if (i % 16 == 0)
+            file << "    ";
+        file << "0x" << std::setw(4) << glm::packHalf1x16(lut[i]) << (i + 1 < lut.size() ? "," : "");
+        file << (i % 16 == 15 || i + 1 == lut.size() ? "\n" : " ");
+    }
+    file << "};\n";
+    std::cout << "BRDF LUT (" << std::dec << BRDF_LUT_SIZE << "x" << BRDF_LUT_SIZE << ") -> " << path << std::endl;
+    return file ? 0 : 1;
+}
+
+// compiles the images named on the command line (directories: every image in them) and the packings listed in
+// the output directory's TextureCompression::PACKINGS_FILE into <output directory>/<key>.ktx2, Cache/Textures by
+// default
+int compileTextures(int argc, char* argv[])
+{
+    std::vector<fs::path> inputs;
+    fs::path outputDirectory = TextureCompression::DIRECTORY;
+    unsigned int threads = 0;
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc)
+            outputDirectory = argv[++i];
+        else if (arg == "-j" && i + 1 < argc && parseThreads(argv[i + 1], threads))
+            ++i;
+        else if (!arg.empty() && arg[0] != '-')
+            inputs.push_back(arg);
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+
+    std::vector<fs::path> imageFiles;
+    std::error_code error;
+    for (const fs::path& input : inputs)
+    {
+        if (!fs::is_directory(input, error))
+        {
+            imageFiles.push_back(input);
+            continue;
+        }
+        std::vector<fs::path> found;
+        for (const fs::directory_entry& entry : fs::directory_iterator(input, error))
+        {
+            std::string extension = entry.path().extension().string();
+            for (char& c : extension)
+                c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            if (entry.is_regular_file() && (extension == ".png" || extension == ".jpg" || extension == ".jpeg" || extension == ".tga" ||
+                                            extension == ".bmp"))
+                found.push_back(entry.path());
+        }
+        std::sort(found.begin(), found.end());
+        imageFiles.insert(imageFiles.end(), found.begin(), found.end());
+    }
+    const std::vector<TextureCompression::Packing> packings = TextureCompression::readPackings(outputDirectory.generic_string());
+    if (imageFiles.empty() && packings.empty())
+    {
+        std::cout << "No images given and no packings listed in " << (outputDirectory / TextureCompression::PACKINGS_FILE).string() << std::endl;
+        printUsage();
+        return 1;
+    }
+    fs::create_directories(outputDirectory, error);
+
+    ThreadPool pool(threads);
+    std::cout << "Compiling " << imageFiles.size() << " texture(s) and " << packings.size() << " packing(s) on " << pool.size() << " thread(s)"
+              << std::endl;
+
+    int failures = 0;
+    for (const fs::path& imagePath : imageFiles)
+    {
+        if (!compileTexture(imagePath, outputDirectory, pool))
+            ++failures;
+    }
+    for (const TextureCompression::Packing& packing : packings)
+    {
+        // the list only grows; a source moved or deleted since the renderer listed it would otherwise fail every run
+        const std::string* missing = nullptr;
+        for (const std::string& path : packing.paths)
+            if (!missing && !path.empty() && !fs::exists(path, error))
+                missing = &path;
+        if (missing)
+        {
+            std::cout << "Skipping a listed packing, " << *missing << " no longer exists" << std::endl;
+            continue;
+        }
+        if (!compilePacking(packing, outputDirectory, pool))
+            ++failures;
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+// compresses one image and its mips into the file the renderer looks for
+bool compileTexture(const fs::path& imagePath, const fs::path& outputDirectory, ThreadPool& pool)
+{
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+
+    // the key is the hash of the file as the renderer reads it
+    std::vector<unsigned char> source;
+    int width = 0, height = 0, components = 0;
+    unsigned char* pixels =
+        readFile(imagePath, source) ? stbi_load_from_memory(source.data(), static_cast<int>(source.size()), &width, &height, &components, 4) : nullptr;
+    if (!pixels)
+    {
+        std::cout << "Failed to load image " << imagePath.string() << std::endl;
+        return false;
+    }
+    std::vector<uint8_t> rgba(pixels, pixels + static_cast<size_t>(width) * height * 4);
+    stbi_image_free(pixels);
+
+    TextureCompression::Kind kind = TextureCompression::classify(imagePath.filename().string(), rgba.data(), rgba.size() / 4);
+    KTX2Texture texture = TextureCompression::compile(std::move(rgba), width, height, kind, pool);
+    std::string outputPath = TextureCompression::compiledPath(outputDirectory.generic_string(), source.data(), source.size());
+    bool written = KTX2::write(outputPath, texture);
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << imagePath.string() << " -> " << outputPath << " (" << width << "x" << height << " " << KTX2::formatName(texture.vkFormat)
+              << ", " << texture.levels.size() << " levels, " << seconds << " s)" << (written ? "" : " FAILED") << std::endl;
+    return written;
+}
+
+// packs and compresses one ORM texture the renderer listed, under the key its TextureCache looks for
+bool compilePacking(const TextureCompression::Packing& packing, const fs::path& outputDirectory, ThreadPool& pool)
+{
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+
+    // the same sources (an image used for two channels is read once), keys and packing as TextureCache::getPacked
+    std::vector<unsigned char> files[3];
+    const std::vector<unsigned char>* sources[3] = {};
+    std::vector<unsigned char*> decoded;
+    const uint8_t* rgba[3] = {};
+    int widths[3] = {}, heights[3] = {};
+    std::string name;
+    for (int i = 0; i < 3; ++i)
+    {
+        name += (i ? " + " : "") + (packing.paths[i].empty() ? std::string("-") : packing.paths[i]);
+        if (packing.paths[i].empty())
+            continue;
+        for (int j = 0; j < i && !sources[i]; ++j)
+            if (sources[j] && packing.paths[j] == packing.paths[i])
+            {
+                sources[i] = sources[j];
+                rgba[i] = rgba[j];
+                widths[i] = widths[j];
+                heights[i] = heights[j];
+            }
+        if (sources[i])
+            continue;
+        int components = 0;
+        unsigned char* pixels = readFile(packing.paths[i], files[i])
+                                    ? stbi_load_from_memory(files[i].data(), static_cast<int>(files[i].size()), &widths[i], &heights[i], &components, 4)
+                                    : nullptr;
+        if (!pixels)
+        {
+            std::cout << "Failed to load image " << packing.paths[i] << std::endl;
+            for (unsigned char* image : decoded)
+                stbi_image_free(image);
+            return false;
+        }
+        decoded.push_back(pixels);
+        sources[i] = &files[i];
+        rgba[i] = pixels;
+    }
+
+    int width = 0, height = 0;
+    std::vector<uint8_t> packed = TextureCompression::pack(rgba, widths, heights, packing.channels, width, height);
+    for (unsigned char* image : decoded)
+        stbi_image_free(image);
+    if (width == 0)
+    {
+        std::cout << "Nothing to pack for " << name << std::endl;
+        return false;
+    }
+    KTX2Texture texture = TextureCompression::compile(std::move(packed), width, height, TextureCompression::Kind::Color, pool);
+    std::string outputPath = TextureCompression::packedPath(outputDirectory.generic_string(), sources, packing.channels);
+    bool written = KTX2::write(outputPath, texture);
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << name << " -> " << outputPath << " (" << width << "x" << height << " " << KTX2::formatName(texture.vkFormat) << ", "
+              << texture.levels.size() << " levels, " << seconds << " s)" << (written ? "" : " FAILED") << std::endl;
+    return written;
+}
+
+bool readFile(const fs::path& path, std::vector<unsigned char>& data)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        return false;
+    data.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    return static_cast<bool>(file);
+}
@@ -7,18 +7,44 @@
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
+// headers below include stb_image.h for its declarations only
+#undef STB_IMAGE_IMPLEMENTATION
 
 #include <Shader.h>
+#include <ComputeShader.h>
+#include <CubemapCapture.h>
+#include <GLExtensions.h>
 #include <Camera.h>
 #include <Model.h>
+#include <IBLCache.h>
+#include <ThreadPool.h>
+#include <SphericalHarmonics.h>
+#include <IBLSampling.h>
+#include <BRDFLUT.h>
+#include <IBLRebaker.h>
+#include <RadianceHDR.h>
+#include <OctahedralEncoder.h>
+#include <ReflectionProbes.h>
+#include <UploadContext.h>
 
 #include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <cstdlib>
 
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
-unsigned int loadTexture(const char* path);
+bool bakeIBL(const char* hdrPath, const IBLConfig& config, ThreadPool& pool, IBLMaps& maps);
+bool bakeIBLCompute(const char* hdrPath, const IBLConfig& config, ThreadPool& pool, IBLMaps& maps);
+bool bakeIBLPreferCompute(const char* hdrPath, const IBLConfig& config, ThreadPool& pool, IBLMaps& maps, bool compute);
+void benchmarkIBL(const char* hdrPath, bool rasterBake, bool irradianceSH);
+unsigned int loadHDRTexture(const char* path, ThreadPool& pool);
+void uploadIrradianceSH(unsigned int ubo, const IBLMaps& maps);
+void projectIrradianceSH(unsigned int envCubemap, int envSize, ThreadPool& pool, IBLMaps& maps);
 void processInput(GLFWwindow* window);
 void renderSphere();
 void renderCube();
@@ -27,6 +53,14 @@ void renderQuad();
 // settings
 const unsigned int SCR_WIDTH = 1280;
 const unsigned int SCR_HEIGHT = 720;
+// GPU time per frame an environment switch may spend re-baking
+const double IBL_REBAKE_BUDGET_MS = 2.0;
+// reflection probes placed with P get a box of this half extent around the camera
+const float PROBE_BOX_HALF_EXTENT = 6.0f;
+// distance over which a probe's reflections fade out towards the faces of its box
+const float PROBE_FADE_DISTANCE = 1.0f;
+// screen space error, in pixels, a model's level of detail may have (--lod-error overrides it)
+const float LOD_ERROR_PIXELS = 1.0f;
 
 //Camera
 Camera camera(glm::vec3(0.0f,0.0f,10.0f));
@@ -41,6 +75,62 @@ float lastFrame = 0.0f;
 int main(int argc, char* argv[])
 {
     //std::string exePath = std::string(argv[0]).substr(0, std::string(argv[0]).find_last_of('/'));
+    // --irradiance-cubemap keeps the convolved irradiance cubemap instead of the SH irradiance (for comparison),
+    // --raster-bake forces the fragment shader IBL bake even where compute shaders are available,
+    // --analytic-brdf replaces the BRDF LUT with an analytic fit (no brdfLUT sampler, for low-end targets),
+    // --ibl-quality low|medium|high|ultra picks the IBL resolutions and sample counts (IBLConfig, default high),
+    // --octahedral stores the IBL maps as octahedral 2D textures instead of cubemaps,
+    // --quantized-vertices stores the model's vertices in the 20 byte quantized layout (VertexLayout.h),
+    // --render-thread-uploads uploads textures and meshes on the render thread instead of the upload context's thread,
+    // --packed-orm binds occlusion, roughness and metallic as one packed texture instead of three (MaterialLayout),
+    //   packed from the sources on every launch until EVCBake --textures has compiled the listed packings to BC7,
+    // --uncompressed-textures decodes the source images even where EVCBake --textures compiled them (TextureCompression.h),
+    // --meshlets splits the model into meshlets and culls them against the view every frame (Meshlets.h),
+    // --lod-error <pixels> sets the screen space error the model's levels of detail may have (0 draws full detail),
+    // --benchmark-ibl bakes the environment at every quality tier, prints bake time and VRAM and exits
+    IBLQuality iblQuality = IBLQuality::High;
+    bool irradianceSH = true;
+    bool octahedral = false;
+    VertexFormat vertexFormat = VertexFormat::Float;
+    float lodErrorPixels = LOD_ERROR_PIXELS;
+    bool meshlets = false;
+    bool uploadThread = true;
+    bool compressedTextures = true;
+    MaterialLayout materialLayout = MaterialLayout::Separate;
+    bool rasterBake = false;
+    bool analyticBRDF = false;
+    bool benchmark = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--irradiance-cubemap")
+            irradianceSH = false;
+        else if (std::string(argv[i]) == "--raster-bake")
+            rasterBake = true;
+        else if (std::string(argv[i]) == "--analytic-brdf")
+            analyticBRDF = true;
+        else if (std::string(argv[i]) == "--octahedral")
+            octahedral = true;
+        else if (std::string(argv[i]) == "--quantized-vertices")
+            vertexFormat = VertexFormat::Quantized;
+        else if (std::string(argv[i]) == "--meshlets")
+            meshlets = true;
+        else if (std::string(argv[i]) == "--render-thread-uploads")
+            uploadThread = false;
+        else if (std::string(argv[i]) == "--packed-orm")
+            materialLayout = MaterialLayout::PackedORM;
+        else if (std::string(argv[i]) == "--uncompressed-textures")
+            compressedTextures = false;
+        else if (std::string(argv[i]) == "--lod-error" && i + 1 < argc)
+            lodErrorPixels = std::max(0.0f, static_cast<float>(std::atof(argv[++i])));
+        else if (std::string(argv[i]) == "--benchmark-ibl")
+            benchmark = true;
+        else if (std::string(argv[i]) == "--ibl-quality" && i + 1 < argc && !IBLConfig::parseQuality(argv[++i], iblQuality))
+            std::cout << "Unknown IBL quality " << argv[i] << ", using high" << std::endl;
+    }
+    IBLConfig iblConfig = IBLConfig::forQuality(iblQuality);
+    iblConfig.irradianceSH = irradianceSH;
+    iblConfig.octahedral = octahedral;
+    const char* hdrPath = "Resources/HDR/shanghai_bund_2k.hdr";
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -75,6 +165,7 @@ int main(int argc, char* argv[])
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    GLExtensions::load((GLADloadproc)glfwGetProcAddress);
 
     // configure global opengl state
     // -----------------------------
@@ -84,24 +175,37 @@ int main(int argc, char* argv[])
     // enable seamless cubemap sampling for lower mip levels in the pre-filter map.
     glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
-    Shader PBR("Shaders/2.2.2.pbr.vs", "Shaders/2.2.2.pbr.fs");
+    if (benchmark)
+    {
+        benchmarkIBL(hdrPath, rasterBake, irradianceSH);
+        glfwTerminate();
+        return 0;
+    }
+
+    std::string pbrDefines = iblConfig.shaderDefines();
+    if (iblConfig.irradianceSH)
+        pbrDefines += "#define IBL_DIFFUSE_SH\n";
+    if (analyticBRDF)
+        pbrDefines += "#define IBL_BRDF_ANALYTIC\n";
+    pbrDefines += ReflectionProbes::shaderDefines();
+    pbrDefines += Material::shaderDefines(materialLayout);
+    Shader PBR("Shaders/2.2.2.pbr.vs", "Shaders/2.2.2.pbr.fs", nullptr, pbrDefines);
     //Shader PBR("PBR.vert", "test.frag");
-    Shader ToCubemap("Shaders/2.2.2.cubemap.vs", "Shaders/2.2.2.equirectangular_to_cubemap.fs");
-    Shader Background("Shaders/2.2.2.background.vs", "Shaders/2.2.2.background.fs");
-    Shader irradianceShader("Shaders/2.2.2.cubemap.vs", "Shaders/2.2.2.irradiance_convolution.fs");
-    Shader prefilterShader("Shaders/2.2.2.cubemap.vs", "Shaders/prefilter.fs");
-    Shader BrdfShader("Shaders/2.2.2.brdf.vs", "Shaders/2.2.2.brdf.fs");
+    Shader Background("Shaders/2.2.2.background.vs", "Shaders/2.2.2.background.fs", nullptr, iblConfig.shaderDefines());
 
     PBR.use();
     PBR.setInt("irradianceMap", 0);
     PBR.setInt("prefilterMap", 1);
     PBR.setInt("brdfLUT", 2);
-    PBR.setInt("albedoMap", 3);
-    PBR.setInt("metallicMap",4);
-    PBR.setInt("roughnessMap",5);
-    PBR.setInt("normalMap", 6);
+    // the model's materials bind their maps to units 3-7, 3-5 with the packed ORM texture (Material::bind)
+    Material::setSamplers(PBR, materialLayout);
     //PBR.setFloat("ao", 1.0f);
-    PBR.setInt("AOMap", 7);
+    // probes: the cube map array atlas, or the two selected probes' cubemaps without one
+    PBR.setInt("reflectionProbeAtlas", 8);
+    PBR.setInt("reflectionProbeMaps[0]", 8);
+    PBR.setInt("reflectionProbeMaps[1]", 9);
+    glUniformBlockBinding(PBR.ID, glGetUniformBlockIndex(PBR.ID, "ReflectionProbeData"), ReflectionProbes::DATA_BINDING);
+    PBR.setFloat("reflectionProbeFade", PROBE_FADE_DISTANCE);
 
     Background.use();
     Background.setInt("environmentMap", 0);
@@ -112,12 +216,19 @@ int main(int argc, char* argv[])
     //unsigned int roughnessMap = loadTexture((exePath + "\\model\\gun\\Textures\\Cerberus_R.tga").c_str());
     //unsigned int normalMap = loadTexture((exePath + "\\model\\gun\\Textures\\Cerberus_N.tga").c_str());
 
-    Model DamagedHelmet("Resources/PBR/DamagedHelmet/DamagedHelmet.gltf");
-    unsigned int albedoMap = loadTexture("Resources/PBR/DamagedHelmet/Default_albedo.jpg");
-    unsigned int metallicMap = loadTexture("Resources/PBR/DamagedHelmet/Default_emissive.jpg");
-    unsigned int roughnessMap = loadTexture("Resources/PBR/DamagedHelmet/Default_metalRoughness.jpg");
-    unsigned int normalMap = loadTexture("Resources/PBR/DamagedHelmet/Default_normal.jpg");
-    unsigned int AOMap = loadTexture("Resources/PBR/DamagedHelmet/Default_AO.jpg");
+    ThreadPool threadPool;
+    // textures and mesh data are uploaded by a second, shared context on its own thread and published with fences
+    UploadContext uploadContext(uploadThread ? window : nullptr);
+    if (uploadContext.valid())
+    {
+        GeometryArena::shared().setUploadContext(&uploadContext);
+        TextureCache::shared().setUploadContext(&uploadContext);
+    }
+    if (!compressedTextures)
+        TextureCache::shared().setCompiledDirectory("");
+    // the model's textures come with its materials, from the TextureCache: they decode on the pool while the IBL
+    // maps are loaded and show up in the frame after they finish (placeholders until then)
+    Model DamagedHelmet("Resources/PBR/DamagedHelmet/DamagedHelmet.gltf", threadPool, false, vertexFormat, meshlets, materialLayout);
     // lights
     // ------
     glm::vec3 lightPositions[] = {
@@ -136,263 +247,76 @@ int main(int argc, char* argv[])
     int nrColumns = 7;
     float spacing = 2.5;
 
-    // pbr: setup framebuffer
-    // ----------------------
-    unsigned int captureFbo;
-    unsigned int captureRbo;
-    glGenFramebuffers(1, &captureFbo);
-    glGenRenderbuffers(1, &captureRbo);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFbo);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRbo);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRbo);
-
-    // pbr: load the HDR environment map
-    // ---------------------------------
-    stbi_set_flip_vertically_on_load(true);
-    int width, height, nrComponents;
-    float* data = stbi_loadf("Resources/HDR/shanghai_bund_2k.hdr", &width, &height, &nrComponents, 0);
-    unsigned int hdrTexture;
-    if (data)
+    // pbr: restore the baked IBL maps from the on-disk cache, or bake them and fill the cache
+    // ---------------------------------------------------------------------------------------
+    IBLCache iblCache("Cache/IBL");
+    // everything the bake output depends on: source image, bake shaders and the resolutions/sample counts
+    uint64_t iblKey = IBLCache::computeKey(hdrPath, iblConfig);
+    IBLMaps ibl;
+    if (iblCache.load(iblKey, ibl))
     {
-        glGenTextures(1, &hdrTexture);
-        glBindTexture(GL_TEXTURE_2D, hdrTexture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, data); // note how we specify the texture's data value to be float
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
+        std::cout << "IBL: loaded baked maps from " << iblCache.pathFor(iblKey) << std::endl;
     }
     else
     {
-        std::cout << "Failed to load HDR image." << std::endl;
+        bool baked = bakeIBLPreferCompute(hdrPath, iblConfig, threadPool, ibl, !rasterBake);
+        // the bakes work in cubemaps, the octahedral layout is a final conversion
+        if (iblConfig.octahedral)
+            OctahedralEncoder().convert(ibl, iblConfig);
+        // only cache a successful bake, a missing HDR would otherwise be remembered as a black environment
+        if (baked)
+            iblCache.save(iblKey, ibl);
     }
 
-    // pbr: setup cubemap to render to and attach to framebuffer
-    // ---------------------------------------------------------
-    unsigned int envCubemap;
-    glGenTextures(1, &envCubemap);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 512, 512, 0, GL_RGB, GL_FLOAT, nullptr);
-    }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    // pbr: set up projection and view matrices for capturing data onto the 6 cubemap face directions
-    // ----------------------------------------------------------------------------------------------
-    glm::mat4 captureProjection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 10.0f);
-    glm::mat4 captureViews[] =
-    {
-        glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
-        glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
-        glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f,  1.0f,  0.0f), glm::vec3(0.0f,  0.0f,  1.0f)),
-        glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f,  0.0f), glm::vec3(0.0f,  0.0f, -1.0f)),
-        glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f,  0.0f,  1.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
-        glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f,  0.0f, -1.0f), glm::vec3(0.0f, -1.0f,  0.0f))
-    };
-
-    ToCubemap.use();
-    ToCubemap.setInt("equirectangularMap", 0);
-    ToCubemap.setMat4("projection", captureProjection);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, hdrTexture);
-    glViewport(0, 0, 512, 512); // don't forget to configure the viewport to the capture dimensions.
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFbo);
-
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        ToCubemap.setMat4("view", captureViews[i]);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, envCubemap, 0);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        renderCube();
-    }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    // then let OpenGL generate mipmaps from first mip face (combatting visible dots artifact)
-    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
-    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-
-
-    unsigned int irradianceMap;
-    glGenTextures(1, &irradianceMap);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 32, 32, 0, GL_RGB, GL_FLOAT, nullptr);
-    }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFbo);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRbo);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 32, 32);
-    // pbr: solve diffuse integral by convolution to create an irradiance (cube)map.
-    // -----------------------------------------------------------------------------
-    irradianceShader.use();
-    irradianceShader.setInt("environmentMap", 0);
-    irradianceShader.setMat4("projection", captureProjection);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
-
-    glViewport(0, 0, 32, 32); // don't forget to configure the viewport to the capture dimensions.
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFbo);
-
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        irradianceShader.setMat4("view", captureViews[i]);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, irradianceMap, 0);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        renderCube();
-    }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    // pbr: create a pre-filter cubemap, and re-scale capture FBO to pre-filter scale.
-    // --------------------------------------------------------------------------------
-    unsigned int prefilterMap;
-    glGenTextures(1, &prefilterMap);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 128, 128, 0, GL_RGB, GL_FLOAT, nullptr);
-    }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); // be sure to set minification filter to mip_linear 
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // generate mipmaps for the cubemap so OpenGL automatically allocates the required memory.
-    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-
-    // pbr: run a quasi monte-carlo simulation on the environment lighting to create a prefilter (cube)map.
-    // ----------------------------------------------------------------------------------------------------
-    prefilterShader.use();
-    prefilterShader.setInt("environmentMap", 0);
-    prefilterShader.setMat4("projection", captureProjection);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
-
-
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFbo);
-    unsigned int maxMipLevels = 5;
-    for (unsigned int mip = 0; mip < maxMipLevels; ++mip)
+    // pbr: environments to cycle through with N, re-baked a few faces per frame while the old one keeps rendering
+    // -------------------------------------------------------------------------------------------------------------
+    IBLRebaker iblRebaker(threadPool, iblConfig, iblCache, renderCube);
+    iblRebaker.setCurrent(ibl);
+    std::vector<std::string> environments;
+    std::error_code directoryError;
+    for (const auto& entry : std::filesystem::directory_iterator("Resources/HDR", directoryError))
+        if (entry.path().extension() == ".hdr")
+            environments.push_back(entry.path().generic_string());
+    std::sort(environments.begin(), environments.end());
+    size_t environmentIndex = std::find(environments.begin(), environments.end(), hdrPath) - environments.begin();
+    bool nextEnvironmentHeld = false;
+    // the BRDF LUT is the same for every environment and ships precomputed
+    unsigned int brdfLUTTexture = analyticBRDF ? 0 : BRDFLUT::createTexture();
+
+    // pbr: upload the SH irradiance into the IrradianceSH uniform block (binding point 0)
+    // -----------------------------------------------------------------------------------
+    unsigned int irradianceSHUbo = 0;
+    if (iblConfig.irradianceSH)
     {
-        // reisze framebuffer according to mip-level size.
-        unsigned int mipWidth = static_cast<unsigned int>(128 * std::pow(0.5, mip));
-        unsigned int mipHeight = static_cast<unsigned int>(128 * std::pow(0.5, mip));
-        glBindRenderbuffer(GL_RENDERBUFFER, captureRbo);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, mipWidth, mipHeight);
-        glViewport(0, 0, mipWidth, mipHeight);
-
-        float roughness = (float)mip / (float)(maxMipLevels - 1);
-        prefilterShader.setFloat("roughness", roughness);
-        for (unsigned int i = 0; i < 6; ++i)
-        {
-            prefilterShader.setMat4("view", captureViews[i]);
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, prefilterMap, mip);
-
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            renderCube();
-        }
+        glGenBuffers(1, &irradianceSHUbo);
+        uploadIrradianceSH(irradianceSHUbo, ibl);
+        glBindBufferBase(GL_UNIFORM_BUFFER, 0, irradianceSHUbo);
+        glUniformBlockBinding(PBR.ID, glGetUniformBlockIndex(PBR.ID, "IrradianceSH"), 0);
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    // pbr: generate a 2D LUT from the BRDF equations used.
-    // ----------------------------------------------------
-    unsigned int brdfLUTTexture;
-    glGenTextures(1, &brdfLUTTexture);
 
-    // pre-allocate enough memory for the LUT texture.
-    glBindTexture(GL_TEXTURE_2D, brdfLUTTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, 512, 512, 0, GL_RG, GL_FLOAT, 0);
-    // be sure to set wrapping mode to GL_CLAMP_TO_EDGE
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    // then re-configure capture framebuffer object and render screen-space quad with BRDF shader.
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFbo);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRbo);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, brdfLUTTexture, 0);
-
-    glViewport(0, 0, 512, 512);
-    BrdfShader.use();
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    renderQuad();
-
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-
-
-    // initialize static shader uniforms before rendering
-    // --------------------------------------------------
-    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    PBR.use();
-    PBR.setMat4("projection", projection);
-    Background.use();
-    Background.setMat4("projection", projection);
-    // then before rendering, configure the viewport to the original framebuffer's screen dimensions
-    int scrWidth, scrHeight;
-    glfwGetFramebufferSize(window, &scrWidth, &scrHeight);
-    glViewport(0, 0, scrWidth, scrHeight);
-
-
-
-    // render loop
-    // -----------
-    while (!glfwWindowShouldClose(window))
+    // the scene, drawn by the main pass and by reflection probe captures. probes is null for a capture, which
+    // renders linear HDR without any probes of its own. viewportHeight picks the models' levels of detail.
+    // ----------------------------------------------------------------------------------------------------------
+    auto renderScene = [&](const glm::mat4& view, const glm::mat4& projection, const glm::vec3& eye, float viewportHeight, const ReflectionProbes* probes)
     {
-        // per-frame time logic
-        // --------------------
-        float currentFrame = static_cast<float>(glfwGetTime());
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
-
-        // input
-        // -----
-        processInput(window);
-
-        // render
-        // ------
-        glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        const IBLMaps& environment = iblRebaker.current();
+        const GLenum environmentTarget = environment.octahedral ? GL_TEXTURE_2D : GL_TEXTURE_CUBE_MAP;
 
         PBR.use();
-        glm::mat4 view = camera.GetViewMatrix();
+        PBR.setMat4("projection", projection);
         PBR.setMat4("view", view);
-        PBR.setVec3("camPos", camera.Position);
+        PBR.setVec3("camPos", eye);
+        PBR.setBool("linearOutput", probes == nullptr);
+        PBR.setInt("reflectionProbeCount", 0);
         // bind pre-computed IBL data
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
+        glBindTexture(environmentTarget, environment.irradianceMap);
         glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
+        glBindTexture(environmentTarget, environment.prefilterMap);
         glActiveTexture(GL_TEXTURE2);
         glBindTexture(GL_TEXTURE_2D, brdfLUTTexture);
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, albedoMap);
-        glActiveTexture(GL_TEXTURE4);
-        glBindTexture(GL_TEXTURE_2D, metallicMap);
-        glActiveTexture(GL_TEXTURE5);
-        glBindTexture(GL_TEXTURE_2D, roughnessMap);
-        glActiveTexture(GL_TEXTURE6);
-        glBindTexture(GL_TEXTURE_2D, normalMap);
-        glActiveTexture(GL_TEXTURE7);
-        glBindTexture(GL_TEXTURE_2D, AOMap);
+        if (probes)
+            probes->bindPass(8);
         
         glm::mat4 model = glm::mat4(1.0f);
         /*
@@ -419,9 +343,15 @@ int main(int argc, char* argv[])
         model = glm::scale(model, glm::vec3(2.0f));
         model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
         PBR.setMat4("model", model);
-        DamagedHelmet.Draw(PBR);
-
-        // render light source (simply re-render sphere at light positions)
+        if (probes)
+            probes->select(PBR, glm::vec3(model[3]), 8);
+        // glTF materials are single sided unless marked doubleSided, so the model's back faces are culled (the background
+        // cube is seen from inside and stays unculled)
+        glEnable(GL_CULL_FACE);
+        DamagedHelmet.Draw(PBR, model, DrawView(eye, view, projection, viewportHeight, lodErrorPixels, meshlets));
+        glDisable(GL_CULL_FACE);
+
+        // render light source (simply re-render sphere at light positions), with the model's last material
         // this looks a bit off as we use the same shader, but it'll make their positions obvious and 
         // keeps the codeprint small.
         for (unsigned int i = 0; i < sizeof(lightPositions) / sizeof(lightPositions[0]); ++i)
@@ -435,19 +365,92 @@ int main(int argc, char* argv[])
             model = glm::translate(model, newPos);
             model = glm::scale(model, glm::vec3(0.5f));
             PBR.setMat4("model", model);
+            if (probes)
+                probes->select(PBR, newPos, 8);
             renderSphere();
         }
         Background.use();
+        Background.setMat4("projection", projection);
         Background.setMat4("view", view);
+        Background.setBool("linearOutput", probes == nullptr);
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+        glBindTexture(environmentTarget, environment.envCubemap);
         renderCube();
+    };
+
+    // pbr: local reflection probes, placed at the camera with P and refreshed one cubemap face per frame
+    // ---------------------------------------------------------------------------------------------------
+    ReflectionProbes reflectionProbes(iblConfig, renderCube, [&](const glm::mat4& view, const glm::mat4& projection, const glm::vec3& position)
+    {
+        renderScene(view, projection, position, static_cast<float>(iblConfig.prefilterSize), nullptr);
+    });
+    bool placeProbeHeld = false;
+
+    // then before rendering, configure the viewport to the original framebuffer's screen dimensions
+    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+    int scrWidth, scrHeight;
+    glfwGetFramebufferSize(window, &scrWidth, &scrHeight);
+    glViewport(0, 0, scrWidth, scrHeight);
+
+
+
+    // render loop
+    // -----------
+    while (!glfwWindowShouldClose(window))
+    {
+        // per-frame time logic
+        // --------------------
+        float currentFrame = static_cast<float>(glfwGetTime());
+        deltaTime = currentFrame - lastFrame;
+        lastFrame = currentFrame;
+
+        // input
+        // -----
+        processInput(window);
+        bool nextEnvironmentPressed = glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS;
+        if (nextEnvironmentPressed && !nextEnvironmentHeld && !environments.empty())
+        {
+            environmentIndex = (environmentIndex + 1) % environments.size();
+            iblRebaker.queue(environments[environmentIndex]);
+        }
+        nextEnvironmentHeld = nextEnvironmentPressed;
+        bool placeProbePressed = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+        if (placeProbePressed && !placeProbeHeld)
+        {
+            const glm::vec3 halfExtent(PROBE_BOX_HALF_EXTENT);
+            if (reflectionProbes.add(camera.Position, camera.Position - halfExtent, camera.Position + halfExtent))
+                std::cout << "Reflection probe " << reflectionProbes.count() << " placed at (" << camera.Position.x << ", "
+                          << camera.Position.y << ", " << camera.Position.z << ")" << std::endl;
+        }
+        placeProbeHeld = placeProbePressed;
+
+        // advance an environment switch; the SH block follows the maps on the frame they are swapped in
+        if (iblRebaker.update(IBL_REBAKE_BUDGET_MS) && irradianceSHUbo)
+            uploadIrradianceSH(irradianceSHUbo, iblRebaker.current());
+        // one face of one probe per frame
+        reflectionProbes.update();
+        // upload the textures decoded since the last frame, and publish what the upload thread has finished
+        TextureCache::shared().update();
+        uploadContext.update();
+
+        // render
+        // ------
+        glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        renderScene(camera.GetViewMatrix(), projection, camera.Position, static_cast<float>(scrHeight), &reflectionProbes);
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
+    reflectionProbes.release();
+    iblRebaker.release();
+    GeometryArena::shared().release();
+    TextureCache::shared().release();
+    uploadContext.release();
+
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
@@ -511,42 +514,426 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     camera.ProcessMouseScroll(static_cast<float>(yoffset));
 }
 
+// bakes the environment dependent IBL products from an equirectangular HDR image: environment cubemap,
+// irradiance map (or SH irradiance) and pre-filtered specular map. Returns false if the HDR image couldn't be loaded.
+// -----------------------------------------------------------------------------------------------------------
+bool bakeIBL(const char* hdrPath, const IBLConfig& config, ThreadPool& pool, IBLMaps& maps)
+{
+    // every capture draws the cube once and the geometry shader routes it to all six faces
+    Shader ToCubemap("Shaders/2.2.2.cubemap.vs", "Shaders/2.2.2.equirectangular_to_cubemap.fs", CubemapCapture::GEOMETRY_SHADER);
+    Shader irradianceShader("Shaders/2.2.2.cubemap.vs", "Shaders/2.2.2.irradiance_convolution.fs", CubemapCapture::GEOMETRY_SHADER);
+    Shader prefilterShader("Shaders/2.2.2.cubemap.vs", "Shaders/prefilter.fs", CubemapCapture::GEOMETRY_SHADER, config.shaderDefines());
+
+    // pbr: setup the layered capture framebuffer
+    // ------------------------------------------
+    CubemapCapture capture;
+
+    // pbr: load the HDR environment map
+    // ---------------------------------
+    unsigned int hdrTexture = loadHDRTexture(hdrPath, pool);
+    bool loaded = hdrTexture != 0;
+
+    // pbr: setup cubemap to render to and attach to framebuffer
+    // ---------------------------------------------------------
+    unsigned int envCubemap;
+    glGenTextures(1, &envCubemap);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+    for (unsigned int i = 0; i < 6; ++i)
+    {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, config.environmentSize, config.environmentSize, 0, GL_RGB, GL_FLOAT, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // pbr: set up the face projection and view matrices for capturing data onto the 6 cubemap face directions
+    // -------------------------------------------------------------------------------------------------------
+    CubemapCapture::prepare(ToCubemap);
+    CubemapCapture::prepare(irradianceShader);
+    CubemapCapture::prepare(prefilterShader);
+
+    ToCubemap.use();
+    ToCubemap.setInt("equirectangularMap", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, hdrTexture);
+    if (capture.begin(envCubemap, 0, config.environmentSize))
+        renderCube();
+    capture.end();
+
+    // then let OpenGL generate mipmaps from first mip face (combatting visible dots artifact)
+    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    // the pre-filter picks a source mip per sample, which only works with a mipmapped minification filter
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+    unsigned int irradianceMap = 0;
+    if (config.irradianceSH)
+    {
+        // pbr: project the environment onto 9 SH coefficients on the CPU instead of convolving a cubemap.
+        // -----------------------------------------------------------------------------------------------
+        projectIrradianceSH(envCubemap, config.environmentSize, pool, maps);
+    }
+    else
+    {
+        glGenTextures(1, &irradianceMap);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
+        for (unsigned int i = 0; i < 6; ++i)
+        {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, config.irradianceSize, config.irradianceSize, 0, GL_RGB, GL_FLOAT, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        // pbr: solve diffuse integral by convolution to create an irradiance (cube)map.
+        // -----------------------------------------------------------------------------
+        irradianceShader.use();
+        irradianceShader.setInt("environmentMap", 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+        if (capture.begin(irradianceMap, 0, config.irradianceSize))
+            renderCube();
+        capture.end();
+    }
+
+    // pbr: create a pre-filter cubemap.
+    // --------------------------------------------------------------------------------
+    unsigned int prefilterMap;
+    glGenTextures(1, &prefilterMap);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
+    for (unsigned int i = 0; i < 6; ++i)
+    {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, config.prefilterSize, config.prefilterSize, 0, GL_RGB, GL_FLOAT, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); // be sure to set minification filter to mip_linear 
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // generate mipmaps for the cubemap so OpenGL automatically allocates the required memory.
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, config.prefilterMipLevels - 1);
+
+    // pbr: run a quasi monte-carlo simulation on the environment lighting to create a prefilter (cube)map.
+    // ----------------------------------------------------------------------------------------------------
+    // the importance samples only depend on roughness, so they are generated once per mip on the CPU and
+    // handed to the shader through a uniform buffer
+    unsigned int prefilterSamplesUbo;
+    glGenBuffers(1, &prefilterSamplesUbo);
+    glBindBuffer(GL_UNIFORM_BUFFER, prefilterSamplesUbo);
+    glBufferData(GL_UNIFORM_BUFFER, IBLSampling::MAX_PREFILTER_SAMPLES * sizeof(glm::vec4), nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 1, prefilterSamplesUbo);
+
+    prefilterShader.use();
+    prefilterShader.setInt("environmentMap", 0);
+    glUniformBlockBinding(prefilterShader.ID, glGetUniformBlockIndex(prefilterShader.ID, "PrefilterSamples"), 1);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+
+    unsigned int maxMipLevels = config.prefilterMipLevels;
+    for (unsigned int mip = 0; mip < maxMipLevels; ++mip)
+    {
+        unsigned int mipSize = std::max(1u, config.prefilterSize >> mip);
+
+        float roughness = (float)mip / (float)(maxMipLevels - 1);
+        std::vector<glm::vec4> samples = IBLSampling::prefilterSamples(roughness, IBLSampling::prefilterSampleCount(mip, config.sampleCount), config.environmentSize);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, samples.size() * sizeof(glm::vec4), samples.data());
+        prefilterShader.setInt("sampleCount", static_cast<int>(samples.size()));
+        if (capture.begin(prefilterMap, mip, mipSize))
+            renderCube();
+    }
+    capture.end();
+
+    // the equirectangular source and the sample buffer are only needed during the bake
+    glDeleteTextures(1, &hdrTexture);
+    glDeleteBuffers(1, &prefilterSamplesUbo);
+
+    maps.envCubemap = envCubemap;
+    maps.irradianceMap = irradianceMap;
+    maps.prefilterMap = prefilterMap;
+    return loaded;
+}
+
 
-unsigned int loadTexture(const char* path)
+// writes the SH irradiance of maps into the IrradianceSH uniform block
+// -------------------------------------------------------------------
+void uploadIrradianceSH(unsigned int ubo, const IBLMaps& maps)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    glm::vec4 shConstants[9];
+    SphericalHarmonics::shaderConstants(maps.irradianceSH, shConstants);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(shConstants), shConstants, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
 
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
+// loads an equirectangular .hdr image into a half float texture, returns 0 if it couldn't be loaded.
+// The image is decoded on the thread pool straight into a mapped pixel buffer, so neither a float copy of it
+// nor a driver-side float -> half conversion is involved.
+// -------------------------------------------------------------------------------------------------------------
+unsigned int loadHDRTexture(const char* path, ThreadPool& pool)
+{
+    RadianceHDR hdr;
+    if (!hdr.open(path))
     {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        std::cout << "Failed to load HDR image." << std::endl;
+        return 0;
+    }
+
+    const size_t bytes = hdr.valueCount() * sizeof(uint16_t);
+    unsigned int pixelBuffer;
+    glGenBuffers(1, &pixelBuffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    bool decoded = mapped && hdr.decode(pool, static_cast<uint16_t*>(mapped), true);
+    // the buffer contents are undefined if it got corrupted while mapped (e.g. a mode switch), treat that as failure
+    if (mapped && !glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+        decoded = false;
+
+    unsigned int hdrTexture = 0;
+    if (decoded)
+    {
+        glGenTextures(1, &hdrTexture);
+        glBindTexture(GL_TEXTURE_2D, hdrTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 2); // rows of 6-byte texels
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, hdr.width(), hdr.height(), 0, GL_RGB, GL_HALF_FLOAT, nullptr); // sourced from the bound pixel buffer
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    else
+    {
+        std::cout << "Failed to upload HDR image." << std::endl;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &pixelBuffer);
+    return hdrTexture;
+}
+
 
-        stbi_image_free(data);
+// reads back a small mip of the (mipmapped) environment cubemap and projects it onto the SH irradiance
+// ---------------------------------------------------------------------------------------------------
+void projectIrradianceSH(unsigned int envCubemap, int envSize, ThreadPool& pool, IBLMaps& maps)
+{
+    int shLevel = 0;
+    while ((envSize >> shLevel) > SphericalHarmonics::SOURCE_SIZE)
+        ++shLevel;
+    const int shSize = envSize >> shLevel;
+    std::vector<float> shFaces[6];
+    const float* shFacePointers[6];
+    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+    for (unsigned int i = 0; i < 6; ++i)
+    {
+        shFaces[i].resize(static_cast<size_t>(shSize) * shSize * 3);
+        glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, shLevel, GL_RGB, GL_FLOAT, shFaces[i].data());
+        shFacePointers[i] = shFaces[i].data();
+    }
+    SphericalHarmonics::project(pool, shFacePointers, shSize, maps.irradianceSH);
+    SphericalHarmonics::irradiance(maps.irradianceSH);
+    maps.hasIrradianceSH = true;
+}
+
+
+// compute shader version of bakeIBL (GL 4.3): every stage writes all six faces of a cubemap level through a
+// layered image binding in a single dispatch, so there is no framebuffer or renderbuffer involved at all.
+// The cubemaps are RGBA16F because image load/store has no three-component formats.
+// -----------------------------------------------------------------------------------------------------------
+bool bakeIBLCompute(const char* hdrPath, const IBLConfig& config, ThreadPool& pool, IBLMaps& maps)
+{
+    ComputeShader toCubemapShader("Shaders/ibl_equirectangular_to_cubemap.comp");
+    ComputeShader downsampleShader("Shaders/ibl_downsample.comp");
+    ComputeShader prefilterShader("Shaders/ibl_prefilter.comp", config.shaderDefines());
+    // leave maps untouched so the caller can fall back to bakeIBL, a failed bake must never reach the cache
+    if (!toCubemapShader.valid || !downsampleShader.valid || !prefilterShader.valid)
+        return false;
+
+    unsigned int hdrTexture = loadHDRTexture(hdrPath, pool);
+    bool loaded = hdrTexture != 0;
+
+    // environment cubemap with its full mip chain in immutable storage
+    const int envSize = config.environmentSize;
+    int envLevels = 1;
+    while ((envSize >> envLevels) > 0)
+        ++envLevels;
+    unsigned int envCubemap;
+    glGenTextures(1, &envCubemap);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, envLevels, GL_RGBA16F, envSize, envSize);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // pbr: equirectangular -> cubemap, all faces in one dispatch
+    // ----------------------------------------------------------
+    toCubemapShader.use();
+    toCubemapShader.setInt("equirectangularMap", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, hdrTexture);
+    glBindImageTexture(0, envCubemap, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    toCubemapShader.dispatch(envSize, envSize, 6);
+
+    // pbr: mip chain, one dispatch per level reading the level above
+    // ---------------------------------------------------------------
+    downsampleShader.use();
+    downsampleShader.setInt("sourceMap", 0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+    for (int level = 1; level < envLevels; ++level)
+    {
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        downsampleShader.setFloat("sourceLevel", static_cast<float>(level - 1));
+        glBindImageTexture(0, envCubemap, level, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        const unsigned int levelSize = std::max(1, envSize >> level);
+        downsampleShader.dispatch(levelSize, levelSize, 6);
+    }
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+    // pbr: diffuse irradiance, as SH or as a convolved cubemap
+    // --------------------------------------------------------
+    unsigned int irradianceMap = 0;
+    if (config.irradianceSH)
+    {
+        projectIrradianceSH(envCubemap, envSize, pool, maps);
     }
     else
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        ComputeShader irradianceShader("Shaders/ibl_irradiance.comp");
+        if (!irradianceShader.valid)
+        {
+            glDeleteTextures(1, &hdrTexture);
+            glDeleteTextures(1, &envCubemap);
+            return false;
+        }
+        glGenTextures(1, &irradianceMap);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
+        glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_RGBA16F, config.irradianceSize, config.irradianceSize);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        irradianceShader.use();
+        irradianceShader.setInt("environmentMap", 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+        glBindImageTexture(0, irradianceMap, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        irradianceShader.dispatch(config.irradianceSize, config.irradianceSize, 6);
+    }
+
+    // pbr: pre-filter, one dispatch per roughness mip with the samples from IBLSampling
+    // ----------------------------------------------------------------------------------
+    const unsigned int maxMipLevels = config.prefilterMipLevels;
+    unsigned int prefilterMap;
+    glGenTextures(1, &prefilterMap);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, maxMipLevels, GL_RGBA16F, config.prefilterSize, config.prefilterSize);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    unsigned int prefilterSamplesUbo;
+    glGenBuffers(1, &prefilterSamplesUbo);
+    glBindBuffer(GL_UNIFORM_BUFFER, prefilterSamplesUbo);
+    glBufferData(GL_UNIFORM_BUFFER, IBLSampling::MAX_PREFILTER_SAMPLES * sizeof(glm::vec4), nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 1, prefilterSamplesUbo);
+
+    prefilterShader.use();
+    prefilterShader.setInt("environmentMap", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+    for (unsigned int mip = 0; mip < maxMipLevels; ++mip)
+    {
+        float roughness = (float)mip / (float)(maxMipLevels - 1);
+        std::vector<glm::vec4> samples = IBLSampling::prefilterSamples(roughness, IBLSampling::prefilterSampleCount(mip, config.sampleCount), envSize);
+        // the previous dispatch still reads the buffer; glBufferSubData is ordered after it by the driver
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, samples.size() * sizeof(glm::vec4), samples.data());
+        prefilterShader.setInt("sampleCount", static_cast<int>(samples.size()));
+        glBindImageTexture(0, prefilterMap, mip, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        const unsigned int mipSize = std::max(1u, config.prefilterSize >> mip);
+        prefilterShader.dispatch(mipSize, mipSize, 6);
     }
+    // everything below samples or reads back the images written above
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+    glDeleteTextures(1, &hdrTexture);
+    glDeleteBuffers(1, &prefilterSamplesUbo);
 
-    return textureID;
+    maps.envCubemap = envCubemap;
+    maps.irradianceMap = irradianceMap;
+    maps.prefilterMap = prefilterMap;
+    return loaded;
+}
+
+
+// bakeIBLCompute when compute is asked for and the context has it, bakeIBL otherwise or when the compute shaders
+// didn't build (bakeIBLCompute then returns false without creating any maps)
+// ---------------------------------------------------------------------------------------------------------
+bool bakeIBLPreferCompute(const char* hdrPath, const IBLConfig& config, ThreadPool& pool, IBLMaps& maps, bool compute)
+{
+    if (compute && GLExtensions::computeShaders)
+    {
+        if (bakeIBLCompute(hdrPath, config, pool, maps))
+            return true;
+        // a missing HDR still produced (black) maps, there is nothing the raster bake would do better
+        if (maps.envCubemap)
+            return false;
+        std::cout << "IBL: compute bake unavailable, falling back to the raster bake" << std::endl;
+    }
+    return bakeIBL(hdrPath, config, pool, maps);
+}
+
+// bakes hdrPath at every quality tier, bypassing the cache, and reports the bake time and the VRAM of the maps.
+// The first bake is a warm-up so the file cache and shader compilation don't count against the low tier.
+// ---------------------------------------------------------------------------------------------------------
+void benchmarkIBL(const char* hdrPath, bool rasterBake, bool irradianceSH)
+{
+    ThreadPool pool;
+    const bool compute = GLExtensions::computeShaders && !rasterBake;
+    auto bake = [&](const IBLConfig& config, IBLMaps& maps)
+    {
+        return bakeIBLPreferCompute(hdrPath, config, pool, maps, compute);
+    };
+
+    IBLConfig warmUpConfig = IBLConfig::forQuality(IBLQuality::Low);
+    warmUpConfig.irradianceSH = irradianceSH;
+    IBLMaps warmUp;
+    bool loaded = bake(warmUpConfig, warmUp);
+    IBLCache::release(warmUp);
+    if (!loaded)
+        return;
+
+    std::cout << "IBL benchmark: " << hdrPath << ", " << (compute ? "compute" : "raster") << " bake, "
+              << (irradianceSH ? "SH" : "cubemap") << " irradiance" << std::endl;
+    std::cout << "tier      env  prefilter  mips  samples    bake ms   VRAM MB" << std::endl;
+    for (IBLQuality quality : { IBLQuality::Low, IBLQuality::Medium, IBLQuality::High, IBLQuality::Ultra })
+    {
+        IBLConfig config = IBLConfig::forQuality(quality);
+        config.irradianceSH = irradianceSH;
+        IBLMaps maps;
+        glFinish();
+        auto start = std::chrono::steady_clock::now();
+        bake(config, maps);
+        glFinish();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        IBLCache::release(maps);
+
+        std::cout << std::left << std::setw(8) << IBLConfig::qualityName(quality) << std::right
+                  << std::setw(5) << config.environmentSize << std::setw(11) << config.prefilterSize
+                  << std::setw(6) << config.prefilterMipLevels << std::setw(9) << config.sampleCount
+                  << std::fixed << std::setprecision(1) << std::setw(11) << ms
+                  << std::setw(10) << config.gpuMemoryBytes() / (1024.0 * 1024.0) << std::endl;
+    }
 }
 
 